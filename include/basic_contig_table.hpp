@@ -6,23 +6,65 @@
 
 namespace sshash {
 
+/*
+    Maps each contig to the list of its occurrences (encoded contig entries) in the
+    references. Most contigs occur exactly once, so their (only) entry is stored inline,
+    in a dense array indexed by contig id, and marked in m_is_single. For the other
+    contigs, the dense array holds their rank among the contigs occurring more than once,
+    which indexes the Elias-Fano offsets of their lists in m_ctg_entries.
+    Entries are decoded with the codec of the table, so tables built with different
+    numbers of reference position bits can be used in the same process.
+*/
 class basic_contig_table {
 public:
     template <typename Visitor>
     void visit(Visitor& visitor) {
         visitor.visit(m_ref_len_bits);
+        visitor.visit(m_is_single);
+        visitor.visit(m_ctg_inline);
         visitor.visit(m_ctg_offsets);
         visitor.visit(m_ctg_entries);
     }
-  
-    sshash::util::contig_span contig_entries(uint64_t contig_id) {
-      auto start_pos = m_ctg_offsets.access(contig_id);
-      auto end_pos = m_ctg_offsets.access(contig_id + 1);
-      size_t len = end_pos - start_pos;
-      return {m_ctg_entries.at(start_pos), m_ctg_entries.at(start_pos + len), len};
+
+    sshash::util::contig_entry_codec codec() const {
+        return sshash::util::contig_entry_codec(m_ref_len_bits);
+    }
+
+    uint64_t num_contigs() const { return m_is_single.size(); }
+
+    uint64_t num_occurrences(uint64_t contig_id) const {
+        if (m_is_single[contig_id]) return 1;
+        uint64_t rank = m_ctg_inline.access(contig_id);
+        return m_ctg_offsets.access(rank + 1) - m_ctg_offsets.access(rank);
+    }
+
+    sshash::util::contig_span contig_entries(uint64_t contig_id) const {
+        auto [start, len] = entries_range(contig_id);
+        return entries(start, len);
+    }
+
+    /* Where the entries of a contig are: their first position (in m_ctg_inline if the
+       contig occurs once, and in m_ctg_entries otherwise) and their number. */
+    std::pair<uint64_t, uint64_t> entries_range(uint64_t contig_id) const {
+        if (m_is_single[contig_id]) return {contig_id, 1};
+        uint64_t rank = m_ctg_inline.access(contig_id);
+        auto start_pos = m_ctg_offsets.access(rank);
+        auto end_pos = m_ctg_offsets.access(rank + 1);
+        return {start_pos, end_pos - start_pos};
+    }
+
+    /* The entry of a contig that occurs once, at `start` as returned by entries_range. */
+    uint64_t single_entry(uint64_t start) const { return m_ctg_inline.access(start); }
+
+    /* The entries of the range [start, start + len) returned by entries_range. */
+    sshash::util::contig_span entries(uint64_t start, uint64_t len) const {
+        if (len == 1) return {m_ctg_inline.at(start), m_ctg_inline.at(start + 1), 1};
+        return {m_ctg_entries.at(start), m_ctg_entries.at(start + len), len};
     }
 
     uint64_t m_ref_len_bits;
+    pthash::bit_vector m_is_single;
+    pthash::compact_vector m_ctg_inline;
     pthash::compact_vector m_ctg_entries;
     sshash::ef_sequence<false> m_ctg_offsets;
 };
@@ -56,6 +56,24 @@ struct buckets {
         return {begin, end};
     }
 
+    /* Prefetch what locate_bucket(bucket_id) reads. */
+    void prefetch_bucket(uint64_t bucket_id) const {
+        num_super_kmers_before_bucket.prefetch(bucket_id);
+        num_super_kmers_before_bucket.prefetch(bucket_id + 1);
+    }
+
+    /* Prefetch the offset of a super-k-mer. */
+    void prefetch_offset(uint64_t super_kmer_id) const {
+        __builtin_prefetch(offsets.bits().data() + (super_kmer_id * offsets.width()) / 64);
+    }
+
+    /* Prefetch the (at most k - m + 1) k-mers of the super-k-mer starting at `offset`. */
+    void prefetch_super_kmer(uint64_t offset, uint64_t k, uint64_t m) const {
+        uint64_t const* words = strings.data().data();
+        __builtin_prefetch(words + (2 * offset) / 64);
+        __builtin_prefetch(words + (2 * (offset + 2 * k - m)) / 64);
+    }
+
     lookup_result lookup(uint64_t bucket_id, uint64_t target_kmer, uint64_t k, uint64_t m) const {
         auto [begin, end] = locate_bucket(bucket_id);
         return lookup(begin, end, target_kmer, k, m);
@@ -2,6 +2,8 @@
 #include "../../external/pthash/external/essentials/include/essentials.hpp"
 #include "../spdlog/spdlog.h"
 #include "util.hpp"
+#include "checkpoint.hpp"
+#include "build_profile.hpp"
 
 /** build steps **/
 #include "parse_file.hpp"
@@ -13,7 +15,9 @@
 
 namespace sshash {
 
-void dictionary::build(std::string const& filename, build_configuration const& build_config) {
+void dictionary::build(std::string const& filename, build_configuration const& build_config,
+                       segments_callback_t const& on_segments_parsed,
+                       build_checkpoint* checkpoint, build_profile* profile) {
     /* Validate the build configuration. */
     if (build_config.k == 0) throw std::runtime_error("k must be > 0");
     if (build_config.k > constants::max_k) {
@@ -36,20 +40,39 @@ void dictionary::build(std::string const& filename, build_configuration const& b
     timings.reserve(5);
     essentials::timer_type timer;
 
+    auto resumed = [checkpoint](std::string const& step) {
+        return checkpoint != nullptr and checkpoint->done(step);
+    };
+
     /* step 1: parse the input file and build compact string pool ***/
     timer.start();
-    parse_data data = parse_file(filename, build_config);
+    build_profile::step parse_step(profile, "parse_file");
+    bool parsed = resumed("parse_file");
+    parse_data data = parsed ? parse_data(build_config.tmp_dirname)
+                             : parse_file(filename, build_config);
+    if (parsed) checkpoint->load("parse_file", data);
     m_size = data.num_kmers;
+    parse_step.set("restored", parsed);
+    parse_step.set("num_kmers", data.num_kmers);
+    parse_step.set("num_super_kmers", data.strings.num_super_kmers());
+    parse_step.set("num_strings", data.strings.pieces.size() - 1);
+    parse_step.set("num_segments", data.segment_lengths.size());
+    parse_step.finish();
     timer.stop();
     timings.push_back(timer.elapsed());
     print_time(timings.back(), data.num_kmers, "step 1: 'parse_file'");
     timer.reset();
     /******/
 
-    if (build_config.weighted) {
+    if (parsed and build_config.weighted) {
+        checkpoint->load("build_weights", m_weights);
+    } else if (build_config.weighted) {
         /* step 1.1: compress weights ***/
         timer.start();
+        build_profile::step weights_step(profile, "build_weights");
         data.weights_builder.build(m_weights);
+        weights_step.set("num_bits", m_weights.num_bits());
+        weights_step.finish();
         timer.stop();
         timings.push_back(timer.elapsed());
         print_time(timings.back(), data.num_kmers, "step 1.1.: 'build_weights'");
@@ -63,16 +86,46 @@ void dictionary::build(std::string const& filename, build_configuration const& b
         }
     }
 
+    if (checkpoint and !parsed) {
+        if (build_config.weighted) checkpoint->save("build_weights", m_weights);
+        checkpoint->save("parse_file", data);
+    }
+    if (on_segments_parsed) {
+        on_segments_parsed(std::move(data.segment_ids), std::move(data.segment_lengths));
+    }
+
     /* step 2: merge minimizers and build MPHF ***/
     timer.start();
-    data.minimizers.merge();
     {
+        build_profile::step merge_step(profile, "merge_minimizers");
+        merge_step.set("restored", resumed("merge_minimizers"));
+        if (resumed("merge_minimizers")) {
+            checkpoint->load("merge_minimizers", data.minimizers);
+        } else {
+            data.minimizers.merge();
+            /* the merge removes the unmerged files, so it must be checkpointed on its own */
+            if (checkpoint) checkpoint->save("merge_minimizers", data.minimizers);
+        }
+        merge_step.set("num_minimizers", data.minimizers.num_minimizers());
+        if (data.minimizers.num_minimizers() > 0) {
+            merge_step.set("tmp_file_bytes", build_profile::file_bytes(
+                                                 data.minimizers.get_minimizers_filename()));
+        }
+    }
+    build_profile::step minimizers_step(profile, "build_minimizers");
+    minimizers_step.set("restored", resumed("build_minimizers"));
+    if (resumed("build_minimizers")) {
+        checkpoint->load("build_minimizers", m_minimizers);
+    } else {
         mm::file_source<minimizer_tuple> input(data.minimizers.get_minimizers_filename(),
                                                mm::advice::sequential);
         minimizers_tuples_iterator iterator(input.data(), input.data() + input.size());
         m_minimizers.build(iterator, data.minimizers.num_minimizers(), build_config);
         input.close();
+        if (checkpoint) checkpoint->save("build_minimizers", m_minimizers);
     }
+    minimizers_step.set("num_bits", m_minimizers.num_bits());
+    minimizers_step.finish();
     timer.stop();
     timings.push_back(timer.elapsed());
     print_time(timings.back(), data.num_kmers, "step 2: 'build_minimizers'");
@@ -81,7 +134,20 @@ void dictionary::build(std::string const& filename, build_configuration const& b
 
     /* step 3: build index ***/
     timer.start();
-    auto buckets_stats = build_index(data, m_minimizers, m_buckets, build_config);
+    build_profile::step index_step(profile, "build_index");
+    index_step.set("restored", resumed("build_index"));
+    buckets_statistics buckets_stats;
+    if (resumed("build_index")) {
+        checkpoint->load("build_index", m_buckets, buckets_stats);
+    } else {
+        buckets_stats = build_index(data, m_minimizers, m_buckets, build_config);
+        if (checkpoint) checkpoint->save("build_index", m_buckets, buckets_stats);
+    }
+    index_step.set("num_buckets", buckets_stats.num_buckets());
+    index_step.set("max_num_super_kmers_in_bucket",
+                   buckets_stats.max_num_super_kmers_in_bucket());
+    index_step.set("num_bits", m_buckets.num_bits());
+    index_step.finish();
     timer.stop();
     timings.push_back(timer.elapsed());
     print_time(timings.back(), data.num_kmers, "step 3: 'build_index'");
@@ -90,7 +156,24 @@ void dictionary::build(std::string const& filename, build_configuration const& b
 
     /* step 4: build skew index ***/
     timer.start();
-    build_skew_index(m_skew_index, data, m_buckets, build_config, buckets_stats);
+    build_profile::step skew_step(profile, "build_skew_index");
+    skew_step.set("restored", resumed("build_skew_index"));
+    if (resumed("build_skew_index")) {
+        checkpoint->load("build_skew_index", m_skew_index);
+    } else {
+        build_skew_index(m_skew_index, data, m_buckets, build_config, buckets_stats);
+        if (checkpoint) checkpoint->save("build_skew_index", m_skew_index);
+    }
+    {
+        std::vector<uint64_t> num_kmers_in_partition;
+        for (auto const& mphf : m_skew_index.mphfs) {
+            num_kmers_in_partition.push_back(mphf.num_keys());
+        }
+        skew_step.set("num_partitions", m_skew_index.mphfs.size());
+        skew_step.set("num_kmers_in_partition", num_kmers_in_partition);
+        skew_step.set("num_bits", m_skew_index.num_bits());
+    }
+    skew_step.finish();
     timer.stop();
     timings.push_back(timer.elapsed());
     print_time(timings.back(), data.num_kmers, "step 4: 'build_skew_index'");
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+
+#include "../json.hpp"
+
+namespace sshash {
+
+/*
+    Resource usage of the process at some point in time. On Linux, the I/O counters and
+    the current and peak resident set size are read from /proc; elsewhere they are 0,
+    except for the peak resident set size which is then the one of getrusage.
+    The I/O counters are those of the whole process: they include the reads of the
+    inputs, the writes of the outputs and the I/O of any other thread.
+*/
+struct resource_usage {
+    double wall_seconds;
+    double cpu_seconds;         // user + system time of the whole process
+    double thread_cpu_seconds;  // user + system time of the calling thread
+    uint64_t rss_bytes;
+    uint64_t peak_rss_bytes;
+    uint64_t read_chars;            // bytes read by read-like system calls
+    uint64_t write_chars;           // bytes written by write-like system calls
+    uint64_t storage_read_bytes;    // bytes fetched from storage (includes mmap'ed reads)
+    uint64_t storage_write_bytes;   // bytes sent to storage
+
+    static resource_usage now() {
+        resource_usage u{};
+        u.wall_seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now().time_since_epoch())
+                             .count();
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        u.cpu_seconds = seconds(ru.ru_utime) + seconds(ru.ru_stime);
+#ifdef __linux__
+        getrusage(RUSAGE_THREAD, &ru);
+        u.thread_cpu_seconds = seconds(ru.ru_utime) + seconds(ru.ru_stime);
+        std::ifstream status("/proc/self/status");
+        for (std::string key; status >> key;) {
+            uint64_t kb = 0;
+            if (key == "VmRSS:" and status >> kb) u.rss_bytes = kb * 1024;
+            if (key == "VmHWM:" and status >> kb) u.peak_rss_bytes = kb * 1024;
+        }
+        std::ifstream io("/proc/self/io");
+        for (std::string key; io >> key;) {
+            uint64_t value = 0;
+            if (!(io >> value)) break;
+            if (key == "rchar:") u.read_chars = value;
+            if (key == "wchar:") u.write_chars = value;
+            if (key == "read_bytes:") u.storage_read_bytes = value;
+            if (key == "write_bytes:") u.storage_write_bytes = value;
+        }
+#else
+        u.thread_cpu_seconds = u.cpu_seconds;
+        u.peak_rss_bytes = ru.ru_maxrss;  // in bytes on macOS
+#endif
+        return u;
+    }
+
+    /* Reset the peak resident set size to the current one, where supported,
+       so that the peak of the next step can be measured. */
+    static void reset_peak_rss() {
+#ifdef __linux__
+        std::ofstream clear_refs("/proc/self/clear_refs");
+        if (clear_refs.good()) clear_refs << "5" << std::endl;
+#endif
+    }
+
+private:
+    static double seconds(struct timeval const& tv) { return tv.tv_sec + tv.tv_usec / 1e6; }
+};
+
+/*
+    Machine-readable profile of an index build: for each (sub-)step, its wall and CPU
+    time, memory and I/O, and the key sizes of what it built.
+*/
+struct build_profile {
+    build_profile() : m_start(resource_usage::now()) {}
+
+    /*
+        Measures a step from its construction to its destruction (or to `finish`).
+        The CPU time is the one of the process, unless the step is `concurrent` with
+        others, in which case it is the one of the calling thread. Sub-steps are steps
+        nested in another one, and are named "<step>/<sub-step>". Steps are listed in the
+        order in which they finish. A step of a null profile measures nothing.
+
+        The peak resident set size is that of the process, so it can only be attributed
+        to a step that runs alone. A concurrent step reports none, and while one runs the
+        peak is not reset: the steps overlapping it report the peak since the last reset
+        (an upper bound of theirs), and are marked with "peak_rss_includes_concurrent".
+    */
+    struct step {
+        step(build_profile* profile, std::string const& name, bool concurrent = false)
+            : m_profile(profile), m_concurrent(concurrent) {
+            if (!m_profile) return;
+            m_info["name"] = name;
+            std::lock_guard<std::mutex> lock(m_profile->m_mutex);
+            m_first_step = m_profile->m_steps.size();
+            m_concurrent_steps_started = m_profile->m_concurrent_steps_started;
+            if (m_concurrent) {
+                ++m_profile->m_concurrent_steps_running;
+                ++m_profile->m_concurrent_steps_started;
+            } else if (m_profile->m_concurrent_steps_running == 0) {
+                resource_usage::reset_peak_rss();
+            } else {
+                m_peak_shared = true;
+            }
+            m_start = resource_usage::now();
+        }
+
+        /* Record a key size (or any other property) of the step. */
+        template <typename T>
+        void set(std::string const& key, T const& value) {
+            if (m_profile) m_info["stats"][key] = value;
+        }
+
+        ~step() { finish(); }
+
+        void finish() {
+            if (!m_profile or m_finished) return;
+            m_finished = true;
+            auto end = resource_usage::now();
+            double wall = end.wall_seconds - m_start.wall_seconds;
+            double cpu = m_concurrent ? end.thread_cpu_seconds - m_start.thread_cpu_seconds
+                                      : end.cpu_seconds - m_start.cpu_seconds;
+            m_info["wall_seconds"] = wall;
+            m_info["cpu_seconds"] = cpu;
+            m_info["avg_busy_threads"] = wall > 0 ? cpu / wall : 0.0;
+            m_info["rss_bytes"] = end.rss_bytes;
+            m_info["process_io"] = {
+                {"read_chars", end.read_chars - m_start.read_chars},
+                {"write_chars", end.write_chars - m_start.write_chars},
+                {"storage_read_bytes", end.storage_read_bytes - m_start.storage_read_bytes},
+                {"storage_write_bytes", end.storage_write_bytes - m_start.storage_write_bytes}};
+            if (m_concurrent) m_info["concurrent"] = true;
+
+            std::lock_guard<std::mutex> lock(m_profile->m_mutex);
+            // the peak was reset by the sub-steps, so it is the largest of theirs and ours
+            uint64_t peak = end.peak_rss_bytes;
+            for (uint64_t i = m_first_step; i != m_profile->m_steps.size(); ++i) {
+                peak = std::max<uint64_t>(peak,
+                                          m_profile->m_steps[i].value("peak_rss_bytes", uint64_t(0)));
+            }
+            m_profile->m_peak_rss_bytes = std::max(m_profile->m_peak_rss_bytes, peak);
+            if (m_concurrent) {
+                --m_profile->m_concurrent_steps_running;
+            } else {
+                m_peak_shared = m_peak_shared or m_profile->m_concurrent_steps_running != 0 or
+                                m_profile->m_concurrent_steps_started != m_concurrent_steps_started;
+                m_info["peak_rss_bytes"] = peak;
+                if (m_peak_shared) m_info["peak_rss_includes_concurrent"] = true;
+            }
+            m_profile->m_steps.push_back(std::move(m_info));
+        }
+
+    private:
+        build_profile* m_profile;
+        bool m_concurrent;
+        bool m_finished{false};
+        bool m_peak_shared{false};
+        uint64_t m_first_step{0};
+        uint64_t m_concurrent_steps_started{0};
+        resource_usage m_start{};
+        nlohmann::json m_info;
+    };
+
+    /* Write the profile, along with `info` about the build, to `filename`. */
+    bool save(std::string const& filename, nlohmann::json info) const {
+        auto end = resource_usage::now();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        info["steps"] = m_steps;
+        info["total"] = {
+            {"wall_seconds", end.wall_seconds - m_start.wall_seconds},
+            {"cpu_seconds", end.cpu_seconds - m_start.cpu_seconds},
+            {"peak_rss_bytes", std::max(m_peak_rss_bytes, end.peak_rss_bytes)},
+            {"process_io",
+             {{"read_chars", end.read_chars - m_start.read_chars},
+              {"write_chars", end.write_chars - m_start.write_chars},
+              {"storage_read_bytes", end.storage_read_bytes - m_start.storage_read_bytes},
+              {"storage_write_bytes", end.storage_write_bytes - m_start.storage_write_bytes}}}};
+        std::ofstream out(filename);
+        if (!out.good()) return false;
+        out << std::setw(4) << info << std::endl;
+        return out.good();
+    }
+
+    /* Size in bytes of the (temporary) file `filename`, or 0 if it does not exist. */
+    static uint64_t file_bytes(std::string const& filename) {
+        std::ifstream in(filename, std::ifstream::binary | std::ifstream::ate);
+        return in.good() ? static_cast<uint64_t>(in.tellg()) : 0;
+    }
+
+private:
+    resource_usage m_start;
+    uint64_t m_peak_rss_bytes{0};
+    uint64_t m_concurrent_steps_running{0};
+    uint64_t m_concurrent_steps_started{0};
+    std::vector<nlohmann::json> m_steps;
+    mutable std::mutex m_mutex;
+};
+
+}  // namespace sshash
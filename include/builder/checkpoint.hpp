@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+#include "../util.hpp"
+#include "../ghc/filesystem.hpp"
+#include "../../external/pthash/external/essentials/include/essentials.hpp"
+#include "../json.hpp"
+#include "../spdlog/spdlog.h"
+
+namespace sshash {
+
+/*
+    Checkpoints of a restartable build.
+
+    Once a build step is done, its outputs are saved to a file in the tmp directory
+    and the step is recorded in a manifest. A build that is resumed with the same
+    inputs and configuration skips the recorded steps and loads their outputs instead.
+    The manifest is only ever replaced by renaming a complete copy over it, so a build
+    that dies while writing a checkpoint resumes from the previous step.
+*/
+struct build_checkpoint {
+    build_checkpoint(std::string const& tmp_dirname, std::string const& name)
+        : m_prefix(tmp_dirname + "/sshash.ckpt." + name) {}
+
+    /* Resume from the existing manifest if it was written for the same `fingerprint`
+       (inputs and configuration), otherwise discard it and start over. */
+    void open(nlohmann::json const& fingerprint) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_fingerprint = fingerprint;
+        m_steps.clear();
+        std::ifstream in(manifest_filename());
+        if (in.good()) {
+            nlohmann::json manifest;
+            try {
+                in >> manifest;
+            } catch (nlohmann::json::exception const& e) {
+                spdlog::warn("cannot parse checkpoint manifest {}: {}", manifest_filename(),
+                             e.what());
+            }
+            std::vector<std::string> steps;
+            if (manifest.contains("steps")) {
+                steps = manifest["steps"].get<std::vector<std::string>>();
+            }
+            if (manifest.contains("fingerprint") and manifest["fingerprint"] == fingerprint) {
+                m_steps = steps;
+                spdlog::info("resuming build from {}: {} step(s) already done.",
+                             manifest_filename(), m_steps.size());
+            } else {
+                spdlog::warn(
+                    "the inputs or the configuration changed since checkpoint {} was written; "
+                    "starting over.",
+                    manifest_filename());
+                for (auto const& step : steps) std::remove(filename(step).c_str());
+            }
+        }
+        write_manifest();
+    }
+
+    bool done(std::string const& step) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return std::find(m_steps.begin(), m_steps.end(), step) != m_steps.end();
+    }
+
+    /* Name of the file holding the outputs of `step`. */
+    std::string filename(std::string const& step) const { return m_prefix + "." + step + ".bin"; }
+
+    /* Save the outputs of `step` and record the step as done. */
+    template <typename... Data>
+    void save(std::string const& step, Data&... data) {
+        {
+            essentials::saver saver(filename(step).c_str());
+            (saver.visit(data), ...);
+        }
+        mark_done(step);
+    }
+
+    template <typename... Data>
+    void load(std::string const& step, Data&... data) const {
+        essentials::loader loader(filename(step).c_str());
+        (loader.visit(data), ...);
+        spdlog::info("step '{}' restored from checkpoint.", step);
+    }
+
+    /* Record `step` as done (for steps whose outputs are written elsewhere). */
+    void mark_done(std::string const& step) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_steps.push_back(step);
+        write_manifest();
+    }
+
+    /* The build is complete: remove all checkpoints and the manifest. */
+    void remove() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto const& step : m_steps) std::remove(filename(step).c_str());
+        m_steps.clear();
+        std::remove(manifest_filename().c_str());
+    }
+
+private:
+    std::string m_prefix;
+    nlohmann::json m_fingerprint;
+    std::vector<std::string> m_steps;
+    mutable std::mutex m_mutex;
+
+    std::string manifest_filename() const { return m_prefix + ".manifest.json"; }
+
+    void write_manifest() const {
+        nlohmann::json manifest;
+        manifest["fingerprint"] = m_fingerprint;
+        manifest["steps"] = m_steps;
+        std::string tmp_filename = manifest_filename() + ".tmp";
+        {
+            std::ofstream out(tmp_filename);
+            out << manifest.dump(4) << std::endl;
+            if (!out.good()) throw std::runtime_error("cannot write file '" + tmp_filename + "'");
+        }
+        if (std::rename(tmp_filename.c_str(), manifest_filename().c_str()) != 0) {
+            throw std::runtime_error("cannot write file '" + manifest_filename() + "'");
+        }
+    }
+};
+
+/* Cheap signature of the file `filename`, which must exist: its size and
+   modification time, and a checksum of a fixed number of blocks sampled evenly
+   across it (the whole file, if it is small). Deciding whether a build can be
+   resumed must not cost an extra full pass over the (large) input files. */
+inline std::string file_signature(std::string const& filename) {
+    constexpr uint64_t num_samples = 64;
+    constexpr uint64_t block_size = 1 << 16;
+    std::ifstream in(filename.c_str(), std::ifstream::binary);
+    if (!in.good()) throw std::runtime_error("error in opening the file '" + filename + "'");
+    uint64_t size = ghc::filesystem::file_size(filename);
+    auto mtime = ghc::filesystem::last_write_time(filename).time_since_epoch().count();
+
+    std::vector<char> buffer(block_size);
+    uint64_t checksum = 0;
+    auto hash_block = [&](uint64_t offset) {
+        in.seekg(offset);
+        in.read(buffer.data(), std::min(block_size, size - offset));
+        uint64_t n = in.gcount();
+        checksum = pthash::MurmurHash2_64(buffer.data(), n, checksum);
+    };
+    if (size <= num_samples * block_size) {
+        for (uint64_t offset = 0; offset < size; offset += block_size) hash_block(offset);
+    } else {
+        // the first and the last block are always sampled
+        uint64_t stride = (size - block_size) / (num_samples - 1);
+        for (uint64_t i = 0; i != num_samples - 1; ++i) hash_block(i * stride);
+        hash_block(size - block_size);
+    }
+
+    // a single string, so that the manifest compares and shows it as one value
+    std::stringstream signature;
+    signature << size << ':' << mtime << ':' << std::hex << checksum;
+    return signature.str();
+}
+
+}  // namespace sshash
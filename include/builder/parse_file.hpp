@@ -11,6 +11,20 @@ struct parse_data {
     minimizers_tuples minimizers;
     compact_string_pool strings;
     weights::builder weights_builder;
+
+    /* identifier and length of every segment of the input, in file order */
+    std::vector<uint64_t> segment_ids;
+    std::vector<uint32_t> segment_lengths;
+
+    /* the weights are not visited: they are compressed right after parsing */
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visitor.visit(num_kmers);
+        visitor.visit(minimizers);
+        visitor.visit(strings);
+        visitor.visit(segment_ids);
+        visitor.visit(segment_lengths);
+    }
 };
 
 void parse_file_from_cuttlefish(std::istream& is, parse_data& data,
@@ -82,6 +96,10 @@ void parse_file_from_cuttlefish(std::istream& is, parse_data& data,
     while (!is.eof()) {
         std::getline(is, sequence);  // header sequence
         auto tsep = sequence.find('\t');
+        if (tsep != std::string::npos) {
+            data.segment_ids.push_back(std::stoull(sequence.substr(0, tsep)));
+            data.segment_lengths.push_back(sequence.size() - (tsep + 1));
+        }
         sequence = sequence.substr(tsep + 1);
         if (sequence.size() < k) continue;
 
@@ -91,6 +91,13 @@ struct compact_string_pool {
     uint64_t num_bits() const { return strings.size(); }
     uint64_t num_super_kmers() const { return m_num_super_kmers; }
 
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visitor.visit(pieces);
+        visitor.visit(strings);
+        visitor.visit(m_num_super_kmers);
+    }
+
     std::vector<uint64_t> pieces;
     pthash::bit_vector strings;
 
@@ -318,6 +325,15 @@ struct minimizers_tuples {
     uint64_t num_minimizers() const { return m_num_minimizers; }
     void remove_tmp_file() { std::remove(get_minimizers_filename().c_str()); }
 
+    /* Visits the state needed to find the (finalized) tmp files again. */
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        assert(m_buffer.empty());
+        visitor.visit(m_num_files_to_merge);
+        visitor.visit(m_num_minimizers);
+        visitor.visit(m_run_identifier);
+    }
+
 private:
     uint64_t m_buffer_size;
     uint64_t m_num_files_to_merge;
@@ -55,6 +55,25 @@ lookup_result dictionary::lookup_uint64_canonical_parsing(uint64_t uint64_kmer)
     return m_buckets.lookup_canonical(begin, end, uint64_kmer, uint64_kmer_rc, m_k, m_m);
 }
 
+uint64_t dictionary::prefetch_bucket_canonical(uint64_t uint64_kmer, uint64_t uint64_kmer_rc,
+                                               uint64_t& minimizer) const {
+    minimizer = std::min<uint64_t>(util::compute_minimizer(uint64_kmer, m_k, m_m, m_seed),
+                                   util::compute_minimizer(uint64_kmer_rc, m_k, m_m, m_seed));
+    uint64_t bucket_id = m_minimizers.lookup(minimizer);
+    m_buckets.prefetch_bucket(bucket_id);
+    return bucket_id;
+}
+
+std::pair<uint64_t, uint64_t> dictionary::prefetch_first_super_kmer(uint64_t bucket_id) const {
+    auto range = m_buckets.locate_bucket(bucket_id);
+    m_buckets.prefetch_offset(range.first);
+    return range;
+}
+
+void dictionary::prefetch_super_kmer(uint64_t super_kmer_id) const {
+    m_buckets.prefetch_super_kmer(m_buckets.offsets.access(super_kmer_id), m_k, m_m);
+}
+
 uint64_t dictionary::lookup(char const* string_kmer, bool check_reverse_complement_too) const {
     uint64_t uint64_kmer = util::string_to_uint64_no_reverse(string_kmer, m_k);
     return lookup_uint64(uint64_kmer, check_reverse_complement_too);
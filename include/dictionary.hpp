@@ -1,5 +1,7 @@
 #pragma once
 
+#include <functional>
+
 #include "util.hpp"
 #include "minimizers.hpp"
 #include "buckets.hpp"
@@ -12,10 +14,24 @@ namespace mindex {
 
 namespace sshash {
 
+struct build_checkpoint;
+struct build_profile;
+struct index_profiler;
+
 struct dictionary {
     dictionary() : m_size(0), m_seed(0), m_k(0), m_m(0), m_canonical_parsing(0) {}
 
-    void build(std::string const& filename, build_configuration const& build_config);
+    /* Invoked once the input file has been parsed (and before the MPHF and the index are
+       built) with the identifier and length of every input segment, in file order. */
+    typedef std::function<void(std::vector<uint64_t>&&, std::vector<uint32_t>&&)>
+        segments_callback_t;
+
+    /* If `checkpoint` is not null, the outputs of each build step are checkpointed
+       there, and the steps it has already recorded are restored instead of rebuilt.
+       If `profile` is not null, the resources used by each build step are recorded there. */
+    void build(std::string const& filename, build_configuration const& build_config,
+               segments_callback_t const& on_segments_parsed = nullptr,
+               build_checkpoint* checkpoint = nullptr, build_profile* profile = nullptr);
 
     uint64_t size() const { return m_size; }
     uint64_t seed() const { return m_seed; }
@@ -44,8 +60,21 @@ struct dictionary {
     bool is_member(char const* string_kmer, bool check_reverse_complement_too = true) const;
     bool is_member_uint64(uint64_t uint64_kmer, bool check_reverse_complement_too = true) const;
 
+    /* Staged prefetching of the data read by the lookup of a k-mer (with canonical parsing),
+       for callers that interleave several lookups to hide the memory latency. Each step
+       reads what the previous one prefetched and prefetches what the next one reads:
+       the bounds of the bucket of the k-mer, the offset of its first super-k-mer and,
+       finally, the k-mers of that super-k-mer. The (canonical) minimizer of the k-mer and
+       the range of super-k-mers of its bucket are returned along the way, so that the
+       lookup itself can be given them (see streaming_query_canonical_parsing). */
+    uint64_t prefetch_bucket_canonical(uint64_t uint64_kmer, uint64_t uint64_kmer_rc,
+                                       uint64_t& minimizer) const;
+    std::pair<uint64_t, uint64_t> prefetch_first_super_kmer(uint64_t bucket_id) const;
+    void prefetch_super_kmer(uint64_t super_kmer_id) const;
+
     friend struct streaming_query_canonical_parsing;
     friend struct streaming_query_regular_parsing;
+    friend struct index_profiler;
     friend class ::mindex::reference_index;
     
     streaming_query_report streaming_query_from_file(std::string const& filename,
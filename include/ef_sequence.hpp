@@ -85,6 +85,16 @@ struct ef_sequence {
                m_low_bits.access(i);
     }
 
+    // Prefetch what access(i) reads: the low bits of the i-th element and the word
+    // of its high bits, estimated as if the elements were evenly spread in [0,back()].
+    inline void prefetch(uint64_t i) const {
+        assert(i < size());
+        uint64_t l = m_low_bits.width();
+        __builtin_prefetch(m_low_bits.bits().data() + (i * l) / 64);
+        uint64_t high_pos = i + (((m_universe / size()) * i) >> l);
+        __builtin_prefetch(m_high_bits.data().data() + high_pos / 64);
+    }
+
     // inline uint64_t diff(uint64_t i) const {
     //     assert(i < size() && encode_prefix_sum);
     //     uint64_t low1 = m_low_bits.access(i);
@@ -13,14 +13,77 @@
 #include <algorithm>
 #include <iostream>
 #include <iterator>
+#include <map>
+#include <memory>
 
 namespace mindex {
+
+// How the hit search moves along a read between k-mer lookups.
+//  * EXHAUSTIVE looks up every k-mer of the read.
+//  * PASC skips along the contigs of the hits, and backs off after misses.
+//  * AGGRESSIVE skips as PASC, but further before the first hit and after misses.
+//  * ADAPTIVE is PASC on short reads, and scales the skips after misses with
+//    the length of longer ones.
+//  * SAMPLED looks up the first k-mer of each super-k-mer of the read (the
+//    runs of at most k - m + 1 k-mers sharing a minimizer, as in the index),
+//    and the last one as well when the first is a miss.
+enum class SkippingStrategy : uint8_t { EXHAUSTIVE = 0, PASC, AGGRESSIVE, ADAPTIVE, SAMPLED };
+
+inline const std::map<std::string, SkippingStrategy>& skipping_strategy_names() {
+  static const std::map<std::string, SkippingStrategy> names{
+      {"exhaustive", SkippingStrategy::EXHAUSTIVE},
+      {"pasc", SkippingStrategy::PASC},
+      {"aggressive", SkippingStrategy::AGGRESSIVE},
+      {"adaptive", SkippingStrategy::ADAPTIVE},
+      {"sampled", SkippingStrategy::SAMPLED}};
+  return names;
+}
+
+struct skipping_policy {
+  skipping_policy() = default;
+
+  explicit skipping_policy(SkippingStrategy s) : strategy(s) {
+    if (strategy == SkippingStrategy::AGGRESSIVE) {
+      no_hit_skip = 8;
+      halving_misses = 2;
+      min_backoff = 4;
+    }
+  }
+
+  // The policy to use on a read of length `read_len`.
+  skipping_policy for_read(int32_t read_len) const {
+    skipping_policy p(*this);
+    if (strategy == SkippingStrategy::ADAPTIVE and read_len > 100) {
+      p.no_hit_skip = read_len / 20;
+      p.halving_misses = 3;
+      p.min_backoff = read_len / 50;
+    }
+    return p;
+  }
+
+  inline bool exhaustive() const { return strategy == SkippingStrategy::EXHAUSTIVE; }
+  inline bool sampled() const { return strategy == SkippingStrategy::SAMPLED; }
+
+  SkippingStrategy strategy{SkippingStrategy::PASC};
+  // the skip after a miss, as long as no hit was found on the read
+  int32_t no_hit_skip{5};
+  // after a miss that follows a skip, the search backs off halfway to the
+  // position it skipped from for the first `halving_misses` misses, and by 
+  // `min_backoff` positions after that (and never by less).
+  int32_t halving_misses{4};
+  int32_t min_backoff{2};
+};
+
 class hit_searcher {
 enum class ExpansionTerminationType : uint8_t { MISMATCH = 0, CONTIG_END, READ_END };  
 
 public:
   explicit hit_searcher(reference_index* pfi) : pfi_(pfi) { 
     k = static_cast<size_t>(pfi_->k()); 
+    if (pfi_->has_delta()) {
+      delta_qc_.reset(
+          new sshash::streaming_query_canonical_parsing(pfi_->get_delta()->get_dict()));
+    }
   }
   
   bool get_raw_hits_sketch(std::string &read,
@@ -30,12 +93,19 @@ public:
 
 void clear();
 
-void setAltSkip(uint32_t altSkip);
+inline void set_skipping_policy(const skipping_policy& policy) { policy_ = policy; }
+inline const skipping_policy& get_skipping_policy() const { return policy_; }
+
+// The number of lookups into the index (the base layer, for an index with
+// a delta), and of the fast checks against the k-mers expected on the 
+// contigs of previous hits, made by get_raw_hits_sketch() so far.
+inline uint64_t num_lookups() const { return num_lookups_; }
+inline uint64_t num_fast_checks() const { return num_fast_checks_; }
 
-inline std::vector<std::pair<int, projected_hits>>& get_left_hits() { 
+inline std::vector<raw_hit>& get_left_hits() { 
   return left_rawHits;
 }
-inline std::vector<std::pair<int, projected_hits>>& get_right_hits() {
+inline std::vector<raw_hit>& get_right_hits() {
   return right_rawHits;
 }
 
@@ -43,12 +113,46 @@ inline reference_index* get_index() const { return pfi_; }
 
 private:
   reference_index* pfi_;
+  // streaming query over the delta layer of the index (if there is one)
+  std::unique_ptr<sshash::streaming_query_canonical_parsing> delta_qc_;
   size_t k;
-  uint32_t altSkip{3};
+  skipping_policy policy_;
+  uint64_t num_lookups_{0};
+  uint64_t num_fast_checks_{0};
 
   bool isSingleEnd = false;
-  std::vector<std::pair<int, projected_hits>> left_rawHits;
-  std::vector<std::pair<int, projected_hits>> right_rawHits;
+  std::vector<raw_hit> left_rawHits;
+  std::vector<raw_hit> right_rawHits;
+};
+
+// Collects the raw hits of a batch of reads, interleaving the hit searches 
+// of up to `width` of them to hide the latency of the index lookups: each 
+// search stops before a lookup, whose data is prefetched in a few dependent 
+// steps while the other searches make progress. The hits of each read are 
+// the same as those `hit_searcher::get_raw_hits_sketch` would collect.
+class batched_hit_searcher {
+public:
+  batched_hit_searcher(reference_index* pfi, size_t width, 
+                       const skipping_policy& policy = skipping_policy());
+  ~batched_hit_searcher();
+
+  // After this call, `get_hits(i)` holds the raw hits of `*reads[i]`.
+  void get_raw_hits_sketch(const std::vector<std::string*>& reads);
+
+  inline std::vector<raw_hit>& get_hits(size_t i) {
+    return rawHits_[i];
+  }
+
+  inline size_t width() const { return slots_.size(); }
+
+private:
+  struct search_slot;
+
+  reference_index* pfi_;
+  size_t k;
+  skipping_policy policy_;
+  std::vector<std::unique_ptr<search_slot>> slots_;
+  std::vector<std::vector<raw_hit>> rawHits_;
 };
 }
 #endif // HIT_SEARCHER
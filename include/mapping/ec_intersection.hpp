@@ -0,0 +1,112 @@
+#pragma once
+
+#include "../include/parallel_hashmap/phmap.h"
+#include "../include/wyhash.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+namespace mapping {
+
+namespace util {
+
+// The sets of (target, orientation) labels met while pseudoaligning reads, and
+// their pairwise intersections, for one thread. A label is (tid << 1) | is_fw, and
+// a set is kept sorted. Each distinct set is stored once and named by an id (0
+// being the empty set), so that intersecting the same two sets again, which is
+// the common case for the reads of highly expressed targets, is a hash lookup.
+class ec_intersection_cache {
+public:
+    static constexpr uint32_t empty_set = 0;
+
+    ec_intersection_cache() { clear(); }
+
+    // The id of the label set of the hits with `key`, calling fill(labels) to
+    // build it (in any order, possibly with duplicates) the first time.
+    template <typename Fill>
+    inline uint32_t leaf(uint64_t key, Fill fill) {
+        auto it = m_leaf_ids.find(key);
+        if (it != m_leaf_ids.end()) { return it->second; }
+        m_scratch.clear();
+        fill(m_scratch);
+        uint32_t id = intern_unsorted();
+        m_leaf_ids.emplace(key, id);
+        return id;
+    }
+
+    // The id of a label set that is not cached by key (built by fill as in leaf()).
+    template <typename Fill>
+    inline uint32_t uncached(Fill fill) {
+        m_scratch.clear();
+        fill(m_scratch);
+        return intern_unsorted();
+    }
+
+    inline uint32_t intersect(uint32_t a, uint32_t b) {
+        if (a == b) { return a; }
+        if (a == empty_set or b == empty_set) { return empty_set; }
+        uint64_t key = (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+        auto it = m_pair_ids.find(key);
+        if (it != m_pair_ids.end()) { return it->second; }
+        auto& sa = m_sets[a];
+        auto& sb = m_sets[b];
+        m_scratch.clear();
+        std::set_intersection(sa.begin(), sa.end(), sb.begin(), sb.end(),
+                              std::back_inserter(m_scratch));
+        uint32_t id = (m_scratch.size() == sa.size())   ? a
+                      : (m_scratch.size() == sb.size()) ? b
+                                                        : intern();
+        m_pair_ids.emplace(key, id);
+        return id;
+    }
+
+    inline const std::vector<uint64_t>& labels(uint32_t id) const { return m_sets[id]; }
+
+    // Drops every set once they hold more than max_labels labels in all. Must only be
+    // called between reads, as it invalidates the ids.
+    inline void trim(size_t max_labels = size_t(1) << 22) {
+        if (m_num_labels > max_labels) { clear(); }
+    }
+
+private:
+    inline void clear() {
+        m_sets.clear();
+        m_sets.emplace_back();
+        m_leaf_ids.clear();
+        m_pair_ids.clear();
+        m_content_ids.clear();
+        m_num_labels = 0;
+    }
+
+    inline uint32_t intern_unsorted() {
+        std::sort(m_scratch.begin(), m_scratch.end());
+        m_scratch.erase(std::unique(m_scratch.begin(), m_scratch.end()), m_scratch.end());
+        return intern();
+    }
+
+    // the id of the set in m_scratch, adding it if it is new
+    inline uint32_t intern() {
+        if (m_scratch.empty()) { return empty_set; }
+        uint64_t h = wyhash(m_scratch.data(), m_scratch.size() * sizeof(uint64_t), 0, _wyp);
+        auto it = m_content_ids.find(h);
+        if (it != m_content_ids.end() and m_sets[it->second] == m_scratch) { return it->second; }
+        uint32_t id = static_cast<uint32_t>(m_sets.size());
+        m_sets.push_back(m_scratch);
+        m_num_labels += m_scratch.size();
+        // on a collision of hashes, the first set keeps the entry
+        m_content_ids.emplace(h, id);
+        return id;
+    }
+
+    std::vector<std::vector<uint64_t>> m_sets;
+    phmap::flat_hash_map<uint64_t, uint32_t> m_leaf_ids;
+    phmap::flat_hash_map<uint64_t, uint32_t> m_pair_ids;
+    phmap::flat_hash_map<uint64_t, uint32_t> m_content_ids;
+    std::vector<uint64_t> m_scratch;
+    size_t m_num_labels{0};
+};
+
+}  // namespace util
+}  // namespace mapping
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "../include/parallel_hashmap/phmap.h"
+#include "../include/itlib/small_vector.hpp"
+#include "../include/mapping/utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace mapping {
+
+namespace util {
+
+// How long reads are split into windows by long_read_mapper.
+struct long_read_options {
+    // reads longer than this are mapped in windows of this length (0 = never)
+    uint32_t window_len{0};
+    // the number of bases shared by consecutive windows
+    uint32_t window_overlap{100};
+
+    inline bool enabled() const { return window_len > 0; }
+    inline bool applies_to(size_t read_len) const { return enabled() and read_len > window_len; }
+};
+
+// Maps long reads (e.g. of nanopore cDNA) as a series of overlapping windows.
+// Each window is mapped on its own, as a short read would be, so that the state
+// map_read keeps for a read (its hit_map, and the chains of each target) only
+// ever covers a window. The mappings of the windows are then merged into chains
+// that span the read: the mappings of two windows to the same target, in the
+// same orientation, join the same chain if they place the start of the read at
+// about the same position. At most max_chains_per_target chains are kept for a
+// (target, orientation), so that the state of a read grows with the number of
+// targets its windows map to, but not with its length. The read maps to the
+// chains supported by the most windows.
+//
+// The windows are independent of one another, but are mapped in turn by the
+// thread that maps the read: the threads of the mapper already map distinct reads.
+class long_read_mapper {
+public:
+    static constexpr size_t max_chains_per_target = 4;
+
+    explicit long_read_mapper(const long_read_options& opts) : m_opts(opts) {
+        if (m_opts.window_overlap >= m_opts.window_len) {
+            m_opts.window_overlap = m_opts.window_len / 2;
+        }
+    }
+
+    inline const long_read_options& options() const { return m_opts; }
+
+    // Maps `read_seq` window by window with map_cache, leaving its merged mappings
+    // in map_cache (map_type, accepted_hits and has_matching_kmers). Returns true
+    // if the hit collection stopped early on any of the windows.
+    inline bool map(std::string* read_seq, mapping_cache_info& map_cache) {
+        const int32_t read_len = static_cast<int32_t>(read_seq->length());
+        const int32_t window_len = static_cast<int32_t>(m_opts.window_len);
+        const int32_t step = window_len - static_cast<int32_t>(m_opts.window_overlap);
+        // mappings of the windows to one target are taken to be colinear if they
+        // place the start of the read within this many bases of one another
+        const int32_t max_drift = std::max<int32_t>(window_len / 4, 1);
+
+        m_chains.clear();
+        bool early_stop = false;
+        bool has_matching_kmers = false;
+        for (int32_t window_start = 0;; window_start += step) {
+            // the last window ends at the end of the read
+            window_start = std::min(window_start, read_len - window_len);
+            int32_t window_end = window_start + window_len;
+            m_window.assign(*read_seq, static_cast<size_t>(window_start),
+                            static_cast<size_t>(window_len));
+            early_stop |= map_read(&m_window, map_cache);
+            has_matching_kmers |= map_cache.has_matching_kmers;
+            ++m_num_windows;
+
+            for (auto const& h : map_cache.accepted_hits) {
+                // where the window places the start of the read on the target (a
+                // pseudoalignment has no position, and its windows all agree)
+                int32_t read_start = map_cache.pseudoalign ? 0
+                                     : h.is_fw ? (h.pos - window_start)
+                                               : (h.pos - (read_len - window_end));
+                add_to_chain(h, read_start, max_drift);
+            }
+            if (window_end >= read_len) { break; }
+        }
+        ++m_num_reads;
+
+        // the mappings of the read are its best supported chains
+        uint32_t best_num_windows = 0;
+        for (auto const& kv : m_chains) {
+            for (auto const& c : kv.second) {
+                best_num_windows = std::max(best_num_windows, c.num_windows);
+            }
+        }
+        auto& accepted_hits = map_cache.accepted_hits;
+        accepted_hits.clear();
+        for (auto const& kv : m_chains) {
+            for (auto const& c : kv.second) {
+                if (c.num_windows < best_num_windows) { continue; }
+                simple_hit h;
+                h.is_fw = (kv.first & 1) != 0;
+                h.pos = c.read_start;
+                h.score = c.score;
+                h.num_hits = c.num_hits;
+                h.tid = static_cast<uint32_t>(kv.first >> 1);
+                accepted_hits.push_back(h);
+            }
+        }
+
+        map_cache.has_matching_kmers = has_matching_kmers;
+        map_cache.map_type = MappingType::UNMAPPED;
+        if (accepted_hits.size() > map_cache.occs.max_read_occ) {
+            accepted_hits.clear();
+        } else if (!accepted_hits.empty()) {
+            map_cache.map_type = MappingType::SINGLE_MAPPED;
+        }
+        return early_stop;
+    }
+
+    // The reads mapped in windows so far, and their windows.
+    inline uint64_t num_reads() const { return m_num_reads; }
+    inline uint64_t num_windows() const { return m_num_windows; }
+
+private:
+    // the mappings of consecutive windows to a (target, orientation) that agree on
+    // where the read starts
+    struct window_chain {
+        int32_t read_start{0};
+        uint32_t num_windows{0};
+        uint32_t num_hits{0};
+        float score{0.0};
+    };
+    typedef itlib::small_vector<window_chain, max_chains_per_target> chains_t;
+
+    inline void add_to_chain(const simple_hit& h, int32_t read_start, int32_t max_drift) {
+        uint64_t key = (static_cast<uint64_t>(h.tid) << 1) | (h.is_fw ? 1 : 0);
+        auto& chains = m_chains[key];
+        for (auto& c : chains) {
+            if (std::abs(c.read_start - read_start) <= max_drift) {
+                ++c.num_windows;
+                c.num_hits += h.num_hits;
+                c.score += h.score;
+                // the position is that of the window covering the 5' end of the
+                // alignment on the target: the first one for a forward mapping,
+                // and the last one for a reverse complement one
+                if (!h.is_fw) { c.read_start = read_start; }
+                return;
+            }
+        }
+        window_chain c{read_start, 1, h.num_hits, h.score};
+        if (chains.size() < max_chains_per_target) {
+            chains.push_back(c);
+            return;
+        }
+        // the table is full: the new chain only takes the place of one that no
+        // other window has joined yet
+        auto weakest = std::min_element(chains.begin(), chains.end(),
+                                        [](const window_chain& a, const window_chain& b) {
+                                            return a.num_windows < b.num_windows;
+                                        });
+        if (weakest->num_windows == 1) { *weakest = c; }
+    }
+
+    long_read_options m_opts;
+    std::string m_window;
+    phmap::flat_hash_map<uint64_t, chains_t> m_chains;
+    uint64_t m_num_reads{0};
+    uint64_t m_num_windows{0};
+};
+
+}  // namespace util
+}  // namespace mapping
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "../include/wyhash.h"
+#include "../include/mapping/utils.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mapping {
+
+namespace util {
+
+// A per-thread cache of the mappings of reads, keyed by a 128-bit hash of the
+// mapped sequence, so that exact duplicates (PCR duplicates, reads of highly
+// expressed targets) are mapped once. It is direct-mapped: a read replaces
+// whatever was cached in its slot, so its size is fixed by the number of slots.
+// Mappings with more than max_cached_hits hits are not cached, which bounds
+// its memory to about num_slots * max_cached_hits * sizeof(simple_hit) bytes.
+class read_mapping_cache {
+public:
+    static constexpr size_t max_cached_hits = 32;
+
+    // A cache with at least `num_slots` slots (rounded up to a power of 2); with
+    // 0 slots, it is disabled and caches nothing.
+    explicit read_mapping_cache(size_t num_slots) {
+        if (num_slots == 0) { return; }
+        size_t n = 1;
+        while (n < num_slots) { n <<= 1; }
+        m_slots.resize(n);
+        m_mask = n - 1;
+    }
+
+    inline bool enabled() const { return !m_slots.empty(); }
+
+    // Whether the mapping of `seq` is cached, without counting it as a lookup.
+    inline bool contains(const std::string& seq) const {
+        if (!enabled()) { return false; }
+        auto key = hash(seq);
+        auto& slot = m_slots[key.first & m_mask];
+        return slot.occupied and slot.key == key;
+    }
+
+    // If the mapping of `seq` is cached, copies it to map_cache (map_type,
+    // accepted_hits and has_matching_kmers) and returns true.
+    inline bool fetch(const std::string& seq, mapping_cache_info& map_cache,
+                      bool& early_stop) {
+        if (!enabled()) { return false; }
+        ++m_num_lookups;
+        auto key = hash(seq);
+        auto& slot = m_slots[key.first & m_mask];
+        if (!slot.occupied or slot.key != key) { return false; }
+        ++m_num_hits;
+        map_cache.map_type = slot.map_type;
+        map_cache.has_matching_kmers = slot.has_matching_kmers;
+        map_cache.accepted_hits.assign(slot.hits.begin(), slot.hits.end());
+        early_stop = slot.early_stop;
+        return true;
+    }
+
+    // Caches the mapping of `seq` held by map_cache.
+    inline void store(const std::string& seq, const mapping_cache_info& map_cache,
+                      bool early_stop) {
+        if (!enabled() or map_cache.accepted_hits.size() > max_cached_hits) { return; }
+        auto key = hash(seq);
+        auto& slot = m_slots[key.first & m_mask];
+        slot.key = key;
+        slot.occupied = true;
+        slot.early_stop = early_stop;
+        slot.map_type = map_cache.map_type;
+        slot.has_matching_kmers = map_cache.has_matching_kmers;
+        slot.hits.assign(map_cache.accepted_hits.begin(), map_cache.accepted_hits.end());
+    }
+
+    inline uint64_t num_lookups() const { return m_num_lookups; }
+    inline uint64_t num_hits() const { return m_num_hits; }
+
+private:
+    typedef std::pair<uint64_t, uint64_t> key_t;
+
+    static inline key_t hash(const std::string& seq) {
+        return {wyhash(seq.data(), seq.size(), 0, _wyp),
+                wyhash(seq.data(), seq.size(), 0x9e3779b97f4a7c15ULL, _wyp)};
+    }
+
+    struct slot_t {
+        key_t key{0, 0};
+        bool occupied{false};
+        bool early_stop{false};
+        bool has_matching_kmers{false};
+        MappingType map_type{MappingType::UNMAPPED};
+        std::vector<simple_hit> hits;
+    };
+
+    std::vector<slot_t> m_slots;
+    uint64_t m_mask{0};
+    uint64_t m_num_lookups{0};
+    uint64_t m_num_hits{0};
+};
+
+// Maps a read, or takes its mapping from `cache` if it is there.
+inline bool map_read_cached(std::string* read_seq, mapping_cache_info& map_cache,
+                            read_mapping_cache& cache) {
+    bool early_stop = false;
+    if (cache.fetch(*read_seq, map_cache, early_stop)) { return early_stop; }
+    early_stop = map_read(read_seq, map_cache);
+    cache.store(*read_seq, map_cache, early_stop);
+    return early_stop;
+}
+
+inline bool map_read_cached(std::string* read_seq, std::vector<raw_hit>& raw_hits,
+                            mapping_cache_info& map_cache, read_mapping_cache& cache) {
+    bool early_stop = false;
+    if (cache.fetch(*read_seq, map_cache, early_stop)) { return early_stop; }
+    early_stop = map_read(read_seq, raw_hits, map_cache);
+    cache.store(*read_seq, map_cache, early_stop);
+    return early_stop;
+}
+
+}  // namespace util
+}  // namespace mapping
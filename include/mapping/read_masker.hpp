@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mapping {
+
+namespace util {
+
+// What read_masker masks; each kind is disabled by its default.
+struct read_mask_options {
+    // poly-A tails (at the 3' end) and poly-T heads (at the 5' end) at least this long
+    uint32_t min_polya_len{0};
+    // runs of a single base at least this long, anywhere in the read
+    uint32_t min_homopolymer_len{0};
+    // occurrences of these sequences (e.g. adapters or the template switch oligo, of
+    // at most max_motif_len bases) or of their reverse complements, along with the
+    // partial ones at either end of the read that overlap it by at least
+    // min_motif_overlap bases
+    std::vector<std::string> motifs;
+    uint32_t min_motif_overlap{8};
+
+    inline bool enabled() const {
+        return min_polya_len > 0 or min_homopolymer_len > 0 or !motifs.empty();
+    }
+};
+
+struct read_mask_stats {
+    uint64_t num_reads_masked{0};
+    uint64_t num_polya_bases{0};
+    uint64_t num_motif_bases{0};
+    uint64_t num_homopolymer_bases{0};
+};
+
+// Masks the parts of a read that cannot yield a useful mapping by overwriting
+// them with 'N', before its hits are collected. The hit search skips every
+// k-mer that contains an 'N', so the masked parts cost no lookup, while the
+// read keeps its length (and its hits their positions). Each of the scans is
+// a single pass over the bases; the motifs (and their reverse complements) are
+// all matched in the same pass, bit-parallel (Shift-And), at a few word
+// operations per base and motif whatever their length.
+class read_masker {
+public:
+    // the motifs are matched within a 64-bit word
+    static constexpr size_t max_motif_len = 64;
+
+    explicit read_masker(const read_mask_options& opts) : m_opts(opts) {
+        for (auto const& motif : opts.motifs) {
+            add_motif(motif);
+            std::string rc(motif.rbegin(), motif.rend());
+            for (auto& c : rc) { c = complement(c); }
+            if (rc != motif) { add_motif(rc); }
+        }
+    }
+
+    inline bool enabled() const { return m_opts.enabled(); }
+
+    // Masks `seq` in place, and returns true if any of its bases was masked.
+    inline bool mask(std::string& seq) {
+        if (!enabled()) { return false; }
+        uint64_t num_polya = 0, num_motif = 0, num_homopolymer = 0;
+        if (m_opts.min_polya_len > 0) { num_polya = mask_polya(seq); }
+        if (!m_motifs.empty()) { num_motif = mask_motifs(seq); }
+        if (m_opts.min_homopolymer_len > 0) { num_homopolymer = mask_homopolymers(seq); }
+
+        m_stats.num_polya_bases += num_polya;
+        m_stats.num_motif_bases += num_motif;
+        m_stats.num_homopolymer_bases += num_homopolymer;
+        bool masked = (num_polya + num_motif + num_homopolymer) > 0;
+        m_stats.num_reads_masked += masked;
+        return masked;
+    }
+
+    inline const read_mask_stats& stats() const { return m_stats; }
+
+    // The motif as the masker matches it (upper case), or an empty string if
+    // it is not made of A, C, G and T only, or is longer than max_motif_len.
+    static std::string normalize_motif(const std::string& motif) {
+        if (motif.empty() or motif.size() > max_motif_len) { return std::string(); }
+        std::string m(motif);
+        for (auto& c : m) {
+            c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+            if (c != 'A' and c != 'C' and c != 'G' and c != 'T') { return std::string(); }
+        }
+        return m;
+    }
+
+private:
+    // A motif as Shift-And matches it: bit i of masks[b] is set if the i-th base
+    // of the motif is b (see base_code).
+    struct motif_masks {
+        size_t len;
+        uint64_t masks[4];
+    };
+
+    // The state of the scan of a read for a motif: bit i of `prefixes` is set if the
+    // first i + 1 bases of the motif end at the current base, and bit i of `suffixes`
+    // if the read so far is the part of the motif that ends with its i-th base (and
+    // starts past its first one); suffix_len is the longest suffix of the motif that
+    // the read starts with.
+    struct motif_state {
+        uint64_t prefixes;
+        uint64_t suffixes;
+        size_t suffix_len;
+    };
+
+    static inline int base_code(char c) {
+        switch (c & 0xDF) {
+            case 'A': return 0;
+            case 'C': return 1;
+            case 'G': return 2;
+            case 'T': return 3;
+        }
+        return -1;
+    }
+
+    void add_motif(const std::string& motif) {
+        motif_masks m{motif.size(), {0, 0, 0, 0}};
+        for (size_t i = 0; i < motif.size(); ++i) {
+            m.masks[base_code(motif[i])] |= uint64_t(1) << i;
+        }
+        m_motifs.push_back(m);
+        m_states.emplace_back();
+    }
+
+    static inline char complement(char c) {
+        switch (c) {
+            case 'A': return 'T';
+            case 'C': return 'G';
+            case 'G': return 'C';
+            case 'T': return 'A';
+        }
+        return 'N';
+    }
+
+    static inline bool same_base(char a, char b) { return (a & 0xDF) == b; }
+
+    // masks [begin, end) of seq, and returns the number of bases that were not
+    // masked already
+    static inline uint64_t mask_range(std::string& seq, size_t begin, size_t end) {
+        uint64_t n = 0;
+        for (size_t i = begin; i < end; ++i) {
+            n += (seq[i] != 'N');
+            seq[i] = 'N';
+        }
+        return n;
+    }
+
+    // The length of the longest run of `base` at one end of seq (the 3' end if
+    // `from_end`) with at most one mismatch in every 10 bases, that starts and
+    // ends with `base`.
+    static inline size_t tail_len(const std::string& seq, char base, bool from_end) {
+        size_t n = seq.size();
+        size_t best = 0;
+        size_t mismatches = 0;
+        for (size_t len = 1; len <= n; ++len) {
+            char c = from_end ? seq[n - len] : seq[len - 1];
+            bool match = same_base(c, base);
+            mismatches += !match;
+            if (10 * mismatches > len + 10) { break; }
+            if (match and 10 * mismatches <= len) { best = len; }
+        }
+        return best;
+    }
+
+    inline uint64_t mask_polya(std::string& seq) {
+        uint64_t n = 0;
+        size_t tail = tail_len(seq, 'A', true);
+        if (tail >= m_opts.min_polya_len) { n += mask_range(seq, seq.size() - tail, seq.size()); }
+        size_t head = tail_len(seq, 'T', false);
+        if (head >= m_opts.min_polya_len) { n += mask_range(seq, 0, head); }
+        return n;
+    }
+
+    // Masks the whole occurrences of the motifs, and the longest prefix of each at the
+    // 3' end of the read and the longest suffix of each at its 5' end.
+    inline uint64_t mask_motifs(std::string& seq) {
+        uint64_t n = 0;
+        size_t seq_len = seq.size();
+        for (size_t j = 0; j < m_motifs.size(); ++j) {
+            // any proper prefix of the motif may precede the read
+            m_states[j] = {0, last_bit(m_motifs[j]) - 1, 0};
+        }
+        for (size_t i = 0; i < seq_len; ++i) {
+            int c = base_code(seq[i]);
+            for (size_t j = 0; j < m_motifs.size(); ++j) {
+                auto const& m = m_motifs[j];
+                auto& state = m_states[j];
+                uint64_t b = (c < 0) ? 0 : m.masks[c];
+                uint64_t last = last_bit(m);
+                state.prefixes = ((state.prefixes << 1) | 1) & b;
+                if (state.prefixes & last) { n += mask_range(seq, i + 1 - m.len, i + 1); }
+                state.suffixes = (state.suffixes << 1) & b;
+                if (state.suffixes & last) { state.suffix_len = i + 1; }
+            }
+        }
+        size_t min_overlap = std::max<size_t>(m_opts.min_motif_overlap, 1);
+        for (size_t j = 0; j < m_motifs.size(); ++j) {
+            auto const& state = m_states[j];
+            uint64_t partial = state.prefixes & (last_bit(m_motifs[j]) - 1);
+            if (partial) {
+                size_t overlap = 64 - static_cast<size_t>(__builtin_clzll(partial));
+                if (overlap >= min_overlap) { n += mask_range(seq, seq_len - overlap, seq_len); }
+            }
+            if (state.suffix_len >= min_overlap) { n += mask_range(seq, 0, state.suffix_len); }
+        }
+        return n;
+    }
+
+    static inline uint64_t last_bit(const motif_masks& m) { return uint64_t(1) << (m.len - 1); }
+
+    inline uint64_t mask_homopolymers(std::string& seq) {
+        uint64_t n = 0;
+        size_t seq_len = seq.size();
+        size_t run_start = 0;
+        for (size_t i = 1; i <= seq_len; ++i) {
+            if (i < seq_len and (seq[i] & 0xDF) == (seq[run_start] & 0xDF)) { continue; }
+            if (i - run_start >= m_opts.min_homopolymer_len and seq[run_start] != 'N') {
+                n += mask_range(seq, run_start, i);
+            }
+            run_start = i;
+        }
+        return n;
+    }
+
+    read_mask_options m_opts;
+    std::vector<motif_masks> m_motifs;
+    std::vector<motif_state> m_states;
+    read_mask_stats m_stats;
+};
+
+}  // namespace util
+}  // namespace mapping
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace mapping {
+
+namespace util {
+
+// A bump allocator for the scratch state of mapping a read. Allocations are carved
+// out of a single block and are never freed one by one: `reset()` makes the whole
+// block available again, and must only be called once the containers that used it
+// are gone. When a read needs more than the block holds, the extra requests are
+// served by overflow blocks, and the next `reset()` replaces them, along with the
+// block, by a single block large enough for all of them. Hence, once a thread has
+// mapped its first few reads, mapping a read does not allocate from the heap.
+// The block never grows past `max_block_bytes`: the rare read that needs more is
+// served by overflow blocks that are freed by the next `reset()`, so that it does
+// not pin its memory for the lifetime of the thread.
+class scratch_arena {
+public:
+    explicit scratch_arena(size_t initial_bytes = 64 * 1024,
+                           size_t max_block_bytes = 16 * 1024 * 1024)
+        : m_max_block_bytes(std::max(initial_bytes, max_block_bytes)) {
+        replace_block(initial_bytes);
+    }
+
+    scratch_arena(const scratch_arena&) = delete;
+    scratch_arena& operator=(const scratch_arena&) = delete;
+
+    inline void* allocate(size_t bytes, size_t alignment) {
+        assert(alignment <= alignof(std::max_align_t));
+        size_t begin = (m_used + alignment - 1) & ~(alignment - 1);
+        if (begin + bytes > m_block_bytes) { return allocate_overflow(bytes, alignment); }
+        m_used = begin + bytes;
+        return reinterpret_cast<char*>(m_block.get()) + begin;
+    }
+
+    inline void reset() {
+        if (!m_overflow.empty()) {
+            size_t needed = m_used + m_overflow_bytes;
+            m_overflow.clear();
+            m_overflow_bytes = 0;
+            if (m_block_bytes < m_max_block_bytes) {
+                replace_block(std::min(std::max(needed, 2 * m_block_bytes), m_max_block_bytes));
+            }
+        }
+        m_used = 0;
+    }
+
+    // The number of blocks taken from the heap so far.
+    inline uint64_t num_heap_allocations() const { return m_num_heap_allocations; }
+    inline size_t capacity() const { return m_block_bytes; }
+
+private:
+    typedef std::unique_ptr<std::max_align_t[]> block;
+
+    static block new_block(size_t bytes) {
+        return block(new std::max_align_t[(bytes + sizeof(std::max_align_t) - 1) /
+                                          sizeof(std::max_align_t)]);
+    }
+
+    void replace_block(size_t bytes) {
+        m_block.reset();
+        m_block = new_block(bytes);
+        m_block_bytes = bytes;
+        m_used = 0;
+        ++m_num_heap_allocations;
+    }
+
+    void* allocate_overflow(size_t bytes, size_t alignment) {
+        (void)alignment;  // blocks are aligned for any type
+        m_overflow.push_back(new_block(bytes));
+        m_overflow_bytes += bytes + alignof(std::max_align_t);
+        ++m_num_heap_allocations;
+        return m_overflow.back().get();
+    }
+
+    size_t m_max_block_bytes;
+    block m_block;
+    size_t m_block_bytes{0};
+    size_t m_used{0};
+    std::vector<block> m_overflow;
+    size_t m_overflow_bytes{0};
+    uint64_t m_num_heap_allocations{0};
+};
+
+// An allocator drawing from a scratch_arena, for the containers of mapping_cache_info
+// that only live for the mapping of one read. Deallocation does nothing.
+template <typename T>
+struct scratch_allocator {
+    typedef T value_type;
+
+    explicit scratch_allocator(scratch_arena* arena_in) noexcept : arena(arena_in) {}
+    template <typename U>
+    scratch_allocator(const scratch_allocator<U>& other) noexcept : arena(other.arena) {}
+
+    inline T* allocate(size_t n) {
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+    inline void deallocate(T*, size_t) noexcept {}
+
+    scratch_arena* arena;
+};
+
+template <typename T, typename U>
+inline bool operator==(const scratch_allocator<T>& a, const scratch_allocator<U>& b) {
+    return a.arena == b.arena;
+}
+
+template <typename T, typename U>
+inline bool operator!=(const scratch_allocator<T>& a, const scratch_allocator<U>& b) {
+    return a.arena != b.arena;
+}
+
+}  // namespace util
+}  // namespace mapping
@@ -7,6 +7,8 @@
 #include "../include/projected_hits.hpp"
 #include "../include/FastxParser.hpp"
 #include "../include/itlib/small_vector.hpp"
+#include "../include/mapping/scratch_arena.hpp"
+#include "../include/mapping/ec_intersection.hpp"
 
 #include "../include/hit_searcher.hpp"
 
@@ -74,6 +76,14 @@ inline bool compare_chains(const chain_state& a, const chain_state& b) {
 
 struct sketch_hit_info {
     static constexpr size_t max_num_chains = 8;
+    typedef itlib::small_vector<chain_state, max_num_chains, 0, scratch_allocator<chain_state>>
+        chains_t;
+
+    // the chains only live for the mapping of a read, so they are drawn from `arena`
+    explicit sketch_hit_info(scratch_arena* arena)
+        : fw_chains(scratch_allocator<chain_state>(arena))
+        , rc_chains(scratch_allocator<chain_state>(arena)) {}
+
     // add a hit to the current target that occurs in the forward
     // orientation with respect to the target.
     bool add_fw(int32_t ref_pos, int32_t read_pos, int32_t rl, int32_t k, int32_t max_stretch,
@@ -293,6 +303,11 @@ struct sketch_hit_info {
 
     inline uint32_t max_hits_for_target() { return std::max(fw_hits, rc_hits); }
 
+    // the number of orientations (0, 1 or 2) in which this target has at least n hits
+    inline uint32_t num_directions_with(uint32_t n) const {
+        return static_cast<uint32_t>(fw_hits >= n) + static_cast<uint32_t>(rc_hits >= n);
+    }
+
     // true if forward, false if rc
     // second element is score
     inline HitDirection best_hit_direction() {
@@ -353,12 +368,11 @@ struct sketch_hit_info {
 
     int32_t fw_rank{-1};
     int32_t rc_rank{-1};
-    itlib::small_vector<chain_state, max_num_chains> fw_chains;
-    itlib::small_vector<chain_state, max_num_chains> rc_chains;
+    chains_t fw_chains;
+    chains_t rc_chains;
 
 private:
-    inline void compact_chains(itlib::small_vector<chain_state, max_num_chains>& chains,
-                               const uint32_t required_hits) {
+    inline void compact_chains(chains_t& chains, const uint32_t required_hits) {
         chains.erase(std::remove_if(chains.begin(), chains.end(),
                                     [required_hits](chain_state& s) -> bool {
                                         // remove this chain if it doesn't satisfy
@@ -375,8 +389,7 @@ private:
                      chains.end());
     }
 
-    inline void process_rank0_hit(int32_t approx_map_pos, int32_t hit_pos,
-                                  itlib::small_vector<chain_state, max_num_chains>& chains,
+    inline void process_rank0_hit(int32_t approx_map_pos, int32_t hit_pos, chains_t& chains,
                                   int32_t& approx_pos_out, bool& ignore_struct_constraints,
                                   uint32_t& num_hits, bool& added) {
         // if there are too many possible chains, just punt
@@ -397,8 +410,8 @@ private:
 
     inline void process_hit(
         bool is_fw_hit,  // we are processing a hit in the forward orientation (otherwise, RC)
-        int32_t read_start_pos, int32_t next_hit_pos, int32_t max_stretch,
-        itlib::small_vector<chain_state, max_num_chains>& chains, uint32_t& num_hits, bool& added) {
+        int32_t read_start_pos, int32_t next_hit_pos, int32_t max_stretch, chains_t& chains,
+        uint32_t& num_hits, bool& added) {
         (void)max_stretch;
         // find the chain that best matches this k-mer.
         chain_state predecessor_probe{read_start_pos, next_hit_pos, -1, 0, max_distortion};
@@ -444,35 +457,143 @@ private:
     }
 };
 
+// The thresholds of map_read on how repetitive hits and reads may be.
+struct occ_thresholds {
+    // hits occurring this many times or more are skipped
+    size_t max_occ_default{200};
+    // ... unless every hit of the read is, and the least frequent occur fewer
+    // times than this, in which case those are collected
+    size_t max_occ_recover{1000};
+    // reads with more mappings than this are left unmapped
+    size_t max_read_occ{2500};
+};
+
+// The largest number of occurrences of the hits of a read that are collected.
+// Hits occurring max_occ_default times or more are too ambiguous to collect.
+// If that is every hit of the fragment, then fall back to a more liberal
+// threshold and collect the least frequent ones: specifically, if the min
+// occurring hits have frequency < max_occ_recover (1000 by default), then
+// collect the min occurring hits to get the mapping. As the hit search
+// records the occurrences of each hit, the threshold is chosen before
+// collecting anything, and the hits are collected in a single pass.
+inline uint64_t max_allowed_hit_occ(const occ_thresholds& occs,
+                                    const std::vector<raw_hit>& raw_hits) {
+    const bool attempt_occ_recover = (occs.max_occ_recover > occs.max_occ_default);
+    // the least frequent hit for this fragment.
+    uint64_t min_occ = std::numeric_limits<uint64_t>::max();
+    for (auto& hit : raw_hits) { min_occ = std::min(min_occ, uint64_t(hit.num_occs)); }
+
+    uint64_t max_allowed_occ = occs.max_occ_default - 1;
+    if (attempt_occ_recover and (min_occ >= occs.max_occ_default) and
+        (min_occ < occs.max_occ_recover)) {
+        max_allowed_occ = min_occ;
+    }
+    return max_allowed_occ;
+}
+
+// Derives the occurrence thresholds from how repetitive the k-mers of the (base layer of
+// the) index are, for indices so redundant that the defaults would leave many reads
+// unmapped: the first-pass threshold lets through all but the 0.1% most frequent
+// k-mers, and the recovery threshold all but the 0.01% most frequent. Neither is
+// lowered below its default, and the thresholds keep the ratios of the defaults.
+inline occ_thresholds calibrate_occ_thresholds(const mindex::reference_index& ri) {
+    const auto& ctab = ri.get_contig_table();
+    const uint64_t k = ri.k();
+
+    // the number of k-mers occurring a given number of times
+    phmap::flat_hash_map<uint64_t, uint64_t> num_kmers_with_occ;
+    uint64_t num_kmers = 0;
+    for (uint64_t contig_id = 0; contig_id != ctab.num_contigs(); ++contig_id) {
+        uint64_t contig_kmers = ri.contig_length(contig_id) - k + 1;
+        num_kmers_with_occ[ctab.num_occurrences(contig_id)] += contig_kmers;
+        num_kmers += contig_kmers;
+    }
+    std::vector<std::pair<uint64_t, uint64_t>> hist(num_kmers_with_occ.begin(),
+                                                    num_kmers_with_occ.end());
+    std::sort(hist.begin(), hist.end());
+
+    // the smallest number of occurrences of at least a fraction `f` of the k-mers
+    auto quantile = [&hist, num_kmers](double f) -> uint64_t {
+        uint64_t target = static_cast<uint64_t>(std::ceil(f * num_kmers));
+        uint64_t acc = 0;
+        for (auto& [occ, n] : hist) {
+            acc += n;
+            if (acc >= target) { return occ; }
+        }
+        return hist.empty() ? 0 : hist.back().first;
+    };
+
+    occ_thresholds defaults;
+    occ_thresholds occs;
+    occs.max_occ_default = std::max<uint64_t>(defaults.max_occ_default, quantile(0.999) + 1);
+    occs.max_occ_recover =
+        std::max<uint64_t>(occs.max_occ_default * defaults.max_occ_recover /
+                               defaults.max_occ_default,
+                           quantile(0.9999) + 1);
+    occs.max_read_occ = std::max<uint64_t>(
+        defaults.max_read_occ, occs.max_occ_recover * defaults.max_read_occ /
+                                   defaults.max_occ_recover);
+    return occs;
+}
+
 struct mapping_cache_info {
 public:
-    mapping_cache_info(mindex::reference_index& ri) : k(ri.k()), q(ri.get_dict()), hs(&ri) {}
+    typedef phmap::flat_hash_map<
+        uint32_t, sketch_hit_info, phmap::priv::hash_default_hash<uint32_t>,
+        phmap::priv::hash_default_eq<uint32_t>,
+        scratch_allocator<phmap::priv::Pair<const uint32_t, sketch_hit_info>>>
+        hit_map_t;
+    typedef phmap::flat_hash_set<uint64_t, phmap::priv::hash_default_hash<uint64_t>,
+                                 phmap::priv::hash_default_eq<uint64_t>,
+                                 scratch_allocator<uint64_t>>
+        ec_set_t;
+
+    mapping_cache_info(mindex::reference_index& ri)
+        : hit_map(0, hit_map_t::hasher(), hit_map_t::key_equal(),
+                  hit_map_t::allocator_type(&arena))
+        , observed_ecs(0, ec_set_t::hasher(), ec_set_t::key_equal(),
+                       ec_set_t::allocator_type(&arena))
+        , k(ri.k())
+        , q(ri.get_dict())
+        , hs(&ri) {}
 
     inline void clear() {
         map_type = mapping::util::MappingType::UNMAPPED;
         q.start();
         hs.clear();
-        hit_map.clear();
+        clear_scratch();
         accepted_hits.clear();
         has_matching_kmers = false;
         ambiguous_hit_indices.clear();
+        candidate_tids.clear();
     }
 
+    // The number of blocks the arena of the per-read scratch containers (hit_map, the
+    // chains of its targets and observed_ecs) took from the heap so far; it stops growing after the first reads,
+    // but for reads whose scratch state outgrows the capped arena. It does not count
+    // the other allocations made while mapping a read (see skip_bench for those).
+    inline uint64_t num_scratch_allocations() const { return arena.num_heap_allocations(); }
+
     // will store how the read mapped
     mapping::util::MappingType map_type{mapping::util::MappingType::UNMAPPED};
 
+private:
+    // backs the containers below; declared first, as they are built on it
+    scratch_arena arena;
+
+public:
     // map from reference id to hit info
-    phmap::flat_hash_map<uint32_t, mapping::util::sketch_hit_info> hit_map;
+    hit_map_t hit_map;
+    // the (ec, orientation) pairs seen while filtering by ambiguous hits
+    ec_set_t observed_ecs;
     std::vector<mapping::util::simple_hit> accepted_hits;
 
     // map to recall the number of unmapped reads we see
     // for each barcode
     phmap::flat_hash_map<uint64_t, uint32_t> unmapped_bc_map;
 
-    size_t max_occ_default = 200;
-    size_t max_occ_recover = 1000;
-    const bool attempt_occ_recover = (max_occ_recover > max_occ_default);
-    size_t alt_max_occ = 2500;
+    // the thresholds on the occurrences of hits and on the mappings of reads
+    occ_thresholds occs;
     size_t k{0};
 
     // to perform queries
@@ -485,73 +606,247 @@ public:
     // holds the indices of k-mers too ambiguous to chain, but which
     // we might later want to check the existence of
     itlib::small_vector<uint32_t, 255> ambiguous_hit_indices;
+    // if not empty, the (sorted) targets to which the read may map: the hits of
+    // other targets are skipped (see map_mates_jointly)
+    std::vector<uint32_t> candidate_tids;
 
     // max ec card
     uint32_t max_ec_card{256};
+
+    // If not 0, map_read approximates the mapping of a read: once a single target, in a
+    // single orientation, is consistent with its first early_exit_hits hits, it is
+    // accepted without decoding the remaining hits. This is lossy, as those hits may
+    // have left the read unmapped (and the hit search itself still runs in full).
+    uint32_t early_exit_hits{0};
+    // the number of reads for which that happened
+    uint64_t num_early_exits{0};
+
+    // If true, map_read does not chain the hits of a read, but intersects the
+    // (target, orientation) sets of their contigs (see pseudoalign_raw_hits)
+    bool pseudoalign{false};
+    // the sets met while doing so, and their intersections
+    ec_intersection_cache ec_cache;
+
+private:
+    // Empties the per-read containers and hands their memory back to the arena.
+    // The new hit_map is sized for as many targets as a read has hit so far
+    // (up to max_reserved_targets), so that it does not grow while mapping a read.
+    inline void clear_scratch() {
+        num_targets_hint =
+            std::max(num_targets_hint, std::min(hit_map.size(), max_reserved_targets));
+        hit_map_t(0, hit_map.hash_function(), hit_map.key_eq(), hit_map.get_allocator())
+            .swap(hit_map);
+        ec_set_t(0, observed_ecs.hash_function(), observed_ecs.key_eq(),
+                 observed_ecs.get_allocator())
+            .swap(observed_ecs);
+        arena.reset();
+        hit_map.reserve(num_targets_hint);
+    }
+
+    static constexpr size_t max_reserved_targets = 1024;
+    size_t num_targets_hint{0};
 };
 
-inline bool map_read(std::string* read_seq, mapping_cache_info& map_cache, bool verbose = false) {
-    map_cache.clear();
+// Pseudoaligns a read from the raw hits collected in map_cache.hs.get_left_hits():
+// rather than chaining the positions of its hits on each target, this intersects
+// the (target, orientation) sets of the contigs the hits fall on, and accepts every
+// pair left, without a position. The set of a contig comes from the equivalence
+// class table if the index has one (so that contigs with the same class share it),
+// and is decoded from the contig table otherwise; the hits of both layers of an
+// index with a delta at the same read position count as the union of their sets.
+// Hits are subject to the same occurrence thresholds as when chaining.
+inline bool pseudoalign_raw_hits(mapping_cache_info& map_cache) {
+    auto& raw_hits = map_cache.hs.get_left_hits();
+    auto& ec_cache = map_cache.ec_cache;
+    auto* ri = map_cache.hs.get_index();
+    const sshash::equivalence_class_map* ec_table =
+        ri->has_ec_table() ? &ri->get_ec_table() : nullptr;
+    const uint32_t early_exit_hits = map_cache.early_exit_hits;
+    const auto& candidate_tids = map_cache.candidate_tids;
+    if (!map_cache.has_matching_kmers) { return false; }
+
+    ec_cache.trim();
+    const uint64_t max_allowed_occ = max_allowed_hit_occ(map_cache.occs, raw_hits);
+
+    // adds the labels of the occurrences of the contig of a hit
+    auto add_labels = [ri, ec_table](const raw_hit& hit, std::vector<uint64_t>& labels) {
+        if (ec_table and !hit.from_delta) {
+            for (uint64_t ent : ec_table->entries_for_tile(hit.contig_id)) {
+                uint64_t tid = ent >> 2;
+                switch (ent & 0x3) {
+                    case 0:  // fw
+                        labels.push_back((tid << 1) | hit.fw_on_contig);
+                        break;
+                    case 1:  // rc
+                        labels.push_back((tid << 1) | !hit.fw_on_contig);
+                        break;
+                    default:  // both
+                        labels.push_back(tid << 1);
+                        labels.push_back((tid << 1) | 1);
+                }
+            }
+            return;
+        }
+        auto proj_hits = ri->project(hit);
+        proj_hits.for_each_hit([&labels](uint64_t tid, const ref_pos& rp) {
+            labels.push_back((tid << 1) | rp.isFW);
+        });
+    };
+    // the key of the set of a hit: its class (or contig) and its orientation on it
+    auto key_of = [ec_table](const raw_hit& hit) -> uint64_t {
+        uint64_t key = (ec_table and !hit.from_delta) ? ec_table->ec_for_tile(hit.contig_id)
+                                                      : (hit.contig_id | (uint64_t(1) << 62));
+        return (key << 1) | hit.fw_on_contig;
+    };
+
+    bool early_stop = false;
+    bool have_set = false;
+    uint32_t set_id = ec_intersection_cache::empty_set;
+    uint64_t prev_key = std::numeric_limits<uint64_t>::max();
+    uint32_t num_used_hits = 0;
+    for (size_t i = 0; i < raw_hits.size(); ++i) {
+        auto& hit = raw_hits[i];
+        // the hits of both layers for the same k-mer
+        size_t j = i + 1;
+        while (j < raw_hits.size() and raw_hits[j].read_pos == hit.read_pos) { ++j; }
+        bool usable = false;
+        for (size_t h = i; h < j; ++h) { usable |= (raw_hits[h].num_occs <= max_allowed_occ); }
+        if (!usable) {
+            i = j - 1;
+            continue;
+        }
+
+        uint32_t hit_set;
+        if (j == i + 1) {
+            // consecutive hits on a contig mostly share it
+            uint64_t key = key_of(hit);
+            if (have_set and key == prev_key) { continue; }
+            prev_key = key;
+            hit_set = ec_cache.leaf(key, [&](std::vector<uint64_t>& labels) {
+                add_labels(hit, labels);
+            });
+        } else {
+            prev_key = std::numeric_limits<uint64_t>::max();
+            hit_set = ec_cache.uncached([&](std::vector<uint64_t>& labels) {
+                for (size_t h = i; h < j; ++h) {
+                    if (raw_hits[h].num_occs <= max_allowed_occ) {
+                        add_labels(raw_hits[h], labels);
+                    }
+                }
+            });
+            i = j - 1;
+        }
+
+        set_id = have_set ? ec_cache.intersect(set_id, hit_set) : hit_set;
+        have_set = true;
+        ++num_used_hits;
+        if (set_id == ec_intersection_cache::empty_set) { break; }
+        if (early_exit_hits and (num_used_hits >= early_exit_hits) and
+            (ec_cache.labels(set_id).size() == 1) and (i + 1 < raw_hits.size())) {
+            ++map_cache.num_early_exits;
+            early_stop = true;
+            break;
+        }
+    }
+
+    if (!have_set) { return early_stop; }
+    for (uint64_t label : ec_cache.labels(set_id)) {
+        uint32_t tid = static_cast<uint32_t>(label >> 1);
+        if (!candidate_tids.empty() and
+            !std::binary_search(candidate_tids.begin(), candidate_tids.end(), tid)) {
+            continue;
+        }
+        simple_hit h;
+        h.is_fw = label & 1;
+        h.pos = 0;
+        h.num_hits = num_used_hits;
+        h.tid = tid;
+        map_cache.accepted_hits.push_back(h);
+    }
+    return early_stop;
+}
+
+// Maps a read from the raw hits collected in map_cache.hs.get_left_hits().
+inline bool map_raw_hits(std::string* read_seq, mapping_cache_info& map_cache,
+                         bool verbose = false) {
     // rebind map_cache variables to
     // local names
-    auto& q = map_cache.q;
     auto& hs = map_cache.hs;
     auto& hit_map = map_cache.hit_map;
     auto& accepted_hits = map_cache.accepted_hits;
     auto& map_type = map_cache.map_type;
-    const bool attempt_occ_recover = map_cache.attempt_occ_recover;
+    const auto& occs = map_cache.occs;
     const bool perform_ambig_filtering = map_cache.hs.get_index()->has_ec_table();
+    // if the index has a delta layer, a k-mer may yield two adjacent raw hits
+    // (one per layer) at the same read position.
+    const bool has_delta = map_cache.hs.get_index()->has_delta();
+    const auto* ri = map_cache.hs.get_index();
     auto k = map_cache.k;
 
-    map_cache.has_matching_kmers = hs.get_raw_hits_sketch(*read_seq, q, true, false);
     bool early_stop = false;
 
     // if we are checking ambiguous hits, the maximum EC
     // size we will consider.
     const size_t max_ec_ambig = map_cache.max_ec_card;
 
-    // if there were hits
-    if (map_cache.has_matching_kmers) {
+    // if not 0, stop decoding hits once a single target, in a single orientation,
+    // is consistent with this many hits (see mapping_cache_info::early_exit_hits)
+    const uint32_t early_exit_hits = map_cache.early_exit_hits;
+
+    const auto& candidate_tids = map_cache.candidate_tids;
+    const bool restrict_targets = !candidate_tids.empty();
+
+    if (map_cache.pseudoalign) {
+        early_stop = pseudoalign_raw_hits(map_cache);
+    } else if (map_cache.has_matching_kmers) {  // if there were hits
         uint32_t num_valid_hits{0};
         uint64_t total_occs{0};
         uint64_t largest_occ{0};
         auto& raw_hits = hs.get_left_hits();
 
         // SANITY
-        decltype(raw_hits[0].first) prev_read_pos = -1;
+        decltype(raw_hits[0].read_pos) prev_read_pos = -1;
         // the maximum span the supporting k-mers of a
         // mapping position are allowed to have.
         // NOTE this is still > read_length b/c the stretch is measured wrt the
         // START of the terminal k-mer.
         int32_t max_stretch = static_cast<int32_t>(read_seq->length() * 1.0);
 
-        // a raw hit is a pair of read_pos and a projected hit
-
-        // the least frequent hit for this fragment.
-        uint64_t min_occ = std::numeric_limits<uint64_t>::max();
+        // a raw hit records the read position of a k-mer and where the occurrences
+        // of its contig are; they are only decoded for the hits we use (see below)
+        uint64_t max_allowed_occ = max_allowed_hit_occ(occs, raw_hits);
 
-        // this is false by default and will be set to true
-        // if *every* collected hit for this fragment occurs
-        // max_occ_default times or more.
-        bool had_alt_max_occ = false;
         int32_t signed_rl = static_cast<int32_t>(read_seq->length());
         auto collect_mappings_from_hits =
-            [&max_stretch, &min_occ, &hit_map, &num_valid_hits, &total_occs, &largest_occ,
-             &early_stop, signed_rl, k, &map_cache, perform_ambig_filtering,
-             verbose](auto& raw_hits, auto& prev_read_pos, auto& max_allowed_occ,
-                      auto& ambiguous_hit_indices, auto& had_alt_max_occ) -> bool {
+            [&max_stretch, &hit_map, &num_valid_hits, &total_occs, &largest_occ, &early_stop,
+             signed_rl, k, &map_cache, perform_ambig_filtering, has_delta, ri, early_exit_hits,
+             &candidate_tids, restrict_targets,
+             verbose](auto& raw_hits, auto& prev_read_pos, uint64_t max_allowed_occ,
+                      auto& ambiguous_hit_indices) -> bool {
             int32_t hit_idx{0};
-
-            for (auto& raw_hit : raw_hits) {
-                auto& read_pos = raw_hit.first;
-                auto& proj_hits = raw_hit.second;
-                auto& refs = proj_hits.refRange;
-
-                uint64_t num_occ = static_cast<uint64_t>(refs.size());
-                min_occ = std::min(min_occ, num_occ);
-                had_alt_max_occ = true;
-
-                bool still_have_valid_target = false;
+            bool still_have_valid_target = false;
+            bool valid_hit_at_pos = false;
+            // the (target, orientation) pairs consistent with every hit so far, counted
+            // when their target is hit at the current position. A target hit several
+            // times at a position may be counted more than once, which only means that
+            // the early exit does not fire.
+            uint32_t num_live = 0;
+            uint32_t live_tid = std::numeric_limits<uint32_t>::max();
+            uint32_t live_tid_dirs = 0;
+            // the last target a hit was added to, and the size of hit_map then
+            uint32_t last_tid = std::numeric_limits<uint32_t>::max();
+            sketch_hit_info* last_target = nullptr;
+            size_t last_map_size = 0;
+
+            for (auto& hit : raw_hits) {
+                auto& read_pos = hit.read_pos;
+
+                uint64_t num_occ = static_cast<uint64_t>(hit.num_occs);
+
+                // the hits of both index layers for the same k-mer count as a single hit
+                const bool pos_continues =
+                    has_delta and (static_cast<size_t>(hit_idx + 1) < raw_hits.size()) and
+                    (raw_hits[hit_idx + 1].read_pos == read_pos);
                 prev_read_pos = read_pos;
 
                 if (num_occ <= max_allowed_occ) {
@@ -559,16 +854,26 @@ inline bool map_read(std::string* read_seq, mapping_cache_info& map_cache, bool
                     largest_occ = (num_occ > largest_occ) ? num_occ : largest_occ;
                     float score_inc = 1.0;
 
-                    for (auto v : refs) {
-                        const auto& ref_pos_ori = proj_hits.decode_hit(v);
-                        uint32_t tid = sshash::util::transcript_id(v);
+                    auto add_hit = [&](uint32_t tid, const ref_pos& ref_pos_ori) {
+                        if (restrict_targets and !std::binary_search(candidate_tids.begin(),
+                                                                     candidate_tids.end(), tid)) {
+                            return;
+                        }
                         int32_t pos = static_cast<int32_t>(ref_pos_ori.pos);
                         bool ori = ref_pos_ori.isFW;
-                        auto& target = hit_map[tid];
+                        // the target of the previous hit is looked up again only if a
+                        // target has been added since (which may have moved it)
+                        if (tid != last_tid or hit_map.size() != last_map_size) {
+                            auto* arena = hit_map.get_allocator().arena;
+                            last_target = &hit_map.try_emplace(tid, arena).first->second;
+                            last_tid = tid;
+                            last_map_size = hit_map.size();
+                        }
+                        auto& target = *last_target;
 
                         /*
                         if (verbose) {
-                            auto& tname = map_cache.hs.get_index()->ref_name(tid);
+                            auto tname = map_cache.hs.get_index()->ref_name(tid);
                             std::cerr << "\traw_hit [read_pos: " << read_pos << " ]:" << tname
                                       << ", " << pos << ", " << (ori ? "fw" : "rc") << "\n";
                         }
@@ -594,49 +899,77 @@ inline bool map_read(std::string* read_seq, mapping_cache_info& map_cache, bool
 
                             still_have_valid_target |=
                                 (target.max_hits_for_target() >= num_valid_hits + 1);
+
+                            if (early_exit_hits and tid != live_tid) {
+                                uint32_t dirs = target.num_directions_with(num_valid_hits + 1);
+                                if (dirs) {
+                                    num_live += dirs;
+                                    live_tid = tid;
+                                    live_tid_dirs = dirs;
+                                }
+                            }
                         }
+                    };
+
+                    if (num_occ == 1) {
+                        // the contig occurs once: decode its (inline) entry directly
+                        ref_pos ref_pos_ori;
+                        uint32_t tid = ri->decode_single(hit, ref_pos_ori);
+                        add_hit(tid, ref_pos_ori);
+                    } else {
+                        // only now build the span over the occurrences of the contig
+                        auto proj_hits = ri->project(hit);
+                        proj_hits.for_each_hit(add_hit);
+                    }
+                    valid_hit_at_pos = true;
 
-                    }  // DONE: for (auto &pos_it : refs)
+                } else if (perform_ambig_filtering) {  // HERE we have that num_occ >
+                                                       // max_allowed_occ
+                    ambiguous_hit_indices.push_back(hit_idx);
+                }
+
+                ++hit_idx;
+                if (pos_continues) { continue; }
+
+                if (valid_hit_at_pos) {
                     ++num_valid_hits;
 
                     // if there are no targets reaching the valid hit threshold, then break
                     // early
                     if (!still_have_valid_target) { return true; }
 
-                } else if (perform_ambig_filtering) {  // HERE we have that num_occ >
-                                                       // max_allowed_occ
-                    ambiguous_hit_indices.push_back(hit_idx);
+                    // If only one target, in one orientation, is consistent with every
+                    // hit, then no other can be accepted whatever the remaining hits are,
+                    // but they may still leave the read unmapped. Once enough hits support
+                    // it, accept it without looking at the rest: this is approximate.
+                    if (early_exit_hits and (num_valid_hits >= early_exit_hits) and
+                        (num_live == 1)) {
+                        // the target may have been hit again since it was counted
+                        num_live += hit_map.find(live_tid)->second.num_directions_with(
+                                        num_valid_hits) -
+                                    live_tid_dirs;
+                        if (num_live == 1) {
+                            ++map_cache.num_early_exits;
+                            return true;
+                        }
+                    }
                 }
-
-                ++hit_idx;
-            }  // DONE : for (auto& raw_hit : raw_hits)
+                still_have_valid_target = false;
+                valid_hit_at_pos = false;
+                num_live = 0;
+                live_tid = std::numeric_limits<uint32_t>::max();
+            }  // DONE : for (auto& hit : raw_hits)
 
             return false;
         };
 
-        bool _discard = false;
-        auto mao_first_pass = map_cache.max_occ_default - 1;
-        early_stop = collect_mappings_from_hits(raw_hits, prev_read_pos, mao_first_pass,
-                                                map_cache.ambiguous_hit_indices, _discard);
-
-        // If our default threshold was too stringent, then fallback to a more liberal
-        // threshold and look up the k-mers that occur the least frequently.
-        // Specifically, if the min occuring hits have frequency < max_occ_recover (2500 by
-        // default) times, then collect the min occuring hits to get the mapping.
-        if (attempt_occ_recover and (min_occ >= map_cache.max_occ_default) and
-            (min_occ < map_cache.max_occ_recover)) {
-            map_cache.ambiguous_hit_indices.clear();
-            prev_read_pos = -1;
-            uint64_t max_allowed_occ = min_occ;
-            early_stop =
-                collect_mappings_from_hits(raw_hits, prev_read_pos, max_allowed_occ,
-                                           map_cache.ambiguous_hit_indices, had_alt_max_occ);
-        }
+        early_stop = collect_mappings_from_hits(raw_hits, prev_read_pos, max_allowed_occ,
+                                                map_cache.ambiguous_hit_indices);
 
         // Further filtering of mappings by ambiguous k-mers
         if (perform_ambig_filtering and !hit_map.empty() and
             !map_cache.ambiguous_hit_indices.empty()) {
-            phmap::flat_hash_set<uint64_t> observed_ecs;
+            auto& observed_ecs = map_cache.observed_ecs;
             size_t min_cardinality_ec_size = std::numeric_limits<size_t>::max();
             uint64_t min_cardinality_ec = std::numeric_limits<size_t>::max();
             size_t min_cardinality_index = 0;
@@ -672,9 +1005,9 @@ inline bool map_read(std::string* read_seq, mapping_cache_info& map_cache, bool
 
             // for each ambiguous hit
             for (auto hit_idx : map_cache.ambiguous_hit_indices) {
-                auto& proj_hit = raw_hits[hit_idx].second;
-                uint32_t contig_id = proj_hit.contig_id();
-                bool fw_on_contig = proj_hit.hit_fw_on_contig();
+                auto& hit = raw_hits[hit_idx];
+                uint32_t contig_id = hit.contig_id;
+                bool fw_on_contig = hit.fw_on_contig;
 
                 // put the combination of the eq and the k-mer orientation
                 // into the map.
@@ -705,8 +1038,7 @@ inline bool map_read(std::string* read_seq, mapping_cache_info& map_cache, bool
             // the one with smallest cardinality.
             if (visited == 0) {
                 auto hit_idx = min_cardinality_index;
-                auto& proj_hit = raw_hits[hit_idx].second;
-                bool fw_on_contig = proj_hit.hit_fw_on_contig();
+                bool fw_on_contig = raw_hits[hit_idx].fw_on_contig;
 
                 uint64_t ec = min_cardinality_ec;
                 auto ec_entries = ec_table.entries_for_ec(ec);
@@ -749,8 +1081,6 @@ inline bool map_read(std::string* read_seq, mapping_cache_info& map_cache, bool
             }
         }
 
-        // alt_max_occ = had_alt_max_occ ? accepted_hits.size() : max_occ_default;
-
         /*
          * This rule; if enabled, allows through mappings missing a single hit, if there
          * was no mapping with all hits. NOTE: this won't work with the current early-exit
@@ -769,7 +1099,7 @@ inline bool map_read(std::string* read_seq, mapping_cache_info& map_cache, bool
     }  // DONE : if (rh)
 
     // If the read mapped to > maxReadOccs places, discard it
-    if (accepted_hits.size() > map_cache.alt_max_occ) {
+    if (accepted_hits.size() > occs.max_read_occ) {
         accepted_hits.clear();
         map_type = mapping::util::MappingType::UNMAPPED;
     } else if (!accepted_hits.empty()) {
@@ -779,6 +1109,35 @@ inline bool map_read(std::string* read_seq, mapping_cache_info& map_cache, bool
     return early_stop;
 }
 
+// Searches a read for raw hits, and collects them in map_cache for map_raw_hits().
+inline void collect_hits(std::string* read_seq, mapping_cache_info& map_cache) {
+    map_cache.clear();
+    map_cache.has_matching_kmers =
+        map_cache.hs.get_raw_hits_sketch(*read_seq, map_cache.q, true, false);
+}
+
+// Collects the raw hits of a read that were already searched for (e.g. by a
+// batched_hit_searcher) in map_cache for map_raw_hits(). The hits are swapped into
+// map_cache, and `raw_hits` is left with unspecified contents.
+inline void collect_hits(std::vector<raw_hit>& raw_hits, mapping_cache_info& map_cache) {
+    map_cache.clear();
+    map_cache.hs.get_left_hits().swap(raw_hits);
+    map_cache.has_matching_kmers = !map_cache.hs.get_left_hits().empty();
+}
+
+inline bool map_read(std::string* read_seq, mapping_cache_info& map_cache, bool verbose = false) {
+    collect_hits(read_seq, map_cache);
+    return map_raw_hits(read_seq, map_cache, verbose);
+}
+
+// Maps a read whose raw hits were already collected (e.g. by a batched_hit_searcher).
+// The hits are swapped into map_cache, and `raw_hits` is left with unspecified contents.
+inline bool map_read(std::string* read_seq, std::vector<raw_hit>& raw_hits,
+                     mapping_cache_info& map_cache, bool verbose = false) {
+    collect_hits(raw_hits, map_cache);
+    return map_raw_hits(read_seq, map_cache, verbose);
+}
+
 inline void merge_se_mappings(mapping_cache_info& map_cache_left,
                               mapping_cache_info& map_cache_right, int32_t left_len,
                               int32_t right_len, mapping_cache_info& map_cache_out) {
@@ -869,6 +1228,11 @@ inline void merge_se_mappings(mapping_cache_info& map_cache_left,
         // find hits of form 1:rc, 2:fw
         merge_lists(first_rc1, last_rc1, first_fw2, last_fw2, back_inserter);
 
+        // pseudoalignments have no positions, hence no fragment lengths
+        if (map_cache_out.pseudoalign) {
+            for (auto& h : map_cache_out.accepted_hits) { h.fragment_length = invalid_frag_len; }
+        }
+
         map_cache_out.map_type = (map_cache_out.accepted_hits.size() > 0) ? MappingType::MAPPED_PAIR
                                                                           : MappingType::UNMAPPED;
     } else if ((num_accepted_left > 0) and !had_matching_kmers_right) {
@@ -888,6 +1252,56 @@ inline void merge_se_mappings(mapping_cache_info& map_cache_left,
     }
 }
 
+// The total number of occurrences of the raw hits collected in map_cache: the fewer
+// there are, the fewer targets the read can map to.
+inline uint64_t num_hit_occurrences(mapping_cache_info& map_cache) {
+    uint64_t num_occs = 0;
+    for (auto& hit : map_cache.hs.get_left_hits()) { num_occs += hit.num_occs; }
+    return num_occs;
+}
+
+// Maps the two mates of a fragment, whose raw hits were collected (see collect_hits())
+// in map_cache_left and map_cache_right, and merges their mappings in map_cache_out
+// as merge_se_mappings() does. The mate whose hits occur the least is mapped first. If
+// it maps, then only its targets are considered for its mate, since mappings to other
+// targets could not be concordant; this also lets the collection of the hits of the
+// mate stop as soon as none of those targets is consistent with them. Otherwise, its
+// mate is mapped on its own, as an orphan may be reported for it. The mappings are
+// those of mapping the mates independently, but for the max_read_occ cap, which the
+// second mate only applies to its mappings to candidate targets.
+inline bool map_mates_jointly(std::string* left_seq, std::string* right_seq,
+                              mapping_cache_info& map_cache_left,
+                              mapping_cache_info& map_cache_right,
+                              mapping_cache_info& map_cache_out) {
+    bool left_first =
+        num_hit_occurrences(map_cache_left) <= num_hit_occurrences(map_cache_right);
+    auto& first = left_first ? map_cache_left : map_cache_right;
+    auto& second = left_first ? map_cache_right : map_cache_left;
+
+    bool early_stop = map_raw_hits(left_first ? left_seq : right_seq, first);
+
+    auto& candidates = second.candidate_tids;
+    for (auto& ah : first.accepted_hits) { candidates.push_back(ah.tid); }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    early_stop |= map_raw_hits(left_first ? right_seq : left_seq, second);
+
+    merge_se_mappings(map_cache_left, map_cache_right, static_cast<int32_t>(left_seq->length()),
+                      static_cast<int32_t>(right_seq->length()), map_cache_out);
+    return early_stop;
+}
+
+// Stops a started parser that has no consumers (e.g. when the mapping can not go on):
+// its producer threads only exit once they have handed out all the reads, so the
+// remaining chunks are taken and returned before joining them.
+template <typename ParserT>
+inline void drain_and_stop(ParserT& parser) {
+    auto rg = parser.getReadGroup();
+    while (parser.refill(rg)) {}
+    parser.stop();
+}
+
 }  // namespace util
 
 }  // namespace mapping
@@ -13,18 +13,61 @@ public:
     inline void cmd_line(std::string& cmd_line_in) { cmd_line_ = cmd_line_in; }
     inline void num_reads(uint64_t num_reads_in) { num_reads_ = num_reads_in; }
     inline void num_hits(uint64_t num_hits_in) { num_hits_ = num_hits_in; }
+    inline void num_early_exits(uint64_t num_early_exits_in) { num_early_exits_ = num_early_exits_in; }
+    inline void read_cache_stats(uint64_t num_lookups_in, uint64_t num_hits_in) {
+        num_read_cache_lookups_ = num_lookups_in;
+        num_read_cache_hits_ = num_hits_in;
+    }
+    inline void read_mask_stats(uint64_t num_reads_masked_in, uint64_t num_polya_bases_in,
+                                uint64_t num_motif_bases_in, uint64_t num_homopolymer_bases_in) {
+        read_masking_ = true;
+        num_reads_masked_ = num_reads_masked_in;
+        num_polya_bases_ = num_polya_bases_in;
+        num_motif_bases_ = num_motif_bases_in;
+        num_homopolymer_bases_ = num_homopolymer_bases_in;
+    }
+    inline void long_read_stats(uint64_t num_long_reads_in, uint64_t num_windows_in) {
+        long_reads_ = true;
+        num_long_reads_ = num_long_reads_in;
+        num_long_read_windows_ = num_windows_in;
+    }
     inline void num_seconds(double num_sec) { num_seconds_ = num_sec; }
+    inline void index_load_seconds(nlohmann::json const& load_sec) { index_load_seconds_ = load_sec; }
 
     inline std::string cmd_line() const { return cmd_line_; }
     inline uint64_t num_reads() const { return num_reads_; }
     inline uint64_t num_hits() const { return num_hits_; }
+    inline uint64_t num_early_exits() const { return num_early_exits_; }
+    inline uint64_t num_read_cache_lookups() const { return num_read_cache_lookups_; }
+    inline uint64_t num_read_cache_hits() const { return num_read_cache_hits_; }
+    inline bool read_masking() const { return read_masking_; }
+    inline uint64_t num_reads_masked() const { return num_reads_masked_; }
+    inline uint64_t num_polya_bases() const { return num_polya_bases_; }
+    inline uint64_t num_motif_bases() const { return num_motif_bases_; }
+    inline uint64_t num_homopolymer_bases() const { return num_homopolymer_bases_; }
+    inline bool long_reads() const { return long_reads_; }
+    inline uint64_t num_long_reads() const { return num_long_reads_; }
+    inline uint64_t num_long_read_windows() const { return num_long_read_windows_; }
     inline double num_seconds() const { return num_seconds_; }
+    inline nlohmann::json index_load_seconds() const { return index_load_seconds_; }
 
 private:
     std::string cmd_line_{""};
     uint64_t num_reads_{0};
     uint64_t num_hits_{0};
+    uint64_t num_early_exits_{0};
+    uint64_t num_read_cache_lookups_{0};
+    uint64_t num_read_cache_hits_{0};
+    bool read_masking_{false};
+    uint64_t num_reads_masked_{0};
+    uint64_t num_polya_bases_{0};
+    uint64_t num_motif_bases_{0};
+    uint64_t num_homopolymer_bases_{0};
+    bool long_reads_{false};
+    uint64_t num_long_reads_{0};
+    uint64_t num_long_read_windows_{0};
     double num_seconds_{0};
+    nlohmann::json index_load_seconds_;
 };
 
 inline bool write_map_info(run_stats& rs, ghc::filesystem::path& map_info_file_path) {
@@ -36,7 +79,30 @@ inline bool write_map_info(run_stats& rs, ghc::filesystem::path& map_info_file_p
     j["num_mapped"] = rs.num_hits();
     double percent_mapped = (100.0 * static_cast<double>(rs.num_hits())) / rs.num_reads();
     j["percent_mapped"] = percent_mapped;
+    // reads mapped approximately, without decoding all their hits (with --early-exit)
+    j["num_early_exits"] = rs.num_early_exits();
+    // reads whose mapping was found in the read cache (with --read-cache)
+    if (rs.num_read_cache_lookups() > 0) {
+        j["read_cache"] = {
+            {"num_lookups", rs.num_read_cache_lookups()},
+            {"num_hits", rs.num_read_cache_hits()},
+            {"hit_rate", static_cast<double>(rs.num_read_cache_hits()) /
+                             rs.num_read_cache_lookups()}};
+    }
+    // the bases masked before the hit search (with the --mask-* options)
+    if (rs.read_masking()) {
+        j["read_masking"] = {{"num_reads_masked", rs.num_reads_masked()},
+                             {"num_polya_bases", rs.num_polya_bases()},
+                             {"num_motif_bases", rs.num_motif_bases()},
+                             {"num_homopolymer_bases", rs.num_homopolymer_bases()}};
+    }
+    // the reads mapped in windows (with --long-read-window)
+    if (rs.long_reads()) {
+        j["long_reads"] = {{"num_reads", rs.num_long_reads()},
+                           {"num_windows", rs.num_long_read_windows()}};
+    }
     j["runtime_seconds"] = rs.num_seconds();
+    if (!rs.index_load_seconds().is_null()) { j["index_load_seconds"] = rs.index_load_seconds(); }
     // write prettified JSON to another file
     std::ofstream o(map_info_file_path.string());
 
@@ -8,6 +8,77 @@ struct ref_pos {
     bool isFW;
 };
 
+// A compact record of a hit, as the hit search collects one for each k-mer of a read
+// it finds in the index: where the k-mer is on the read and on its contig, and where
+// the occurrences of the contig are in the contig table of the index layer the hit
+// comes from. `reference_index::project()` turns it into projected_hits, building
+// the span over the occurrences only once they are needed.
+struct raw_hit {
+    int32_t read_pos{0};
+    uint32_t contig_id{0};
+    // the position of the k-mer on the contig, and the length of the contig
+    uint32_t contig_pos{0};
+    uint32_t contig_len{0};
+    // the number of occurrences of the contig (0 if the k-mer was not found)
+    uint32_t num_occs{0};
+    // true if the k-mer maps to the contig in the forward orientation
+    bool fw_on_contig{false};
+    // true if the hit comes from the delta layer of the index
+    bool from_delta{false};
+    // the first occurrence, see basic_contig_table::entries_range
+    uint64_t ctab_start{0};
+
+    inline bool empty() const { return num_occs == 0; }
+};
+
+// Where a k-mer at position `contig_pos` of a contig of length `contig_len`, mapping
+// to it in orientation `contig_orientation` (true for fw), falls on the reference of
+// the contig table entry `v` (decoded with `codec`).
+template <typename Codec>
+inline ref_pos decode_contig_entry(uint64_t v, Codec const& codec, uint32_t contig_pos,
+                                   uint32_t contig_len, bool contig_orientation, uint32_t k) {
+    // true if the contig is fowrard on the reference
+    bool contigFW = codec.orientation(v);
+    // we are forward with respect to the reference if :
+    // (1) contigFW and contig_orientation
+    // (2) !contigFW and !contig_orientation
+    // we are reverse complement with respect to the reference if :
+    // (3) configFW and !contig_orientation
+    // (4) !configFW and contig_orientation
+
+    // if we're in the forward orientation, then our position is
+    // just the contig offset plus or relative position
+    uint32_t rpos;  //{0};
+    bool rfw;       //{false};
+    if (contigFW and contig_orientation) {
+        // kmer   :          AGC
+        // contig :      ACTTAGC
+        // ref    :  GCA[ACTTAGC]CA
+        rpos = codec.pos(v) + contig_pos;
+        rfw = true;
+    } else if (contigFW and !contig_orientation) {
+        // kmer   :          GCT
+        // contig :      ACTTAGC
+        // ref    :  GCA[ACTTAGC]CA
+        rpos = codec.pos(v) + contig_pos;
+        rfw = false;
+    } else if (!contigFW and contig_orientation) {
+        // kmer   :          AGT
+        // contig :      GCTAAGT
+        // ref    :  GCA[ACTTAGC]CA
+        rpos = codec.pos(v) + contig_len - (contig_pos + k);
+        rfw = false;
+    } else {  // if (!contigFW and !contig_orientation) {
+        // kmer   :          ACT
+        // contig :      GCTAAGT
+        // ref    :  GCA[ACTTAGC]CA
+        rpos = codec.pos(v) + contig_len - (contig_pos + k);
+        rfw = true;
+    }
+
+    return {rpos, rfw};
+}
+
 struct projected_hits {
     uint32_t contigIdx_;
     // The relative position of the k-mer inducing this hit on the
@@ -21,53 +92,33 @@ struct projected_hits {
     uint32_t k_;
 
     sshash::util::contig_span refRange;
+    // decodes the entries of refRange; it comes from the contig table of the
+    // index that produced this hit
+    sshash::util::contig_entry_codec codec_;
 
     inline bool empty() { return refRange.empty(); }
 
     inline uint32_t contig_id() const { return contigIdx_; }
     inline bool hit_fw_on_contig() const { return contigOrientation_; }
 
-    inline ref_pos decode_hit(uint64_t v) {
-        // true if the contig is fowrard on the reference
-        bool contigFW = sshash::util::orientation(v);
-        // we are forward with respect to the reference if :
-        // (1) contigFW and contigOrientation_
-        // (2) !contigFW and !contigOrientation_
-        // we are reverse complement with respect to the reference if :
-        // (3) configFW and !contigOrientation_
-        // (4) !configFW and contigOrientation_
+    inline uint32_t transcript_id(uint64_t v) const { return codec_.transcript_id(v); }
 
-        // if we're in the forward orientation, then our position is
-        // just the contig offset plus or relative position
-        uint32_t rpos;  //{0};
-        bool rfw;       //{false};
-        if (contigFW and contigOrientation_) {
-            // kmer   :          AGC
-            // contig :      ACTTAGC
-            // ref    :  GCA[ACTTAGC]CA
-            rpos = sshash::util::pos(v) + contigPos_;
-            rfw = true;
-        } else if (contigFW and !contigOrientation_) {
-            // kmer   :          GCT
-            // contig :      ACTTAGC
-            // ref    :  GCA[ACTTAGC]CA
-            rpos = sshash::util::pos(v) + contigPos_;
-            rfw = false;
-        } else if (!contigFW and contigOrientation_) {
-            // kmer   :          AGT
-            // contig :      GCTAAGT
-            // ref    :  GCA[ACTTAGC]CA
-            rpos = sshash::util::pos(v) + contigLen_ - (contigPos_ + k_);
-            rfw = false;
-        } else {  // if (!contigFW and !contigOrientation_) {
-            // kmer   :          ACT
-            // contig :      GCTAAGT
-            // ref    :  GCA[ACTTAGC]CA
-            rpos = sshash::util::pos(v) + contigLen_ - (contigPos_ + k_);
-            rfw = true;
-        }
+    inline ref_pos decode_hit(uint64_t v) const { return decode_hit(v, codec_); }
+
+    // Decode with `codec`, which must have the layout of codec_; code specialized on
+    // the number of position bits can pass a sshash::util::fixed_contig_entry_codec.
+    template <typename Codec>
+    inline ref_pos decode_hit(uint64_t v, Codec const& codec) const {
+        return decode_contig_entry(v, codec, contigPos_, contigLen_, contigOrientation_, k_);
+    }
 
-        return {rpos, rfw};
+    // Calls f(transcript_id, ref_pos) for every entry of refRange, with a decoding loop
+    // specialized on the number of position bits of codec_ when it is a common one.
+    template <typename F>
+    inline void for_each_hit(F&& f) {
+        sshash::util::with_contig_entry_codec(codec_, [&](auto const& codec) {
+            for (auto v : refRange) { f(codec.transcript_id(v), decode_hit(v, codec)); }
+        });
     }
 
     // inline friend function :
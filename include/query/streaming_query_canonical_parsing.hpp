@@ -35,6 +35,8 @@ struct streaming_query_canonical_parsing {
 
         , m_num_searches(0)
         , m_num_extensions(0)
+        , m_num_cache_hits(0)
+        , m_num_cache_misses(0)
 
     {
         assert(m_dict->m_canonical_parsing);
@@ -42,9 +44,68 @@ struct streaming_query_canonical_parsing {
 
     inline void start() { m_start = true; }
 
+    /*
+        The canonical minimizer of the k-mer `km` and the range [begin, end) of
+        super-k-mers of its bucket, as found beforehand (by the prefetching methods of
+        the dictionary). If `km` is the next k-mer looked up, the lookup takes them
+        instead of computing the minimizer and looking up its bucket again.
+    */
+    inline void set_next_bucket(uint64_t km, uint64_t minimizer, uint64_t begin,
+                                uint64_t end) {
+        m_hint_kmer = km;
+        m_hint_minimizer = minimizer;
+        m_hint_begin = begin;
+        m_hint_end = end;
+    }
+
+    /*
+        Enable a direct-mapped cache of (at least) `num_entries` entries (rounded up
+        to a power of 2), mapping canonical k-mers to their lookup results, misses
+        included. get_contig_pos() consults it whenever it would otherwise start a
+        new search (rather than extend the previous one), which spares the minimizer,
+        bucket and string accesses for the k-mers queried over and over.
+        With 0 entries, the cache is disabled.
+    */
+    void enable_kmer_cache(uint64_t num_entries) {
+        m_cache.clear();
+        m_cache_mask = 0;
+        if (num_entries == 0) return;
+        uint64_t n = 1;
+        while (n < num_entries) n <<= 1;
+        m_cache.resize(n);
+        m_cache_mask = n - 1;
+    }
+
     lookup_result get_contig_pos(const uint64_t km, const uint64_t km_rc,
                                  const uint64_t query_offset) {
-        return lookup_advanced(km, km_rc, query_offset);
+        if (m_cache.empty() or (!m_start and (m_prev_query_offset + 1) == query_offset)) {
+            return lookup_advanced(km, km_rc, query_offset);
+        }
+
+        /* the result is cached relative to the canonical k-mer */
+        uint64_t canonical = std::min(km, km_rc);
+        bool flip = canonical != km;
+        auto& entry = m_cache[hash_kmer(canonical) & m_cache_mask];
+        if (entry.kmer == canonical) {
+            ++m_num_cache_hits;
+            /* the search state is not that of this k-mer: start anew next time */
+            m_start = true;
+            m_prev_query_offset = query_offset;
+            lookup_result res = entry.res;
+            if (flip and res.kmer_id != constants::invalid_uint64) {
+                res.kmer_orientation = !res.kmer_orientation;
+            }
+            return res;
+        }
+
+        ++m_num_cache_misses;
+        lookup_result res = lookup_advanced(km, km_rc, query_offset);
+        entry.kmer = canonical;
+        entry.res = res;
+        if (flip and res.kmer_id != constants::invalid_uint64) {
+            entry.res.kmer_orientation = !res.kmer_orientation;
+        }
+        return res;
     }
 
     lookup_result lookup_advanced(const uint64_t km, const uint64_t km_rc,
@@ -89,16 +150,27 @@ struct streaming_query_canonical_parsing {
     }
 
     lookup_result do_lookup_advanced() {
-        m_curr_minimizer = m_minimizer_enum.next(m_kmer, m_start);
-        assert(m_curr_minimizer == util::compute_minimizer(m_kmer, m_k, m_m, m_seed));
-        constexpr bool reverse = true;
-        uint64_t minimizer_rc = m_minimizer_enum_rc.next<reverse>(m_kmer_rc, m_start);
-        assert(minimizer_rc == util::compute_minimizer(m_kmer_rc, m_k, m_m, m_seed));
-        m_curr_minimizer = std::min<uint64_t>(m_curr_minimizer, minimizer_rc);
+        m_use_hint = (m_hint_kmer == m_kmer);
+        if (m_use_hint) {
+            /* the enumerators are not fed this k-mer: the next one refills them */
+            m_curr_minimizer = m_hint_minimizer;
+            m_hint_kmer = constants::invalid_uint64;
+            m_refill_enums = true;
+        } else {
+            bool clear = m_start or m_refill_enums;
+            m_refill_enums = false;
+            m_curr_minimizer = m_minimizer_enum.next(m_kmer, clear);
+            assert(m_curr_minimizer == util::compute_minimizer(m_kmer, m_k, m_m, m_seed));
+            constexpr bool reverse = true;
+            uint64_t minimizer_rc = m_minimizer_enum_rc.next<reverse>(m_kmer_rc, clear);
+            assert(minimizer_rc == util::compute_minimizer(m_kmer_rc, m_k, m_m, m_seed));
+            m_curr_minimizer = std::min<uint64_t>(m_curr_minimizer, minimizer_rc);
+        }
 
         /* 3. compute result */
         if (m_start) {
-            locate_bucket();
+            /* a new search in the bucket of the previous one need not locate it again */
+            if (!same_minimizer()) locate_bucket();
             lookup_advanced();
         } else if (same_minimizer()) {
             if (minimizer_found()) {
@@ -127,6 +199,8 @@ struct streaming_query_canonical_parsing {
 
     uint64_t num_searches() const { return m_num_searches; }
     uint64_t num_extensions() const { return m_num_extensions; }
+    uint64_t num_cache_hits() const { return m_num_cache_hits; }
+    uint64_t num_cache_misses() const { return m_num_cache_misses; }
 
 private:
     dictionary const* m_dict;
@@ -155,11 +229,41 @@ private:
     /* performance counts */
     uint64_t m_num_searches;
     uint64_t m_num_extensions;
+    uint64_t m_num_cache_hits;
+    uint64_t m_num_cache_misses;
+
+    /* bucket located beforehand for the next k-mer (see set_next_bucket) */
+    uint64_t m_hint_kmer = constants::invalid_uint64;
+    uint64_t m_hint_minimizer = 0;
+    uint64_t m_hint_begin = 0, m_hint_end = 0;
+    bool m_use_hint = false;
+    bool m_refill_enums = false;
+
+    /* k-mer cache */
+    struct cache_entry {
+        uint64_t kmer = constants::invalid_uint64;  // never a k-mer, as k < 32
+        lookup_result res;
+    };
+    std::vector<cache_entry> m_cache;
+    uint64_t m_cache_mask = 0;
+
+    static inline uint64_t hash_kmer(uint64_t kmer) {
+        /* the finalizer of MurmurHash3 */
+        kmer ^= kmer >> 33;
+        kmer *= 0xff51afd7ed558ccdULL;
+        kmer ^= kmer >> 33;
+        return kmer;
+    }
 
     inline bool same_minimizer() const { return m_curr_minimizer == m_prev_minimizer; }
     inline bool minimizer_found() const { return !m_minimizer_not_found; }
 
     void locate_bucket() {
+        if (m_use_hint) {
+            m_begin = m_hint_begin;
+            m_end = m_hint_end;
+            return;
+        }
         uint64_t bucket_id = (m_dict->m_minimizers).lookup(m_curr_minimizer);
         std::tie(m_begin, m_end) = (m_dict->m_buckets).locate_bucket(bucket_id);
     }
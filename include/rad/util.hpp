@@ -23,7 +23,7 @@ inline size_t write_rad_header(mindex::reference_index& ri, size_t bc_length, si
     rad_header rh;
     // right now, all formats are effectively single-end
     rh.is_paired(false);
-    for (size_t i = 0; i < ri.num_refs(); ++i) { rh.add_refname(ri.ref_name(i)); }
+    ri.for_each_ref([&rh](std::string const& name, uint64_t) { rh.add_refname(name); });
     rh.dump_to_bin(bw);
 
     // where we will write the number of chunks when we know
@@ -106,7 +106,7 @@ inline size_t write_rad_header_bulk(mindex::reference_index& ri, bool is_paired,
     //  RADHeader
     rad_header rh;
     rh.is_paired(is_paired);
-    for (size_t i = 0; i < ri.num_refs(); ++i) { rh.add_refname(ri.ref_name(i)); }
+    ri.for_each_ref([&rh](std::string const& name, uint64_t) { rh.add_refname(name); });
     rh.dump_to_bin(bw);
 
     // where we will write the number of chunks when we know
@@ -269,6 +269,8 @@ inline void write_to_rad_stream_bulk(mapping::util::MappingType map_type,
                 // if we actually have a paird fragment get the
                 // leftmost position
                 leftmost_pos = std::min(aln.pos, aln.mate_pos);
+                // (pseudoalignments have no fragment length)
+                if (aln.fragment_length == mapping::util::invalid_frag_len) { break; }
                 frag_len = aln.frag_len();
                 // if the leftmost position is < 0, then adjust
                 // the overhang by setting the start position to 0
@@ -1,15 +1,19 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <exception>
 #include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #include "dictionary.hpp"
 #include "basic_contig_table.hpp"
 #include "equivalence_class_map.hpp"
+#include "reference_info.hpp"
 #include "../external/pthash/external/essentials/include/essentials.hpp"
-#include "../include/bitsery/bitsery.h"
-#include "../include/bitsery/adapter/stream.h"
-#include "../include/bitsery/brief_syntax/vector.h"
-#include "../include/bitsery/brief_syntax/string.h"
 #include "../include/ghc/filesystem.hpp"
 //#include "query/contig_info_query_canonical_parsing.cpp"
 #include "query/streaming_query_canonical_parsing.hpp"
@@ -17,6 +21,7 @@
 #include "CanonicalKmerIterator.hpp"
 #include "projected_hits.hpp"
 #include "util.hpp"
+#include "json.hpp"
 #include "spdlog/spdlog.h"
 
 namespace mindex {
@@ -24,16 +29,25 @@ class reference_index {
 public:
     reference_index(const std::string& basename, bool attempt_load_ec_map = false) {
         spdlog::info("loading index from {}", basename);
+        auto start = std::chrono::steady_clock::now();
+
+        // the components are independent, so load them concurrently
         std::string dict_name = basename + ".sshash";
-        essentials::load(m_dict, dict_name.c_str());
         std::string ctg_name = basename + ".ctab";
-        essentials::load(m_bct, ctg_name.c_str());
+        std::string ref_info_name = basename + ".refinfo";
+        auto dict_load = std::async(std::launch::async,
+                                    [this, &dict_name]() { return timed_load(m_dict, dict_name); });
+        auto ctab_load = std::async(std::launch::async,
+                                    [this, &ctg_name]() { return timed_load(m_bct, ctg_name); });
+        m_load_seconds["refinfo"] = timed_load(m_ref_info, ref_info_name);
+        m_num_base_refs = m_ref_info.size();
+        m_load_seconds["sshash"] = dict_load.get();
+        m_load_seconds["ctab"] = ctab_load.get();
 
+        std::string ectab_name = basename + ".ectab";
         if (attempt_load_ec_map) {
-            std::string ectab_name = basename + ".ectab";
             if (ghc::filesystem::exists(ectab_name)) {
                 m_has_ec_tab = true;
-                essentials::load(m_ec_tab, ectab_name.c_str());
             } else {
                 spdlog::warn(
                     "user requested an option that required loading the ec map, but that was "
@@ -44,29 +58,56 @@ public:
             }
         }
 
-        // based on the number of bits used to encode reference positions
-        // read from the file, set the shift we have to perform on a
-        // contig table entry to read off the reference id (= m_ref_len_bits + 1)
-        // where the +1 is for the orientation bit.
-        sshash::util::_ref_shift = (m_bct.m_ref_len_bits + 1);
-        // based on the value of m_ref_len_bits, select the appropriate mask to use
-        // when decoding a reference position from a contig table entry.
-        sshash::util::_pos_mask = sshash::util::pos_masks[m_bct.m_ref_len_bits];
-
-        std::string ref_info = basename + ".refinfo";
+        // if a delta (built with `build --delta-of`) exists for this index,
+        // load it as well so that it is queried along with the base.
+        std::string delta_name = basename + ".delta";
+        if (ghc::filesystem::exists(delta_name + ".sshash")) {
+            auto delta_start = std::chrono::steady_clock::now();
+            load_delta(delta_name);
+            m_load_seconds["delta"] = seconds_since(delta_start);
+        }
 
-        std::fstream s{ref_info.c_str(), s.binary | s.in};
-        auto state = bitsery::quickDeserialization<bitsery::InputStreamAdapter>(s, m_ref_names);
-        state = bitsery::quickDeserialization<bitsery::InputStreamAdapter>(s, m_ref_lens);
+        // the ec map is only consulted for reads with highly-repetitive hits, so
+        // it is loaded in the background, while the first reads are being mapped.
+        // get_ec_table() waits for it to be ready.
+        if (m_has_ec_tab) {
+            m_ec_tab_loader = std::thread([this, ectab_name]() {
+                try {
+                    m_ec_tab_load_seconds = timed_load(m_ec_tab, ectab_name);
+                    spdlog::info("done loading ec map from {}", ectab_name);
+                } catch (...) { m_ec_tab_error = std::current_exception(); }
+            });
+        }
+        m_load_seconds["total"] = seconds_since(start);
         spdlog::info("done loading index");
     }
 
+    ~reference_index() {
+        if (m_ec_tab_loader.joinable()) { m_ec_tab_loader.join(); }
+    }
+
     projected_hits query(pufferfish::CanonicalKmerIterator kmit,
                          sshash::streaming_query_canonical_parsing& q) {
-        auto qres = q.get_contig_pos(kmit->first.fwWord(), kmit->first.rcWord(), kmit->second);
+        raw_hit hit;
+        uint64_t global_pos = query_raw(kmit, q, hit);
+        if (hit.empty()) {
+            return {invalid_u32, invalid_u32, false,
+                    invalid_u32, invalid_u64, static_cast<uint32_t>(m_dict.k()),
+                    {}, m_bct.codec()};
+        }
+        auto phits = project_in_layer(hit);
+        phits.globalPos_ = global_pos;
+        return phits;
+    }
 
-        constexpr uint64_t invalid_u64 = std::numeric_limits<uint64_t>::max();
-        constexpr uint32_t invalid_u32 = std::numeric_limits<uint32_t>::max();
+    // Look up a k-mer as query() does, but only fill the compact `hit` (but for its
+    // read position): the occurrences of the contig are located in the contig table,
+    // but not read. Returns the position of the k-mer in the contig strings (i.e.,
+    // its k-mer id plus (k - 1) for each contig before its own), which the hit search
+    // needs to read the k-mers that follow on the contig.
+    uint64_t query_raw(pufferfish::CanonicalKmerIterator kmit,
+                       sshash::streaming_query_canonical_parsing& q, raw_hit& hit) {
+        auto qres = q.get_contig_pos(kmit->first.fwWord(), kmit->first.rcWord(), kmit->second);
 
         bool is_member = (qres.kmer_id != sshash::constants::invalid_uint64);
 
@@ -78,59 +119,196 @@ public:
         // std::cout << "contig_id " << qres.contig_id << '\n';
         // std::cout << "contig_size " << qres.contig_size << '\n';
 
-        if (is_member) {
-            qres.contig_size += m_dict.k() - 1;
-            auto start_pos = m_bct.m_ctg_offsets.access(qres.contig_id);
-            auto end_pos = m_bct.m_ctg_offsets.access(qres.contig_id + 1);
-            size_t len = end_pos - start_pos;
-            sshash::util::contig_span s{m_bct.m_ctg_entries.at(start_pos),
-                                        m_bct.m_ctg_entries.at(start_pos + len), len};
-
-            uint32_t contig_id = (qres.contig_id > invalid_u32)
-                                     ? invalid_u32
-                                     : static_cast<uint32_t>(qres.contig_id);
-            uint32_t contig_offset = (qres.kmer_id_in_contig > invalid_u32)
-                                         ? invalid_u32
-                                         : static_cast<uint32_t>(qres.kmer_id_in_contig);
-            uint32_t contig_length = (qres.contig_size > invalid_u32)
-                                         ? invalid_u32
-                                         : static_cast<uint32_t>(qres.contig_size);
-
-            bool is_forward = (qres.kmer_orientation == sshash::constants::forward_orientation);
-
-            return projected_hits{contig_id,
-                                  contig_offset,
-                                  is_forward,
-                                  contig_length,
-                                  qres.kmer_id,
-                                  static_cast<uint32_t>(m_dict.k()),
-                                  s};
-        } else {
-            return {invalid_u32, invalid_u32, false,
-                    invalid_u32, invalid_u64, static_cast<uint32_t>(m_dict.k()),
-                    {}};
+        if (!is_member) {
+            hit = raw_hit();
+            return invalid_u64;
+        }
+
+        qres.contig_size += m_dict.k() - 1;
+        auto [ctab_start, num_occs] = m_bct.entries_range(qres.contig_id);
+
+        hit.contig_id = (qres.contig_id > invalid_u32) ? invalid_u32
+                                                        : static_cast<uint32_t>(qres.contig_id);
+        hit.contig_pos = (qres.kmer_id_in_contig > invalid_u32)
+                             ? invalid_u32
+                             : static_cast<uint32_t>(qres.kmer_id_in_contig);
+        hit.contig_len = (qres.contig_size > invalid_u32) ? invalid_u32
+                                                          : static_cast<uint32_t>(qres.contig_size);
+        hit.num_occs = static_cast<uint32_t>(num_occs);
+        hit.fw_on_contig = (qres.kmer_orientation == sshash::constants::forward_orientation);
+        hit.from_delta = false;
+        hit.ctab_start = ctab_start;
+        return qres.kmer_id;
+    }
+
+    // Query the delta layer (if any) for the same k-mer. The returned hit
+    // has its contig id offset by the number of contigs in the base, so that
+    // contigs from the two layers never compare equal. The reference ids in
+    // the delta contig table already follow those of the base.
+    projected_hits query_delta(pufferfish::CanonicalKmerIterator kmit,
+                               sshash::streaming_query_canonical_parsing& q) {
+        auto phits = m_delta->query(kmit, q);
+        if (!phits.empty()) { phits.contigIdx_ += m_num_base_contigs; }
+        return phits;
+    }
+
+    uint64_t query_delta_raw(pufferfish::CanonicalKmerIterator kmit,
+                             sshash::streaming_query_canonical_parsing& q, raw_hit& hit) {
+        uint64_t global_pos = m_delta->query_raw(kmit, q, hit);
+        if (!hit.empty()) {
+            hit.contig_id += m_num_base_contigs;
+            hit.from_delta = true;
         }
+        return global_pos;
+    }
+
+    // The projected hits of a raw hit found by query_raw() or query_delta_raw(),
+    // decoded with the contig table of the layer the hit comes from. Their global
+    // position is not recorded in the raw hit, and is left invalid.
+    projected_hits project(const raw_hit& hit) const {
+        return hit.from_delta ? m_delta->project_in_layer(hit) : project_in_layer(hit);
+    }
+
+    // For a raw hit on a contig that occurs once (hit.num_occs == 1), the reference
+    // of that occurrence, and in `rp`, where the hit falls on it: what decoding the
+    // only entry of project(hit) gives, but read straight from the contig table,
+    // which keeps the entries of such contigs inline.
+    uint32_t decode_single(const raw_hit& hit, ref_pos& rp) const {
+        return hit.from_delta ? m_delta->decode_single_in_layer(hit, rp)
+                              : decode_single_in_layer(hit, rp);
     }
 
+    bool has_delta() const { return static_cast<bool>(m_delta); }
+    const reference_index* get_delta() const { return m_delta.get(); }
+    uint64_t num_base_contigs() const { return m_num_base_contigs; }
+
     uint64_t k() const { return m_dict.k(); }
     const sshash::dictionary* get_dict() const { return &m_dict; }
     pthash::bit_vector& contigs() { return m_dict.m_buckets.strings; }
-    const std::string& ref_name(size_t i) const { return m_ref_names[i]; }
-    uint64_t ref_len(size_t i) const { return m_ref_lens[i]; }
-    uint64_t num_refs() const { return m_ref_names.size(); }
+    // the length (in bases) of a contig of this layer
+    uint64_t contig_length(uint64_t contig_id) const {
+        return m_dict.m_buckets.contig_length(contig_id);
+    }
+    // the references of the delta (if any) follow those of the base
+    std::string ref_name(size_t i) const {
+        return (i < m_num_base_refs) ? m_ref_info.name(i) : m_delta->ref_name(i - m_num_base_refs);
+    }
+    uint64_t ref_len(size_t i) const {
+        return (i < m_num_base_refs) ? m_ref_info.len(i) : m_delta->ref_len(i - m_num_base_refs);
+    }
+    uint64_t num_refs() const { return m_num_base_refs + (m_delta ? m_delta->num_refs() : 0); }
+
+    // Call f(name, len) for every reference, in order. This streams the names,
+    // and is much faster than calling ref_name() for each of them.
+    template <typename Func>
+    void for_each_ref(Func f) const {
+        m_ref_info.for_each(f);
+        if (m_delta) { m_delta->for_each_ref(f); }
+    }
     const sshash::basic_contig_table& get_contig_table() const { return m_bct; }
 
     bool has_ec_table() const { return m_has_ec_tab; }
-    const sshash::equivalence_class_map& get_ec_table() { return m_ec_tab; }
+    // blocks until the ec map, loaded in the background, is ready
+    const sshash::equivalence_class_map& get_ec_table() {
+        if (!m_ec_tab_ready.load(std::memory_order_acquire)) { wait_for_ec_table(); }
+        return m_ec_tab;
+    }
+
+    // wall-clock seconds spent loading each component of the index, and the whole
+    // index ("total", which does not include the ec map loaded in the background)
+    nlohmann::json load_seconds() {
+        nlohmann::json j = m_load_seconds;
+        if (m_has_ec_tab) {
+            get_ec_table();
+            j["ectab"] = m_ec_tab_load_seconds;
+        }
+        return j;
+    }
 
 private:
+    static constexpr uint64_t invalid_u64 = std::numeric_limits<uint64_t>::max();
+    static constexpr uint32_t invalid_u32 = std::numeric_limits<uint32_t>::max();
+
+    projected_hits project_in_layer(const raw_hit& hit) const {
+        return projected_hits{hit.contig_id,
+                              hit.contig_pos,
+                              hit.fw_on_contig,
+                              hit.contig_len,
+                              invalid_u64,
+                              static_cast<uint32_t>(m_dict.k()),
+                              m_bct.entries(hit.ctab_start, hit.num_occs),
+                              m_bct.codec()};
+    }
+
+    uint32_t decode_single_in_layer(const raw_hit& hit, ref_pos& rp) const {
+        assert(hit.num_occs == 1);
+        auto codec = m_bct.codec();
+        uint64_t v = m_bct.single_entry(hit.ctab_start);
+        rp = decode_contig_entry(v, codec, hit.contig_pos, hit.contig_len, hit.fw_on_contig,
+                                 static_cast<uint32_t>(m_dict.k()));
+        return codec.transcript_id(v);
+    }
+
+    template <typename T>
+    static double timed_load(T& data, std::string const& filename) {
+        auto start = std::chrono::steady_clock::now();
+        essentials::load(data, filename.c_str());
+        return seconds_since(start);
+    }
+
+    static double seconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void wait_for_ec_table() {
+        std::lock_guard<std::mutex> lock(m_ec_tab_mutex);
+        if (m_ec_tab_loader.joinable()) { m_ec_tab_loader.join(); }
+        if (m_ec_tab_error) { std::rethrow_exception(m_ec_tab_error); }
+        m_ec_tab_ready.store(true, std::memory_order_release);
+    }
+
+    void load_delta(const std::string& delta_name) {
+        spdlog::info("loading delta index from {}", delta_name);
+        m_delta.reset(new reference_index(delta_name));
+        if (m_delta->k() != k() or m_delta->m_bct.m_ref_len_bits != m_bct.m_ref_len_bits) {
+            spdlog::critical(
+                "the delta index {} is incompatible with the base index (k = {} vs. {}, "
+                "reference length bits = {} vs. {}); rebuild it with `build --delta-of`.",
+                delta_name, m_delta->k(), k(), m_delta->m_bct.m_ref_len_bits,
+                m_bct.m_ref_len_bits);
+            throw std::runtime_error("incompatible delta index");
+        }
+        // the hits of the delta are decoded with the codec of its own contig table,
+        // which `build --delta-of` makes encode positions with as many bits as the base.
+        m_num_base_contigs = m_bct.num_contigs();
+        size_t num_delta_refs = m_delta->num_refs();
+        if (m_has_ec_tab) {
+            spdlog::warn(
+                "the ec map is not supported for an index with an unmerged delta; features "
+                "requiring it will be disabled. Run `merge` to fold the delta into the index.");
+            m_has_ec_tab = false;
+        }
+        spdlog::info("delta adds {} references", num_delta_refs);
+    }
+
     sshash::dictionary m_dict;
     sshash::basic_contig_table m_bct;
     sshash::equivalence_class_map m_ec_tab;
-    std::vector<std::string> m_ref_names;
-    std::vector<uint64_t> m_ref_lens;
+    sshash::reference_info m_ref_info;
+    // the number of references in m_ref_info (i.e., in the base layer)
+    uint64_t m_num_base_refs{0};
     // will be set to true if we have & load
     // and equivalence class table.
     bool m_has_ec_tab{false};
+    // background load of the ec map, and whether it has completed
+    std::thread m_ec_tab_loader;
+    std::exception_ptr m_ec_tab_error;
+    std::mutex m_ec_tab_mutex;
+    std::atomic<bool> m_ec_tab_ready{false};
+    double m_ec_tab_load_seconds{0.0};
+    nlohmann::json m_load_seconds;
+    // optional delta layer, and the number of contigs in this (base) layer
+    std::unique_ptr<reference_index> m_delta;
+    uint64_t m_num_base_contigs{0};
 };
 }  // namespace mindex
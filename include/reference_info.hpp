@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "util.hpp"
+#include "ef_sequence.hpp"
+#include "spdlog/spdlog.h"
+
+namespace sshash {
+
+/*
+    Names and lengths of the references of an index.
+
+    The names are front-coded in one contiguous byte arena: they are grouped in buckets
+    of `bucket_size` consecutive names, the first name of a bucket is stored in full and
+    every other one as the length of the prefix it shares with its predecessor followed
+    by the rest of the name. Lengths are varint-encoded. The Elias-Fano sequence
+    m_bucket_offsets gives where each bucket starts in the arena, so a name is decoded
+    from the start of its bucket, while all names can be streamed in one pass.
+    The reference lengths are stored in a compact_vector using as many bits as the
+    longest reference needs.
+    The file starts with a magic word and a format version, checked before anything
+    else is read: a file of another format (such as the .refinfo of indices built
+    before this one was introduced) is reported, rather than loaded as garbage.
+*/
+class reference_info {
+public:
+    static constexpr uint64_t bucket_size = 16;
+    static constexpr uint64_t magic = 0x6f666e6966657270;  // "prefinfo", little-endian
+    static constexpr uint64_t version = 1;
+
+    void build(std::vector<std::string> const& names, std::vector<uint64_t> const& lens) {
+        assert(names.size() == lens.size());
+        m_names.clear();
+        std::vector<uint64_t> bucket_offsets;
+        bucket_offsets.reserve((names.size() + bucket_size - 1) / bucket_size + 1);
+        for (uint64_t i = 0; i != names.size(); ++i) {
+            std::string const& name = names[i];
+            uint64_t lcp = 0;
+            if (i % bucket_size == 0) {
+                bucket_offsets.push_back(m_names.size());
+            } else {
+                std::string const& prev = names[i - 1];
+                while (lcp < name.size() and lcp < prev.size() and name[lcp] == prev[lcp]) ++lcp;
+                write_varint(lcp);
+            }
+            write_varint(name.size() - lcp);
+            m_names.insert(m_names.end(), name.begin() + lcp, name.end());
+        }
+        bucket_offsets.push_back(m_names.size());
+        m_names.shrink_to_fit();
+        m_bucket_offsets.encode(bucket_offsets.begin(), bucket_offsets.size(),
+                                bucket_offsets.back());
+
+        uint64_t max_len = 0;
+        for (auto len : lens) max_len = std::max(max_len, len);
+        uint64_t len_bits = std::max<uint64_t>(1, std::ceil(std::log2(max_len + 1)));
+        auto lens_builder = pthash::compact_vector::builder(lens.size(), len_bits);
+        for (uint64_t i = 0; i != lens.size(); ++i) lens_builder.set(i, lens[i]);
+        lens_builder.build(m_lens);
+    }
+
+    uint64_t size() const { return m_lens.size(); }
+
+    uint64_t len(uint64_t i) const { return m_lens.access(i); }
+
+    /* Decode the name of the i-th reference into `name`. */
+    void name(uint64_t i, std::string& name) const {
+        uint64_t bucket = i / bucket_size;
+        uint8_t const* p = m_names.data() + m_bucket_offsets.access(bucket);
+        uint64_t len = read_varint(p);
+        name.assign(reinterpret_cast<char const*>(p), len);
+        p += len;
+        for (uint64_t j = bucket * bucket_size; j != i; ++j) {
+            uint64_t lcp = read_varint(p);
+            len = read_varint(p);
+            name.resize(lcp);
+            name.append(reinterpret_cast<char const*>(p), len);
+            p += len;
+        }
+    }
+
+    std::string name(uint64_t i) const {
+        std::string s;
+        name(i, s);
+        return s;
+    }
+
+    /* Call f(name, len) for every reference, in order, decoding the names in one pass. */
+    template <typename Func>
+    void for_each(Func f) const {
+        std::string name;
+        uint8_t const* p = m_names.data();
+        for (uint64_t i = 0; i != size(); ++i) {
+            uint64_t lcp = (i % bucket_size == 0) ? 0 : read_varint(p);
+            uint64_t len = read_varint(p);
+            name.resize(lcp);
+            name.append(reinterpret_cast<char const*>(p), len);
+            p += len;
+            f(static_cast<std::string const&>(name), m_lens.access(i));
+        }
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visitor.visit(m_magic);
+        visitor.visit(m_version);
+        if (m_magic != magic or m_version != version) {
+            spdlog::critical(
+                "the reference info (.refinfo) of this index is not in the current format "
+                "(version {}); it was built by an older version, and must be rebuilt.",
+                version);
+            throw std::runtime_error("unsupported .refinfo format");
+        }
+        visitor.visit(m_names);
+        visitor.visit(m_bucket_offsets);
+        visitor.visit(m_lens);
+    }
+
+private:
+    uint64_t m_magic{magic};
+    uint64_t m_version{version};
+    std::vector<uint8_t> m_names;
+    sshash::ef_sequence<false> m_bucket_offsets;
+    pthash::compact_vector m_lens;
+
+    void write_varint(uint64_t x) {
+        while (x >= 128) {
+            m_names.push_back(static_cast<uint8_t>((x & 127) | 128));
+            x >>= 7;
+        }
+        m_names.push_back(static_cast<uint8_t>(x));
+    }
+
+    static uint64_t read_varint(uint8_t const*& p) {
+        uint64_t x = 0;
+        for (uint64_t shift = 0;; shift += 7) {
+            uint8_t b = *p++;
+            x |= static_cast<uint64_t>(b & 127) << shift;
+            if (b < 128) return x;
+        }
+    }
+};
+
+}  // namespace sshash
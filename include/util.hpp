@@ -97,7 +97,8 @@ struct build_configuration {
         , weighted(false)
         , verbose(true)
         , num_threads(1)
-        , tmp_dirname(constants::default_tmp_dirname) {}
+        , tmp_dirname(constants::default_tmp_dirname)
+        , resume(false) {}
 
     uint64_t k;  // kmer size
     uint64_t m;  // minimizer size
@@ -112,6 +113,7 @@ struct build_configuration {
     
     uint64_t num_threads; // number of threads to use during construction
     std::string tmp_dirname;
+    bool resume;  // checkpoint each build step and resume from the last one finished
 
     void print() const {
         std::cout << "k = " << k << ", m = " << m << ", seed = " << seed << ", l = " << l
@@ -125,7 +127,8 @@ struct buckets_statistics {
     static const uint64_t max_bucket_size = 4 * 1024;
     static const uint64_t max_string_size = 256;
 
-    buckets_statistics(uint64_t num_buckets, uint64_t num_kmers, uint64_t num_super_kmers = 0)
+    buckets_statistics(uint64_t num_buckets = 0, uint64_t num_kmers = 0,
+                       uint64_t num_super_kmers = 0)
         : m_num_buckets(num_buckets)
         , m_num_kmers(num_kmers)
         // , m_num_super_kmers(num_super_kmers)
@@ -162,6 +165,17 @@ struct buckets_statistics {
     uint64_t num_buckets() const { return m_num_buckets; }
     uint64_t max_num_super_kmers_in_bucket() const { return m_max_num_super_kmers_in_bucket; }
 
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visitor.visit(m_num_buckets);
+        visitor.visit(m_num_kmers);
+        visitor.visit(m_max_num_kmers_in_super_kmer);
+        visitor.visit(m_max_num_super_kmers_in_bucket);
+        visitor.visit(m_bucket_sizes);
+        visitor.visit(m_total_kmers);
+        visitor.visit(m_string_sizes);
+    }
+
     void print() const {
         // full statistics
         // std::cout << " === bucket statistics === \n";
@@ -272,16 +286,6 @@ struct ec_span {
     inline size_t size() const { return len; }
 };
 
-// the amount we have to shift right
-// to get just the reference on which
-// the hit occurs
-static uint64_t _ref_shift;
-
-// once we shift 1 bit (to get rid of position)
-// the maks we have to apply to remove the 
-// upper reference bits
-static uint64_t _pos_mask;
-
 constexpr uint64_t pos_masks[] = {
 0x0, 0x1, 0x3, 0x7, 0xf, 0x1f, 0x3f, 0x7f, 0xff, 0x1ff, 0x3ff,
 0x7ff, 0xfff, 0x1fff, 0x3fff, 0x7fff, 0xffff, 0x1ffff, 0x3ffff,
@@ -297,24 +301,90 @@ constexpr uint64_t pos_masks[] = {
 0xfffffffffffffff, 0x1fffffffffffffff, 0x3fffffffffffffff,
 0x7fffffffffffffff};
 
-inline uint32_t transcript_id(uint64_t e) { 
-    return static_cast<uint32_t>((e >> _ref_shift));
-}
-inline uint32_t pos(uint64_t e) { 
-    return static_cast<uint32_t>((e >> 1) & _pos_mask); 
-}
-inline bool orientation(uint64_t e) { return (e & 0x1); }
-
-inline uint64_t encode_contig_entry(uint64_t refctr, uint64_t current_offset, bool is_fw) {
-    // e starts out with the reference index
-    uint64_t e = refctr;
-    // we shift this left by _ref_shift (which is pos_bits + 1)
-    e <<= _ref_shift;
-    // shift the current offset left by 1 and add it to the representation
-    e |= (current_offset << 1);
-    // set the orientation bit
-    e |= is_fw ? 1 : 0;
-    return e;
+/*
+    A contig table entry packs the reference on which a contig occurs, the position of
+    the contig on that reference (using `ref_len_bits` bits), and its orientation
+    (lowest bit, 1 = forward). The number of position bits depends on the longest
+    reference of the index, so it belongs to the contig table that holds the entries,
+    and indexes with different widths can be used side by side.
+*/
+struct contig_entry_codec {
+    contig_entry_codec() = default;
+    explicit contig_entry_codec(uint64_t ref_len_bits)
+        : ref_shift(ref_len_bits + 1), pos_mask(pos_masks[ref_len_bits]) {}
+
+    inline uint32_t transcript_id(uint64_t e) const {
+        return static_cast<uint32_t>(e >> ref_shift);
+    }
+    inline uint32_t pos(uint64_t e) const { return static_cast<uint32_t>((e >> 1) & pos_mask); }
+    static inline bool orientation(uint64_t e) { return (e & 0x1); }
+    inline uint64_t ref_len_bits() const { return ref_shift - 1; }
+
+    inline uint64_t encode(uint64_t refctr, uint64_t current_offset, bool is_fw) const {
+        // e starts out with the reference index
+        uint64_t e = refctr;
+        // we shift this left by ref_shift (which is pos_bits + 1)
+        e <<= ref_shift;
+        // shift the current offset left by 1 and add it to the representation
+        e |= (current_offset << 1);
+        // set the orientation bit
+        e |= is_fw ? 1 : 0;
+        return e;
+    }
+
+    // the amount we have to shift right
+    // to get just the reference on which
+    // the hit occurs
+    uint64_t ref_shift{1};
+
+    // once we shift 1 bit (to get rid of the orientation)
+    // the mask we have to apply to remove the
+    // upper reference bits
+    uint64_t pos_mask{0};
+};
+
+/*
+    The same layout, for code specialized on a number of position bits known at
+    compile time: the shift and the mask become immediates.
+*/
+template <uint64_t RefLenBits>
+struct fixed_contig_entry_codec {
+    static_assert(RefLenBits < 64, "too many position bits");
+    static constexpr uint64_t ref_shift = RefLenBits + 1;
+    static constexpr uint64_t pos_mask = pos_masks[RefLenBits];
+
+    static inline uint32_t transcript_id(uint64_t e) {
+        return static_cast<uint32_t>(e >> ref_shift);
+    }
+    static inline uint32_t pos(uint64_t e) { return static_cast<uint32_t>((e >> 1) & pos_mask); }
+    static inline bool orientation(uint64_t e) { return (e & 0x1); }
+    static inline uint64_t encode(uint64_t refctr, uint64_t current_offset, bool is_fw) {
+        return (refctr << ref_shift) | (current_offset << 1) | (is_fw ? 1 : 0);
+    }
+};
+
+/*
+    Calls `f` with the codec to use for decoding many entries laid out as by `codec`:
+    a fixed_contig_entry_codec if its number of position bits is a common one (that of
+    a transcriptome, or of a genome), and `codec` itself otherwise. `f` is instantiated
+    once per width, so it should be just the decoding loop.
+*/
+template <typename F>
+inline void with_contig_entry_codec(contig_entry_codec const& codec, F&& f) {
+    switch (codec.ref_len_bits()) {
+        case 16: f(fixed_contig_entry_codec<16>()); break;
+        case 17: f(fixed_contig_entry_codec<17>()); break;
+        case 18: f(fixed_contig_entry_codec<18>()); break;
+        case 19: f(fixed_contig_entry_codec<19>()); break;
+        case 20: f(fixed_contig_entry_codec<20>()); break;
+        case 27: f(fixed_contig_entry_codec<27>()); break;
+        case 28: f(fixed_contig_entry_codec<28>()); break;
+        case 29: f(fixed_contig_entry_codec<29>()); break;
+        case 30: f(fixed_contig_entry_codec<30>()); break;
+        case 31: f(fixed_contig_entry_codec<31>()); break;
+        case 32: f(fixed_contig_entry_codec<32>()); break;
+        default: f(codec);
+    }
 }
 
 // For the time being, assume < 4B contigs
@@ -4,6 +4,7 @@
 
 #include "../external/pthash/external/cmd_line_parser/include/parser.hpp"
 #include "../include/dictionary.hpp"
+#include "../include/ghc/filesystem.hpp"
 #include "../include/spdlog/spdlog.h"
 #include "../include/spdlog/sinks/stdout_color_sinks.h"
 #include "bench_utils.hpp"
@@ -23,6 +24,142 @@ extern "C" {
 #endif
 
 
+// Builds the dictionary and the contig table (and optionally the
+// equivalence class table) for the cuttlefish files with basename
+// `input_files_basename`. If `delta_of` is not empty, the index is built
+// as a delta of the index with that basename: its references are numbered
+// after those of that (base) index. Returns 0 on success.
+//
+// If `build_config.resume` is set, every build step is checkpointed in the
+// tmp directory, and a build that was interrupted is resumed from the last
+// step it finished (provided the inputs and the configuration are unchanged).
+//
+// The time, memory and I/O used by each build step, along with the key sizes
+// of what it built, are written to `output_filename`.build_info.json.
+int build_reference_index(const std::string& input_files_basename,
+                          build_configuration const& build_config,
+                          const std::string& output_filename, bool build_ec_table, bool check,
+                          bool bench, const std::string& delta_of) {
+    uint64_t k = build_config.k;
+
+    // The contig table is built from the same single read of the input files
+    // as the dictionary: the segments collected by the dictionary parser are
+    // handed over to the contig table builder, whose (text) pass over the
+    // tilings then runs concurrently with the rest of the dictionary build.
+    build_profile profile;
+    contig_table_builder ctb(input_files_basename, k, output_filename, build_config.tmp_dirname);
+    ctb.set_profile(&profile);
+
+    std::unique_ptr<build_checkpoint> checkpoint;
+    if (build_config.resume) {
+        // the checkpoints of a build are found through its inputs and output
+        std::string run = input_files_basename + '\0' + output_filename;
+        std::stringstream name;
+        name << std::hex << pthash::MurmurHash2_64(run.data(), run.size(), 0);
+        checkpoint = std::make_unique<build_checkpoint>(build_config.tmp_dirname, name.str());
+
+        nlohmann::json fingerprint;
+        fingerprint["k"] = build_config.k;
+        fingerprint["m"] = build_config.m;
+        fingerprint["seed"] = build_config.seed;
+        fingerprint["l"] = build_config.l;
+        fingerprint["c"] = build_config.c;
+        fingerprint["canonical_parsing"] = build_config.canonical_parsing;
+        fingerprint["weighted"] = build_config.weighted;
+        fingerprint["build_ec_table"] = build_ec_table;
+        fingerprint["delta_of"] = delta_of;
+        fingerprint["output_filename"] = output_filename;
+        for (auto suffix : {".cf_seg", ".cf_seq", ".json"}) {
+            fingerprint["inputs"][suffix] = file_signature(input_files_basename + suffix);
+        }
+        checkpoint->open(fingerprint);
+        ctb.set_checkpoint(checkpoint.get());
+    }
+    if (!delta_of.empty()) {
+        // the delta encodes reference positions as the base does,
+        // and its reference ids follow those of the base.
+        basic_contig_table base_bct;
+        essentials::load(base_bct, (delta_of + ".ctab").c_str());
+        reference_info base_ref_info;
+        essentials::load(base_ref_info, (delta_of + ".refinfo").c_str());
+        spdlog::info("building a delta of {} (which has {} references).", delta_of,
+                     base_ref_info.size());
+        ctb.set_base_index(base_ref_info.size(), base_bct.m_ref_len_bits);
+    }
+
+    std::thread tiling_thread;
+    bool tilings_ok = false;
+    // join the pass over the tilings even if the dictionary build throws;
+    // destroying a joinable std::thread would terminate with the real error lost
+    struct thread_joiner {
+        std::thread& t;
+        ~thread_joiner() {
+            if (t.joinable()) { t.join(); }
+        }
+    } tiling_joiner{tiling_thread};
+    {
+        // make this scope here and put dict inside of it to
+        // ensure it goes out of scope before we build the
+        // contig table
+        auto input_seq = input_files_basename + ".cf_seg";
+        dictionary dict;
+        dict.build(input_seq, build_config,
+                   [&](std::vector<uint64_t>&& ids, std::vector<uint32_t>&& lengths) {
+                       ctb.set_segments(std::move(ids), std::move(lengths));
+                       tiling_thread = std::thread([&]() { tilings_ok = ctb.scan_tilings(); });
+                   },
+                   checkpoint.get(), &profile);
+        assert(dict.k() == k);
+        auto output_seqidx = output_filename + ".sshash";
+        spdlog::info("saving data structure to disk...");
+        {
+            build_profile::step save_step(&profile, "save_dictionary");
+            essentials::save(dict, output_seqidx.c_str());
+            save_step.set("num_kmers", dict.size());
+            save_step.set("num_bits", dict.num_bits());
+        }
+        spdlog::info("DONE");
+
+        if (check) {
+            check_correctness_lookup_access(dict, input_seq);
+            if (build_config.weighted) check_correctness_weights(dict, input_seq);
+            check_correctness_iterator(dict);
+        }
+        if (bench) {
+            perf_test_lookup_access(dict);
+            if (dict.weighted()) perf_test_lookup_weight(dict);
+            perf_test_iterator(dict);
+        }
+    }
+    if (tiling_thread.joinable()) { tiling_thread.join(); }
+
+    // now build the contig table
+    if (!tilings_ok or !ctb.build(build_ec_table, build_config.num_threads)) {
+        spdlog::critical("failed to build contig table.");
+        return 1;
+    }
+    if (checkpoint) { checkpoint->remove(); }
+
+    nlohmann::json build_info;
+    build_info["input_files_basename"] = input_files_basename;
+    build_info["output_filename"] = output_filename;
+    build_info["k"] = build_config.k;
+    build_info["m"] = build_config.m;
+    build_info["seed"] = build_config.seed;
+    build_info["l"] = build_config.l;
+    build_info["c"] = build_config.c;
+    build_info["canonical_parsing"] = build_config.canonical_parsing;
+    build_info["build_ec_table"] = build_ec_table;
+    build_info["delta_of"] = delta_of;
+    build_info["num_threads"] = build_config.num_threads;
+    build_info["resume"] = build_config.resume;
+    std::string build_info_filename = output_filename + ".build_info.json";
+    if (!profile.save(build_info_filename, build_info)) {
+        spdlog::warn("failed to write {}", build_info_filename);
+    }
+    return 0;
+}
+
 int run_build(int argc, char** argv) {
     constexpr uint32_t min_threads = 1;
     constexpr uint32_t target_threads = 16;
@@ -61,7 +198,7 @@ int run_build(int argc, char** argv) {
         "-d", false);
     parser.add(
         "num_threads",
-        "Number of threads to use for hash construction (much of the other index building is currently single-threaded, default is " +
+        "Number of threads to use for hash and equivalence class table construction (much of the other index building is currently single-threaded, default is " +
           std::to_string(default_num_threads) + ")",
         "-t", false
         );
@@ -71,6 +208,17 @@ int run_build(int argc, char** argv) {
                "--canonical-parsing", true);
     parser.add("build_ec_table", "build orientation-aware equivalence class table an include it in the index.", 
                "--build-ec-table", true);
+    parser.add("delta_of",
+               "Build a delta for the index with the given basename, holding only the references "
+               "of the input files. The delta is written to '<basename>.delta', is queried along "
+               "with the base index, and can later be folded into it with `merge`. An index has "
+               "at most one delta.",
+               "--delta-of", false);
+    parser.add("resume",
+               "Checkpoint every build step in the tmp directory (see -d) and, if a previous "
+               "build of the same inputs and output with --resume was interrupted, resume it "
+               "from the last step it finished.",
+               "--resume", true);
     parser.add("weighted", "Also store the weights in compressed format.", "--weighted", true);
     parser.add("check", "Check correctness after construction.", "--check", true);
     parser.add("bench", "Run benchmark after construction.", "--bench", true);
@@ -124,48 +272,41 @@ int run_build(int argc, char** argv) {
     build_config.canonical_parsing = parser.get<bool>("canonical_parsing");
     build_config.weighted = parser.get<bool>("weighted");
     build_config.verbose = parser.get<bool>("verbose");
+    build_config.resume = parser.get<bool>("resume");
     if (parser.parsed("tmp_dirname")) {
         build_config.tmp_dirname = parser.get<std::string>("tmp_dirname");
         essentials::create_directory(build_config.tmp_dirname);
     }
     //if (!quiet) { build_config.print(); }
 
-    if (!parser.parsed("output_filename")) {
-        spdlog::critical("output filename is required but missing!\n");
-        return 1;
-    }
-    auto output_filename = parser.get<std::string>("output_filename");
-
-    {
-        // make this scope here and put dict inside of it to
-        // ensure it goes out of scope before we build the
-        // contig table
-        auto input_seq = input_files_basename + ".cf_seg";
-        dictionary dict;
-        dict.build(input_seq, build_config);
-        assert(dict.k() == k);
-        auto output_seqidx = output_filename + ".sshash";
-        spdlog::info("saving data structure to disk...");
-        essentials::save(dict, output_seqidx.c_str());
-        spdlog::info("DONE");
+    bool build_ec_table = parser.get<bool>("build_ec_table");
+    bool check = parser.get<bool>("check");
+    bool bench = parser.get<bool>("bench");
 
-        bool check = parser.get<bool>("check");
-        if (check) {
-            check_correctness_lookup_access(dict, input_seq);
-            if (build_config.weighted) check_correctness_weights(dict, input_seq);
-            check_correctness_iterator(dict);
+    std::string delta_of;
+    std::string output_filename;
+    if (parser.parsed("delta_of")) {
+        delta_of = parser.get<std::string>("delta_of");
+        output_filename = delta_of + ".delta";
+        if (parser.parsed("output_filename")) {
+            spdlog::warn("building a delta; the output will be written to {}", output_filename);
         }
-        bool bench = parser.get<bool>("bench");
-        if (bench) {
-            perf_test_lookup_access(dict);
-            if (dict.weighted()) perf_test_lookup_weight(dict);
-            perf_test_iterator(dict);
+        // an index has at most one delta; its contig table is the last file written
+        if (ghc::filesystem::exists(output_filename + ".ctab")) {
+            spdlog::critical("{} already has a delta ({}); merge it into the index with `merge` "
+                             "before building another one.",
+                             delta_of, output_filename);
+            return 1;
         }
+    } else if (!parser.parsed("output_filename")) {
+        spdlog::critical("output filename is required but missing!\n");
+        return 1;
+    } else {
+        output_filename = parser.get<std::string>("output_filename");
     }
-    
-    // now build the contig table
-    bool build_ec_table = parser.get<bool>("build_ec_table");
-    bool ctab_ok = build_contig_table_main(input_files_basename, k, build_ec_table, output_filename);
+
+    int ctab_ok = build_reference_index(input_files_basename, build_config, output_filename,
+                                        build_ec_table, check, bench, delta_of);
     spdlog::drop_all();
     return ctab_ok;
 }
@@ -1,17 +1,20 @@
 #include <iostream>
 #include <vector>
+#include <sstream>
+#include <cstdio>
+#include <algorithm>
+#include <mutex>
+#include <thread>
 #include "../include/basic_contig_table.hpp"
 #include "../external/pthash/external/essentials/include/essentials.hpp"
 #include "../include/ef_sequence.hpp"
 #include "../include/equivalence_class_map.hpp"
+#include "../include/reference_info.hpp"
 #include "../external/pthash/external/cmd_line_parser/include/parser.hpp"
 #include "../include/util.hpp"
+#include "../include/builder/checkpoint.hpp"
+#include "../include/builder/build_profile.hpp"
 #include "../include/parallel_hashmap/phmap.h"
-#include "../include/bitsery/bitsery.h"
-#include "../include/bitsery/brief_syntax.h"
-#include "../include/bitsery/adapter/stream.h"
-#include "../include/bitsery/brief_syntax/vector.h"
-#include "../include/bitsery/brief_syntax/string.h"
 #include "../include/spdlog/spdlog.h"
 #include "../include/json.hpp"
 #include "../external/pthash/include/utils/hasher.hpp"
@@ -19,79 +22,398 @@
 using namespace sshash;
 using phmap::flat_hash_map;
 
-struct rank_count {
-    uint64_t rank;
-    uint32_t len;
-    uint64_t count;
+enum class dir_status : uint8_t {
+  FW=0, RC=1, BOTH=2
 };
 
-struct rank_offset {
-  uint32_t rank;
-  uint64_t offset;
+
+// 128-bit fingerprint of an equivalence class label. Labels are interned
+// by their fingerprint so that the labels themselves never have to be kept
+// in memory while the table is being built.
+struct label_fingerprint {
+  uint64_t h1;
+  uint64_t h2;
+  bool operator==(const label_fingerprint& o) const { return (h1 == o.h1) and (h2 == o.h2); }
 };
 
-enum class dir_status : uint8_t {
-  FW=0, RC=1, BOTH=2
+struct label_fingerprint_hasher {
+  // h1 is already a well-mixed hash of the label
+  std::size_t operator()(const label_fingerprint& f) const { return static_cast<std::size_t>(f.h1); }
+};
+
+struct ec_info {
+  uint64_t first_tile; // smallest tile index having this label
+  uint64_t offset;     // start of this label in the concatenated label list
+  uint32_t rank;       // the ec id, assigned in order of first_tile
+  uint32_t len;        // number of entries in this label
 };
 
+using ec_id_map_t = phmap::parallel_flat_hash_map<
+    label_fingerprint, ec_info, label_fingerprint_hasher, std::equal_to<label_fingerprint>,
+    std::allocator<std::pair<const label_fingerprint, ec_info>>, 6, std::mutex>;
+
+// Fill `label` with the sorted, packed (tid << 2 | dir) entries of the
+// equivalence class label of tile `tile_idx`, and return its fingerprint.
+static label_fingerprint compute_tile_label(basic_contig_table& bct, uint64_t tile_idx,
+                                            std::vector<uint64_t>& label,
+                                            uint64_t& largest_tid) {
+  label.clear();
+  uint32_t prev_tid = 0;
+  dir_status prev_dir = dir_status::FW;
+  bool first = true;
+  const auto codec = bct.codec();
+  sshash::util::contig_span ctg_entry_span = bct.contig_entries(tile_idx);
+  for (auto ce : ctg_entry_span) {
+    uint32_t tid = codec.transcript_id(ce);
+    dir_status dir = codec.orientation(ce) ? dir_status::FW : dir_status::RC;
+    largest_tid = std::max(static_cast<uint64_t>(tid), largest_tid);
+
+    // skip adjacent duplicates (we can still get dups because of orientation
+    // switching), but if duplicate target / ori pairs are adjacent, don't
+    // add them to avoid the vector growing unnecessarily.
+    if (first or tid != prev_tid) {
+      label.push_back((static_cast<uint64_t>(tid) << 2) | static_cast<uint64_t>(dir));
+    } else if (tid == prev_tid and dir != prev_dir) {
+      // if dir != prev_dir, then
+      // dir == FW and prev_dir == RC
+      // or dir == RC and prev_dir == FW
+      // or prev_dir == BOTH and dir == FW | RC
+      // in any such case, the right thing to do is
+      // to set (or keep) the dir as BOTH.
+      label.back() = (label.back() & ~uint64_t(0x3)) | static_cast<uint64_t>(dir_status::BOTH);
+    }
 
-namespace std {
+    prev_tid = tid;
+    prev_dir = dir;
+    first = false;
+  }
+  // remove any duplicate entries --- shouldn't be any!
+  // the packed entries sort by target id first and then by orientation.
+  std::sort(label.begin(), label.end());
+  auto last_valid_it = std::unique(label.begin(), label.end());
+  if (last_valid_it != label.end()) {
+    spdlog::warn("sort | unique should not be necessary on ec label!");
+    label.erase(last_valid_it, label.end());
+  }
+
+  const void* data = reinterpret_cast<const void*>(label.data());
+  uint64_t len = label.size() * sizeof(uint64_t);
+  return {pthash::MurmurHash2_64(data, len, 0),
+          pthash::MurmurHash2_64(data, len, 0x9e3779b97f4a7c15ULL)};
+}
 
-  template <>
-  struct hash<std::vector<std::tuple<uint32_t, dir_status>>>
+// Build the orientation-aware equivalence class table for the `num_tiles`
+// tiles of `bct` using `num_threads` threads, and write it to
+// `output_filename`.ectab.
+//
+// The tiles are split into contiguous ranges, one per thread. In a first
+// parallel pass, each label is interned in a sharded map (keyed by its
+// fingerprint) that records the first tile on which it occurs. Equivalence
+// class ids are then assigned in order of first occurrence, which makes the
+// table independent of thread scheduling. In a second parallel pass each
+// tile is assigned its ec id, and the tile on which a label first occurs
+// writes that label directly into the packed label vector.
+static bool build_equivalence_class_table(basic_contig_table& bct, uint64_t num_tiles,
+                                          uint32_t num_threads,
+                                          const std::string& output_filename,
+                                          build_profile* profile = nullptr) {
+  build_profile::step ec_step(profile, "ectab");
+  num_threads = std::max(num_threads, uint32_t(1));
+  // make every range a multiple of 64 tiles so that no two threads ever
+  // write to the same word of the (packed) tile -> ec id vector.
+  uint64_t range_size = (num_tiles + num_threads - 1) / num_threads;
+  range_size = std::max(uint64_t(64), (range_size + 63) & ~uint64_t(63));
+  std::vector<std::pair<uint64_t, uint64_t>> tile_ranges;
+  for (uint64_t b = 0; b < num_tiles; b += range_size) {
+    tile_ranges.push_back({b, std::min(b + range_size, num_tiles)});
+  }
+
+  ec_id_map_t ec_id_map;
+  std::vector<uint64_t> largest_tids(tile_ranges.size(), 0);
+
+  spdlog::info("interning equivalence class labels using {} thread(s).", tile_ranges.size());
   {
-    std::size_t operator()(const std::vector<std::tuple<uint32_t, dir_status>>& k) const
-    {
-       const void* data = reinterpret_cast<const void*>(&k[0]);
-       uint64_t len = k.size() * sizeof(std::tuple<uint32_t, dir_status>);
-       return pthash::MurmurHash2_64(data, len, 0);
+    build_profile::step intern_step(profile, "ectab/intern_labels");
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < tile_ranges.size(); ++t) {
+      workers.emplace_back([&, t]() {
+        std::vector<uint64_t> label;
+        uint64_t largest_tid = 0;
+        for (uint64_t tile_idx = tile_ranges[t].first; tile_idx < tile_ranges[t].second;
+             ++tile_idx) {
+          auto fp = compute_tile_label(bct, tile_idx, label, largest_tid);
+          ec_id_map.try_emplace_l(
+              fp,
+              [tile_idx](ec_id_map_t::value_type& v) {
+                v.second.first_tile = std::min(v.second.first_tile, tile_idx);
+              },
+              ec_info{tile_idx, 0, 0, static_cast<uint32_t>(label.size())});
+        }
+        largest_tids[t] = largest_tid;
+      });
     }
-  };
-
+    for (auto& w : workers) { w.join(); }
+  }
+
+  uint64_t num_ecs = ec_id_map.size();
+  uint64_t largest_tid = 0;
+  for (auto l : largest_tids) { largest_tid = std::max(largest_tid, l); }
+  spdlog::info("found {} distinct equivalence classes over {} tiles.", num_ecs, num_tiles);
+
+  equivalence_class_map ect;
+
+  // assign ec ids in order of first occurrence and lay out the labels in
+  // that order. No insertions happen from here on, so pointers into the
+  // map remain valid.
+  std::vector<ec_info*> ecs_by_first_tile;
+  ecs_by_first_tile.reserve(num_ecs);
+  for (auto& kv : ec_id_map) { ecs_by_first_tile.push_back(&kv.second); }
+  std::sort(ecs_by_first_tile.begin(), ecs_by_first_tile.end(),
+            [](const ec_info* a, const ec_info* b) { return a->first_tile < b->first_tile; });
+
+  // will hold the starting position in the globally concatenated
+  // list, for the sublist corresponding to each equivalence class
+  std::vector<uint64_t> label_list_offsets;
+  label_list_offsets.reserve(num_ecs + 1);
+  uint64_t total_label_length = 0;
+  for (size_t i = 0; i < ecs_by_first_tile.size(); ++i) {
+    ec_info* e = ecs_by_first_tile[i];
+    e->rank = static_cast<uint32_t>(i);
+    e->offset = total_label_length;
+    label_list_offsets.push_back(total_label_length);
+    total_label_length += e->len;
+  }
+  // last label list ending position
+  label_list_offsets.push_back(total_label_length);
+
+  // since the labels are laid out in order of the first tile on which they
+  // occur, the labels written by each thread occupy a contiguous interval
+  // of the label vector.
+  std::vector<std::pair<uint64_t, uint64_t>> label_ranges;
+  for (auto& r : tile_ranges) {
+    auto rank_at = [&ecs_by_first_tile](uint64_t tile) {
+      return std::lower_bound(ecs_by_first_tile.begin(), ecs_by_first_tile.end(), tile,
+                              [](const ec_info* e, uint64_t t) { return e->first_tile < t; }) -
+             ecs_by_first_tile.begin();
+    };
+    label_ranges.push_back(
+        {label_list_offsets[rank_at(r.first)], label_list_offsets[rank_at(r.second)]});
+  }
+  ecs_by_first_tile.clear();
+  ecs_by_first_tile.shrink_to_fit();
+
+  uint64_t tile_id_width = std::ceil(std::log2(num_ecs + 1));
+  pthash::compact_vector::builder ec_id_builder(num_tiles, tile_id_width);
+  // the +2 is for the orientation bits;
+  uint64_t label_width = std::ceil(std::log2(largest_tid + 1)) + 2;
+  pthash::compact_vector::builder label_builder(total_label_length, label_width);
+
+  // writes of label entries that share a word with the interval of another
+  // thread are deferred and applied once all threads are done.
+  std::vector<std::vector<std::pair<uint64_t, uint64_t>>> deferred(tile_ranges.size());
+
+  spdlog::info("writing equivalence class table.");
+  {
+    build_profile::step write_step(profile, "ectab/write_labels");
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < tile_ranges.size(); ++t) {
+      workers.emplace_back([&, t]() {
+        std::vector<uint64_t> label;
+        uint64_t unused_largest_tid = 0;
+        const uint64_t first_word = (label_ranges[t].first * label_width) / 64;
+        const bool first_word_shared = ((label_ranges[t].first * label_width) % 64) != 0;
+        const uint64_t last_word = (label_ranges[t].second * label_width + 63) / 64 - 1;
+        const bool last_word_shared = ((label_ranges[t].second * label_width) % 64) != 0;
+        auto& my_deferred = deferred[t];
+
+        for (uint64_t tile_idx = tile_ranges[t].first; tile_idx < tile_ranges[t].second;
+             ++tile_idx) {
+          auto fp = compute_tile_label(bct, tile_idx, label, unused_largest_tid);
+          ec_info info{0, 0, 0, 0};
+          ec_id_map.if_contains(fp, [&info](const ec_id_map_t::value_type& v) { info = v.second; });
+          ec_id_builder.set(tile_idx, info.rank);
+          // only the first tile with this label writes it
+          if (info.first_tile != tile_idx) { continue; }
+          for (uint64_t i = 0; i < label.size(); ++i) {
+            uint64_t pos = info.offset + i;
+            uint64_t w0 = (pos * label_width) / 64;
+            uint64_t w1 = (pos * label_width + label_width - 1) / 64;
+            if ((first_word_shared and w0 == first_word) or
+                (last_word_shared and w1 == last_word)) {
+              my_deferred.push_back({pos, label[i]});
+            } else {
+              label_builder.set(pos, label[i]);
+            }
+          }
+        }
+      });
+    }
+    for (auto& w : workers) { w.join(); }
+  }
+  for (auto& d : deferred) {
+    for (auto& pv : d) { label_builder.set(pv.first, pv.second); }
+  }
+
+  // since the offset vector is a monotonic sequence
+  // it is amenable to Elias-Fano compression, so compress it
+  // as such and write it.
+  ect.m_label_list_offsets.encode(label_list_offsets.begin(), label_list_offsets.size(),
+                                  label_list_offsets.back());
+  ec_id_builder.build(ect.m_tile_ec_ids);
+  label_builder.build(ect.m_label_entries);
+
+  std::string out_ectab = output_filename + ".ectab";
+  essentials::save(ect, out_ectab.c_str());
+  ec_step.set("num_threads", tile_ranges.size());
+  ec_step.set("num_ecs", num_ecs);
+  ec_step.set("num_label_entries", total_label_length);
+  return true;
 }
 
-bool build_contig_table(const std::string& input_filename, uint64_t k,
-                        bool build_eq_table,
-                        const std::string& output_filename) {
-    flat_hash_map<uint64_t, rank_count> id_to_rank;
-    const std::string refstr = "Reference";
-    const auto hlen = refstr.length();
+// Builds the contig table (and, optionally, the equivalence class table)
+// while reading each cuttlefish file only once:
+//
+//  - the segments (identifier and length, in .cf_seg order) are either
+//    handed over by the dictionary parser via `set_segments`, or read
+//    directly with `read_segments`;
+//  - `scan_tilings` tokenizes the .cf_seq file a single time. It counts
+//    the occurrences of each segment, collects the reference names and
+//    lengths (written to the .refinfo file), and records every tiling
+//    entry in a compact binary intermediate file in the tmp directory;
+//  - `build` fills the contig table by replaying the intermediate file
+//    rather than re-tokenizing the .cf_seq file.
+class contig_table_builder {
+public:
+    contig_table_builder(const std::string& input_filename, uint64_t k,
+                         const std::string& output_filename, const std::string& tmp_dirname)
+        : m_input_filename(input_filename)
+        , m_output_filename(output_filename)
+        , m_k(k)
+        , m_max_ref_len(0)
+        , m_num_refs(0) {
+        std::stringstream filename;
+        filename << tmp_dirname << "/sshash.tmp.run_"
+                 << pthash::clock_type::now().time_since_epoch().count() << ".tilings.bin";
+        m_tilings_filename = filename.str();
+    }
 
-    // where we will write the reference info
-    std::string out_refinfo = output_filename + ".refinfo";
-    std::fstream s{out_refinfo.c_str(), s.binary | s.trunc | s.out};
-    bitsery::Serializer<bitsery::OutputBufferedStreamAdapter> ser{s};
+    void set_segments(std::vector<uint64_t>&& ids, std::vector<uint32_t>&& lengths) {
+        m_segment_ids = std::move(ids);
+        m_segment_lengths = std::move(lengths);
+    }
 
-    std::vector<uint64_t> segment_order;
-    {
-        // First, we will pass over the segment file to collect the
-        // identifier and length of each segment.
-        std::ifstream seg_file(input_filename + ".cf_seg");
-        uint64_t idx = 0;
+    // Pass over the segment file to collect the identifier and length
+    // of each segment.
+    void read_segments() {
+        std::ifstream seg_file(m_input_filename + ".cf_seg");
         while (!seg_file.eof()) {
             uint64_t seg_id;
-            uint32_t seg_len;
             std::string seg;
             while (seg_file >> seg_id >> seg) {
-                segment_order.push_back(seg_id);
-                seg_len = seg.length();
-                id_to_rank[seg_id] = {idx, seg_len, 0};
-                ++idx;
+                m_segment_ids.push_back(seg_id);
+                m_segment_lengths.push_back(seg.length());
             }
         }
-        spdlog::info("computed all segment lengts");
+        spdlog::info("computed all segment lengths");
     }
 
-    size_t num_refs = 0;
+    // Number the references of the input after the `num_base_refs` references
+    // of an existing (base) index, whose contig table encodes reference positions
+    // with `base_ref_len_bits` bits. Used to build a delta of that index.
+    void set_base_index(uint64_t num_base_refs, uint64_t base_ref_len_bits) {
+        m_first_ref_id = num_base_refs;
+        m_base_ref_len_bits = base_ref_len_bits;
+    }
+
+    // Record the time, memory and I/O of each build step in `profile`.
+    void set_profile(build_profile* profile) { m_profile = profile; }
+
+    // Checkpoint the pass over the tilings and the tables in `checkpoint`,
+    // and skip what it has already recorded.
+    void set_checkpoint(build_checkpoint* checkpoint) {
+        m_checkpoint = checkpoint;
+        // the intermediate file must outlive this run
+        m_tilings_filename = checkpoint->filename("tilings");
+    }
+
+    bool scan_tilings();
+    bool build(bool build_eq_table, uint32_t num_threads);
+
+private:
+    // Each entry of the intermediate file is a single 64-bit word, whose
+    // lowest 2 bits are a tag and whose remaining bits are the payload.
+    enum tiling_tag : uint64_t {
+        TILE_FW = 0,    // payload is the segment rank
+        TILE_RC = 1,    // payload is the segment rank
+        N_RUN = 2,      // payload is the number of 'N's
+        NEW_REF = 3     // no payload
+    };
+    static constexpr uint64_t tiling_buffer_size = 1ULL << 20;
+
+    std::string m_input_filename;
+    std::string m_output_filename;
+    std::string m_tilings_filename;
+    uint64_t m_k;
+    uint64_t m_max_ref_len;
+    uint64_t m_num_refs;
+    uint64_t m_first_ref_id{0};
+    uint64_t m_base_ref_len_bits{0};
+    build_checkpoint* m_checkpoint{nullptr};
+    build_profile* m_profile{nullptr};
+
+    // indexed by segment rank (the order of appearance in the .cf_seg file)
+    std::vector<uint64_t> m_segment_ids;
+    std::vector<uint32_t> m_segment_lengths;
+    std::vector<uint64_t> m_segment_counts;
+};
+
+bool contig_table_builder::scan_tilings() {
+    // runs concurrently with the construction of the dictionary
+    build_profile::step scan_step(m_profile, "scan_tilings", true);
+    scan_step.set("restored", m_checkpoint and m_checkpoint->done("scan_tilings"));
+    if (m_checkpoint and m_checkpoint->done("scan_tilings")) {
+        m_checkpoint->load("scan_tilings", m_segment_lengths, m_segment_counts, m_max_ref_len,
+                           m_num_refs);
+        return true;
+    }
+
+    const std::string refstr = "Reference";
+    const auto hlen = refstr.length();
+    const uint64_t k = m_k;
+
+    flat_hash_map<uint64_t, uint64_t> id_to_rank;
+    id_to_rank.reserve(m_segment_ids.size());
+    for (uint64_t rank = 0; rank < m_segment_ids.size(); ++rank) {
+        id_to_rank[m_segment_ids[rank]] = rank;
+    }
+    // the ids are only needed to resolve the tiling entries
+    std::vector<uint64_t>().swap(m_segment_ids);
+    m_segment_counts.assign(m_segment_lengths.size(), 0);
+
+    std::ofstream tilings_out(m_tilings_filename.c_str(), std::ofstream::binary);
+    if (!tilings_out.good()) {
+        spdlog::critical("could not open intermediate file {} for writing.", m_tilings_filename);
+        return false;
+    }
+    std::vector<uint64_t> tilings_buffer;
+    tilings_buffer.reserve(tiling_buffer_size);
+    auto push_tiling = [&](uint64_t payload, tiling_tag tag) {
+        tilings_buffer.push_back((payload << 2) | tag);
+        if (tilings_buffer.size() == tiling_buffer_size) {
+            tilings_out.write(reinterpret_cast<char const*>(tilings_buffer.data()),
+                              tilings_buffer.size() * sizeof(uint64_t));
+            tilings_buffer.clear();
+        }
+    };
+
     size_t max_ref_len = 0;
     {
-        // In the first pass over the cf_seq file we
-        // will assign each segment an ID based on the
-        // order of its first appearance (rank),
-        // will count how many times each segment occurs, and
+        // In the single pass over the cf_seq file we
+        // will count how many times each segment occurs,
         // will compute the lengths of all reference
-        // sequences.
-        std::ifstream ifile(input_filename + ".cf_seq");
+        // sequences, and will record the tiling of each
+        // reference for the construction of the table.
+        std::ifstream ifile(m_input_filename + ".cf_seq");
 
         uint64_t refctr = 0;
         bool first = true;
@@ -125,6 +447,7 @@ bool build_contig_table(const std::string& input_filename, uint64_t k,
 
                     std::string refname = tok.substr(ep);
                     ref_names.push_back(refname);
+                    push_tiling(0, NEW_REF);
 
                     current_offset = 0;
                     first = false;
@@ -132,7 +455,7 @@ bool build_contig_table(const std::string& input_filename, uint64_t k,
                     bool is_n_tile = false;
                     if (!((tok.back() == '-') or (tok.back() == '+'))) {
                         // in this case, the first character must be an 'N'
-                        if ( tok.front() == 'N' ) { 
+                        if ( tok.front() == 'N' ) {
                           is_n_tile = true;
                         } else {
                           spdlog::critical("Unless a tiling entry is an 'N' entry, it must end with '+' or '-'. "
@@ -147,13 +470,15 @@ bool build_contig_table(const std::string& input_filename, uint64_t k,
                       tok.erase(0,1); // remove the actual 'N'
                       uint64_t num_ns = std::stoul(tok, nullptr, 10);
                       // if this was the first tile it needs special handling.
-                      // specifically, we *shouldn't* skip the k-1 overlap we should 
+                      // specifically, we *shouldn't* skip the k-1 overlap we should
                       // just skip the leading 'N's.
                       if (current_offset > 0) {
                         current_offset += (k-1);
                       }
                       current_offset += num_ns;
+                      push_tiling(num_ns, N_RUN);
                     } else {
+                      bool is_fw = (tok.back() == '+');
                       tok.pop_back();
                       uint64_t id = std::stoul(tok, nullptr, 10);
 
@@ -165,9 +490,11 @@ bool build_contig_table(const std::string& input_filename, uint64_t k,
                             id);
                         std::exit(1);
                       } else {
-                        rit->second.count += 1;
+                        uint64_t rank = rit->second;
+                        m_segment_counts[rank] += 1;
+                        push_tiling(rank, is_fw ? TILE_FW : TILE_RC);
                         // then we increment the current offset
-                        current_offset += rit->second.len - (k - 1);
+                        current_offset += m_segment_lengths[rank] - (k - 1);
                       }
                     }
                 }
@@ -188,7 +515,7 @@ bool build_contig_table(const std::string& input_filename, uint64_t k,
         {
             using short_refs_t = std::vector<std::pair<std::string, size_t>>;
             nlohmann::json dbg_info;
-            std::ifstream json_file(input_filename + ".json");
+            std::ifstream json_file(m_input_filename + ".json");
             json_file >> dbg_info;
             if (dbg_info.contains("short refs")) {
                 short_refs_t short_refs_info = dbg_info["short refs"].get<short_refs_t>();
@@ -204,282 +531,201 @@ bool build_contig_table(const std::string& input_filename, uint64_t k,
             spdlog::info("finished processing reference #{} : {}, len : {}", refctr, rn, len);
         }
 
-        num_refs = ref_lens.size();
+        m_num_refs = ref_lens.size();
 
-        {
-            ser(ref_names);
-            // flush to writer
-            ser.adapter().flush();
-            // s.close();
-        }
+        // write the reference info
+        reference_info ref_info;
+        ref_info.build(ref_names, ref_lens);
+        std::string out_refinfo = m_output_filename + ".refinfo";
+        essentials::save(ref_info, out_refinfo.c_str());
+    }
 
-        {
-            // serialize this part of the segment table.
-            ser(ref_lens);
-            // flush to writer
-            ser.adapter().flush();
+    tilings_out.write(reinterpret_cast<char const*>(tilings_buffer.data()),
+                      tilings_buffer.size() * sizeof(uint64_t));
+    scan_step.set("tmp_file_bytes", static_cast<uint64_t>(tilings_out.tellp()));
+    tilings_out.close();
+    if (!tilings_out.good()) {
+        spdlog::critical("failed to write intermediate file {}.", m_tilings_filename);
+        return false;
+    }
+
+    m_max_ref_len = max_ref_len;
+    spdlog::info("completed pass over paths.");
+    scan_step.set("num_refs", m_num_refs);
+    scan_step.set("max_ref_len", m_max_ref_len);
+    if (m_checkpoint) {
+        m_checkpoint->save("scan_tilings", m_segment_lengths, m_segment_counts, m_max_ref_len,
+                           m_num_refs);
+    }
+    return true;
+}
+
+bool contig_table_builder::build(bool build_eq_table, uint32_t num_threads) {
+    if (m_checkpoint and m_checkpoint->done("ctab")) {
+        std::remove(m_tilings_filename.c_str());
+        if (!build_eq_table or m_checkpoint->done("ectab")) { return true; }
+        basic_contig_table bct;
+        std::string out_ctab = m_output_filename + ".ctab";
+        essentials::load(bct, out_ctab.c_str());
+        spdlog::info("step 'ctab' restored from checkpoint.");
+        if (!build_equivalence_class_table(bct, m_segment_lengths.size(), num_threads,
+                                           m_output_filename, m_profile)) {
+            return false;
         }
+        m_checkpoint->mark_done("ectab");
+        return true;
     }
-    // close the buffer that we are serializing to
-    s.close();
 
-    uint64_t ref_len_bits = std::ceil(std::log2(max_ref_len + 1));
-    uint64_t num_ref_bits = std::ceil(std::log2(num_refs + 1));
+    build_profile::step ctab_step(m_profile, "ctab");
+    const uint64_t k = m_k;
+    const uint64_t num_segments = m_segment_lengths.size();
+    uint64_t ref_len_bits = std::ceil(std::log2(m_max_ref_len + 1));
+    if (m_base_ref_len_bits > 0) {
+        if (ref_len_bits > m_base_ref_len_bits) {
+            spdlog::critical(
+                "max ref len = {} requires {} bits, but the base index encodes reference "
+                "positions with {} bits; the index must be rebuilt.",
+                m_max_ref_len, ref_len_bits, m_base_ref_len_bits);
+            return false;
+        }
+        ref_len_bits = m_base_ref_len_bits;
+    }
+    uint64_t num_ref_bits = std::ceil(std::log2(m_first_ref_id + m_num_refs + 1));
     uint64_t total_ctg_bits = ref_len_bits + num_ref_bits + 1;
 
     // to get to the ref we shift ref_len_bits + 1 (orientation bit)
-    sshash::util::_ref_shift = ref_len_bits + 1;
-    sshash::util::_pos_mask = sshash::util::pos_masks[ref_len_bits];
+    const sshash::util::contig_entry_codec codec(ref_len_bits);
 
-    spdlog::info("completed first pass over paths.");
-    spdlog::info("there were {} segments.", id_to_rank.size());
-    spdlog::info("max ref len = {}, requires {} bits.", max_ref_len, ref_len_bits);
-    spdlog::info("max refs = {}, requires {} bits.", num_refs, num_ref_bits);
+    spdlog::info("there were {} segments.", num_segments);
+    spdlog::info("max ref len = {}, requires {} bits.", m_max_ref_len, ref_len_bits);
+    spdlog::info("max refs = {}, requires {} bits.", m_num_refs, num_ref_bits);
 
     uint64_t tot_seg_occ = 0;
-    for (auto& kv : id_to_rank) { tot_seg_occ += kv.second.count; }
+    for (auto c : m_segment_counts) { tot_seg_occ += c; }
 
     spdlog::info("there were {} total segment occurrences", tot_seg_occ);
     spdlog::info("computing cumulative offset vector.");
 
+    // a contig occurring once has its entry stored inline; for every other contig,
+    // the inline slot holds its rank among the contigs occurring more than once.
+    constexpr uint64_t inline_entry = sshash::constants::invalid_uint64;
+    uint64_t num_single = 0;
+    for (auto c : m_segment_counts) { num_single += (c == 1); }
+    uint64_t num_multi = num_segments - num_single;
+    uint64_t inline_bits = std::max<uint64_t>(total_ctg_bits, std::ceil(std::log2(num_multi + 1)));
+    spdlog::info("{} segments occur once and are stored inline.", num_single);
+
     basic_contig_table bct;
     bct.m_ref_len_bits = ref_len_bits;
+    auto inline_builder = pthash::compact_vector::builder(num_segments, inline_bits);
     {
         // next we compute an offest vector that will point
         // to where, in the concatenated contig occurrence
-        // table, the sublist for each contig starts.
+        // table, the sublist for each contig (occurring more
+        // than once) starts.
         // this looks like:
         // [0, #occ(ctg_0), #occ(ctg_0)+#occ(ctg_1), ...]
         // in other words, it is a cumulative sum, padded with 0
         // at the start.
+        pthash::bit_vector_builder is_single_builder(num_segments);
         std::vector<uint64_t> contig_offsets;
-        contig_offsets.reserve(id_to_rank.size() + 1);
+        contig_offsets.reserve(num_multi + 1);
         contig_offsets.push_back(0);
         uint64_t total_occ = 0;
-        for (auto seg_id : segment_order) {
-            total_occ += id_to_rank[seg_id].count;
-            contig_offsets.push_back(total_occ);
-        }
-
-        spdlog::info("converting segment coutns to offsets.");
-        // now convert each `count` entry for each contig to
-        // the current offset where its next entry will be written
-        for (size_t i = 0; i < segment_order.size(); ++i) {
-            auto seg_id = segment_order[i];
-            id_to_rank[seg_id].count = contig_offsets[i];
-            if (id_to_rank[seg_id].rank != i) {
-                spdlog::critical("expected segment {} to have rank {}, but it had rank {}", seg_id,
-                                 i, id_to_rank[seg_id].rank);
-                std::exit(1);
+        spdlog::info("converting segment counts to offsets.");
+        for (uint64_t rank = 0; rank < num_segments; ++rank) {
+            if (m_segment_counts[rank] == 1) {
+                is_single_builder.set(rank, true);
+                m_segment_counts[rank] = inline_entry;
+                continue;
             }
+            inline_builder.set(rank, contig_offsets.size() - 1);
+            // now convert each count to the current offset
+            // where the next entry of that segment will be written
+            uint64_t count = m_segment_counts[rank];
+            m_segment_counts[rank] = total_occ;
+            total_occ += count;
+            contig_offsets.push_back(total_occ);
         }
         // since the contig offset vector is a monotonic sequence
         // it is amenable to Elias-Fano compression, so compress it
         // as such and write it.
-        // ef_sequence efo;
         bct.m_ctg_offsets.encode(contig_offsets.begin(), contig_offsets.size(),
                                  contig_offsets.back());
-        // std::string cto_fname = output_filename+"_coff.bin";
-        // essentials::save(efo, cto_fname.c_str());
+        pthash::bit_vector(&is_single_builder).swap(bct.m_is_single);
     }
 
-    spdlog::info("second pass over seq file to fill in contig entries.");
+    spdlog::info("replaying tilings to fill in contig entries.");
     {
-        // Finally, we'll go over the sequences of segments again
+        build_profile::step replay_step(m_profile, "ctab/replay_tilings");
+        // Finally, we'll go over the recorded tilings
         // and build the final table.
-        auto seg_table_builder = pthash::compact_vector::builder(tot_seg_occ, total_ctg_bits);
-        // auto& seg_table = bct.m_ctg_entries;
-        // seg_table.resize(tot_seg_occ);
-        std::ifstream ifile(input_filename + ".cf_seq");
+        auto seg_table_builder =
+            pthash::compact_vector::builder(tot_seg_occ - num_single, total_ctg_bits);
+        mm::file_source<uint64_t> input(m_tilings_filename, mm::advice::sequential);
+        uint64_t const* tilings = input.data();
+        uint64_t num_tilings = input.size();
 
-        uint64_t refctr = 0;
+        uint64_t refctr = m_first_ref_id;
         bool first = true;
         uint64_t current_offset = 0;
 
-        while (!ifile.eof()) {
-            std::string tok;
-            while (ifile >> tok) {
-                // this is a new reference
-                if (tok.compare(0, hlen, refstr) == 0) {
+        for (uint64_t i = 0; i < num_tilings; ++i) {
+            uint64_t payload = tilings[i] >> 2;
+            switch (tilings[i] & 0x3) {
+                case NEW_REF:
                     if (!first) { ++refctr; }
                     if (refctr % 10000 == 0) { spdlog::info("processing reference #{}", refctr); }
                     first = false;
                     current_offset = 0;
-                } else {  // this should be a segment entry
-                    bool is_n_tile = false;
-                    bool is_fw = true;
-                    if (tok.back() == '-') {
-                        is_fw = false;
-                    } else if (tok.back() == '+') {
-                        is_fw = true;
-                    } else if (tok.front() == 'N') {
-                        is_n_tile = true;
-                    } else {
-                        spdlog::critical("Unless a tiling entry is an 'N' entry, it must end with '+' or '-'. "
-                                         "Found unexpected last character [{}] of tiling entry.",
-                                          tok.back());
-                        std::exit(1);
-                    }
-                    
-                    if (is_n_tile) {
-                      tok.erase(0,1); // remove the leading 'N'
-                      uint64_t num_ns = std::stoul(tok, nullptr, 10);
-                      // if this was the first tile it needs special handling.
-                      // specifically, we *shouldn't* skip the k-1 overlap we should 
-                      // just skip the leading 'N's.
-                      if (current_offset > 0) {
-                        current_offset += (k-1);
-                      }
-                      current_offset += num_ns;
+                    break;
+                case N_RUN:
+                    // if this was the first tile it needs special handling.
+                    // specifically, we *shouldn't* skip the k-1 overlap we should
+                    // just skip the leading 'N's.
+                    if (current_offset > 0) { current_offset += (k - 1); }
+                    current_offset += payload;
+                    break;
+                default: {
+                    bool is_fw = ((tilings[i] & 0x3) == TILE_FW);
+                    uint64_t encoded_entry = codec.encode(refctr, current_offset, is_fw);
+                    auto& entry_idx = m_segment_counts[payload];
+                    if (entry_idx == inline_entry) {
+                        inline_builder.set(payload, encoded_entry);
                     } else {
-                      tok.pop_back();
-                      uint64_t id = std::stoul(tok, nullptr, 10);
-                      // get the entry for this segment
-                      auto& v = id_to_rank[id];
-
-                      // insert the next entry for this segment
-                      // at the index given by v.count.
-                      auto entry_idx = v.count;
-                      uint64_t encoded_entry =
-                        sshash::util::encode_contig_entry(refctr, current_offset, is_fw);
-                      //[entry_idx].update(refctr, current_offset, is_fw);
-                      seg_table_builder.set(entry_idx, encoded_entry);
-                      // then we increment entry_idx for next time
-                      v.count += 1;
-                      // then we increment the current offset
-                      current_offset += v.len - (k - 1);
+                        // insert the next entry for this segment
+                        // at the index given by its current offset.
+                        seg_table_builder.set(entry_idx, encoded_entry);
+                        // then we increment entry_idx for next time
+                        entry_idx += 1;
                     }
+                    // then we increment the current offset
+                    current_offset += m_segment_lengths[payload] - (k - 1);
                 }
             }
         }
+        input.close();
         seg_table_builder.build(bct.m_ctg_entries);
+        inline_builder.build(bct.m_ctg_inline);
     }
+    std::vector<uint64_t>().swap(m_segment_counts);
 
-    std::string out_ctab = output_filename + ".ctab";
+    std::string out_ctab = m_output_filename + ".ctab";
     essentials::save(bct, out_ctab.c_str());
+    if (m_checkpoint) { m_checkpoint->mark_done("ctab"); }
+    std::remove(m_tilings_filename.c_str());
+    ctab_step.set("num_segments", num_segments);
+    ctab_step.set("num_entries", tot_seg_occ);
+    ctab_step.set("num_inline_entries", num_single);
+    ctab_step.set("entry_bits", total_ctg_bits);
+    ctab_step.finish();
 
     if (build_eq_table) {
-      // map equivalence class content to id
-      flat_hash_map<std::vector<std::tuple<uint32_t, dir_status>>, rank_offset>  ec_id_map;
-      std::vector<std::tuple<uint32_t, dir_status>> label;
-      uint64_t largest_label = 0;
-
-      // the number of tiles
-      size_t num_tiles = id_to_rank.size();
-
-      // the ec table
-      equivalence_class_map ect;
-
-      // will hold the total length of concatenated labels of all equivalence 
-      // classes
-      size_t total_label_length = 0;
-      {
-        // will hold the starting position in the globally concatenated 
-        // list, for the sublist corresponding to each equivalence class
-        std::vector<uint64_t> label_list_offsets;
-
-        // holds the corresponding ec id for each contig
-        std::vector<uint32_t> tile_ec_ids;
-        tile_ec_ids.reserve(num_tiles);
-
-        for (size_t tile_idx = 0; tile_idx < num_tiles; ++tile_idx) {
-          label.clear();
-          uint32_t prev_tid = 0;
-          dir_status prev_dir = dir_status::FW;
-          bool first = true;
-          sshash::util::contig_span ctg_entry_span = bct.contig_entries(tile_idx);
-          for (auto ce : ctg_entry_span) {
-            // note, these sshash::util:: functions should be safe to call because 
-            // we have set the relevant static members above.
-            uint32_t tid = sshash::util::transcript_id(ce);
-            dir_status dir = sshash::util::orientation(ce) ? dir_status::FW : dir_status::RC;
-            largest_label = std::max(static_cast<uint64_t>(tid), largest_label);
-
-            // skip adjacent duplicates (we can still get dups because of orientation 
-            // switching), but if duplicate target / ori pairs are adjacent, don't 
-            // add them to avoid the vector growing unnecessarily.
-            if (first or tid != prev_tid) {
-              label.push_back({tid, dir});
-            } else if (tid == prev_tid and dir != prev_dir) {
-              // if dir != prev_dir, then 
-              // dir == FW and prev_dir == RC
-              // or dir == RC and prev_dir == FW
-              // or prev_dir == BOTH and dir == FW | RC 
-              // in any such case, the right thing to do is 
-              // to set (or keep) the dir as BOTH.
-              std::get<1>(label.back()) = dir_status::BOTH;
-            }
-
-            prev_tid = tid;
-            prev_dir = dir;
-            first = false;
-          }
-          // remove any duplicate entries --- shouldn't be any!
-          std::sort(label.begin(), label.end());
-          auto last_valid_it = std::unique(label.begin(), label.end());
-          if (last_valid_it != label.end()) {
-            std::cerr << "sort | unique should not be necessary on ec label!\n";
-            label.erase(last_valid_it, label.end());
-          }
-
-          // see if we know about this class already
-          uint32_t next_ec_rank = static_cast<uint32_t>(ec_id_map.size());
-          auto ec_it = ec_id_map.insert({label, {next_ec_rank, total_label_length}});
-          // if this is newly inserted
-          if (ec_it.second) {
-            label_list_offsets.push_back(total_label_length);
-            total_label_length += label.size();
-          }
-          // may have been set / updated in the if above
-          tile_ec_ids.push_back((ec_it.first)->second.rank);
-
-        } // created the hash map, now pack it into an efficient structure 
-          // last label list ending position
-        label_list_offsets.push_back(total_label_length);
-        // since the offset vector is a monotonic sequence
-        // it is amenable to Elias-Fano compression, so compress it
-        // as such and write it.
-        ect.m_label_list_offsets.encode(label_list_offsets.begin(), label_list_offsets.size(),
-            label_list_offsets.back());
-        
-        uint64_t tile_id_width = std::ceil(std::log2(ec_id_map.size() + 1));
-        pthash::compact_vector::builder ec_id_builder(tile_ec_ids.begin(), tile_ec_ids.size(), tile_id_width);
-        ec_id_builder.build(ect.m_tile_ec_ids);
-      } // end scope to free labal_list_offsets 
-
-      // the +2 is for the orientation bits;
-      uint64_t label_width = std::ceil(std::log2(largest_label + 1)) + 2;
-      pthash::compact_vector::builder label_builder(total_label_length, label_width);
-
-      // now, iterate over the equivalence class map and pack the 
-      // label information into the concatenated vector
-      for (auto& kv : ec_id_map) {
-        // where we start writing 
-        uint64_t offset_pos = kv.second.offset;
-        for (auto ref_dir : kv.first) {
-          auto txpid = std::get<0>(ref_dir);
-          auto dir = std::get<1>(ref_dir);
-          // pack this into the compact_vector 
-          uint64_t packed_entry = (txpid << 2);
-          switch (dir) {
-            case dir_status::FW:
-              break;
-            case dir_status::RC:
-              packed_entry |= 0x1;
-              break;
-            case dir_status::BOTH:
-              packed_entry |= 0x2;
-          }
-
-          label_builder.set(offset_pos, packed_entry);
-          ++offset_pos;
-        }
+      if (!build_equivalence_class_table(bct, num_segments, num_threads, m_output_filename,
+                                         m_profile)) {
+        return false;
       }
-
-      label_builder.build(ect.m_label_entries);
-
-      std::string out_ectab = output_filename + ".ectab";
-      essentials::save(ect, out_ectab.c_str());
+      if (m_checkpoint) { m_checkpoint->mark_done("ectab"); }
     }
 
     /*
@@ -513,10 +759,22 @@ bool build_contig_table(const std::string& input_filename, uint64_t k,
     return true;
 }
 
+bool build_contig_table(const std::string& input_filename, uint64_t k,
+                        bool build_eq_table, uint32_t num_threads,
+                        const std::string& tmp_dirname,
+                        const std::string& output_filename) {
+    contig_table_builder ctb(input_filename, k, output_filename, tmp_dirname);
+    ctb.read_segments();
+    if (!ctb.scan_tilings()) { return false; }
+    return ctb.build(build_eq_table, num_threads);
+}
+
 int build_contig_table_main(const std::string& input_filename, uint64_t k,
-                            bool build_eq_table,
+                            bool build_eq_table, uint32_t num_threads,
+                            const std::string& tmp_dirname,
                             const std::string& output_filename) {
-    bool success = build_contig_table(input_filename, k, build_eq_table, output_filename);
+    bool success = build_contig_table(input_filename, k, build_eq_table, num_threads,
+                                      tmp_dirname, output_filename);
     if (!success) {
         spdlog::critical("failed to build contig table.");
         return 1;
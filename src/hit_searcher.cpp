@@ -2,6 +2,8 @@
 #include "../include/bit_vector_iterator.hpp"
 #include <cmath>
 #include <limits>
+#include <optional>
+#include <tuple>
 
 // using spp:sparse_hash_map;
 
@@ -9,10 +11,6 @@ namespace mindex {
 // polute the namespace --- put this in the functions that need it.
 namespace kmers = combinelib::kmers;
 
-void hit_searcher::setAltSkip(uint32_t as) {
-  altSkip = as;
-}
-
 enum class LastSkipType : uint8_t { NO_HIT=0, SKIP_READ=1, SKIP_UNI=2 };
 
 struct FastHitInfo {
@@ -30,19 +28,91 @@ struct FastHitInfo {
   uint64_t ref_kmer{0};
 };
 
+// A hit as the search holds it: the compact record it will report, along with 
+// the position of the k-mer in the contig strings, which tells where the k-mers 
+// that follow on the contig are (see `SkipContext::advance_from_hit()`).
+struct search_hit {
+  inline bool empty() const { return hit.empty(); }
+
+  raw_hit hit;
+  uint64_t global_pos{std::numeric_limits<uint64_t>::max()};
+};
+
+// Splits a read into its super-k-mers as the index would: maximal runs of
+// consecutive k-mers with the same (canonical) minimizer, of at most k - m + 1
+// k-mers each. Since the k-mers of a super-k-mer of the read all fall in the
+// bucket of its minimizer, looking up one or two of them per super-k-mer
+// probes every bucket the read can hit.
+struct SuperKmerSampler {
+  SuperKmerSampler(std::string& read, const sshash::dictionary* dict) :
+    it(read),
+    max_len(static_cast<int32_t>(dict->k() - dict->m() + 1)),
+    fw_enum(dict->k(), dict->m(), dict->seed()),
+    rc_enum(dict->k(), dict->m(), dict->seed()) {
+    if (it != it_end) { pending_minimizer = minimizer(true); }
+  }
+
+  // Sets `first` and `last` to the first and last k-mer of the next
+  // super-k-mer of the read, and returns false if there is none.
+  inline bool next(pufferfish::CanonicalKmerIterator& first,
+                   pufferfish::CanonicalKmerIterator& last) {
+    if (it == it_end) { return false; }
+    first = it;
+    last = it;
+    uint64_t curr_minimizer = pending_minimizer;
+    int32_t len = 1;
+    while (true) {
+      int32_t prev_pos = it->second;
+      ++it;
+      if (it == it_end) { break; }
+      bool clear = (it->second != prev_pos + 1);
+      pending_minimizer = minimizer(clear);
+      if (clear or pending_minimizer != curr_minimizer or len == max_len) { break; }
+      last = it;
+      ++len;
+    }
+    return true;
+  }
+
+  // the canonical minimizer of the k-mer at `it`, computed as the streaming
+  // query does (see `do_lookup_advanced()`)
+  inline uint64_t minimizer(bool clear) {
+    constexpr bool reverse = true;
+    uint64_t fw = fw_enum.next(it->first.fwWord(), clear);
+    uint64_t rc = rc_enum.next<reverse>(it->first.rcWord(), clear);
+    return std::min(fw, rc);
+  }
+
+  pufferfish::CanonicalKmerIterator it;
+  pufferfish::CanonicalKmerIterator it_end;
+  int32_t max_len;
+  sshash::minimizer_enumerator<> fw_enum;
+  sshash::minimizer_enumerator<> rc_enum;
+  uint64_t pending_minimizer{0};
+};
+
 // Idea is to move the logic of the search into here.
 // We should also consider the optimizations that can 
 // be done here (like having small checks expected to)
 // be on the same contig bypass a hash lookup.
 struct SkipContext {
 
-  SkipContext(std::string& read, reference_index* pfi_in, int32_t k_in) : 
-    kit1(read), kit_tmp(read), pfi(pfi_in), 
+  SkipContext(std::string& read, reference_index* pfi_in, int32_t k_in,
+              const skipping_policy& policy_in,
+              sshash::streaming_query_canonical_parsing* delta_qc_in = nullptr) : 
+    kit1(read), kit_tmp(read), pfi(pfi_in), delta_qc(delta_qc_in),
     ref_contig_it( sshash::bit_vector_iterator(pfi_in->contigs(), 0) ),
     read_len(static_cast<int32_t>(read.length())),
     read_target_pos(0), read_current_pos(0), read_prev_pos(0), safe_skip(1),
-    k(k_in), expected_cid(invalid_cid), last_skip_type(LastSkipType::NO_HIT), miss_it(0),
-    global_contig_pos(-1) { }
+    k(k_in), policy(policy_in.for_read(read_len)), expected_cid(invalid_cid), 
+    last_skip_type(LastSkipType::NO_HIT), miss_it(0), global_contig_pos(-1) {
+    if (policy.sampled()) {
+      sampler.emplace(read, pfi->get_dict());
+      // the first k-mer of the read starts its first super-k-mer
+      sampler->next(kit1, skmer_last);
+      kit_tmp = kit1;
+    }
+  }
   
   inline bool is_exhausted() {
     return kit1 == kit_end;
@@ -55,26 +125,48 @@ struct SkipContext {
   inline bool query_kmer(sshash::streaming_query_canonical_parsing& qc) {
     bool found_match = false;
     if (fast_hit.valid()) {
+      ++num_fast_checks;
       auto keq = kit1->first.isEquivalent(fast_hit.ref_kmer);
       if (keq != KmerMatchType::NO_MATCH) {
         found_match = true;
         // how the k-mer hits the contig (true if k-mer in fwd orientation,
         // false otherwise)
         bool hit_fw = (keq == KmerMatchType::IDENTITY_MATCH);
-        phits.contigOrientation_ = hit_fw;
-        phits.globalPos_ += fast_hit.offset;
-        phits.contigPos_ += fast_hit.offset;
+        phits.hit.fw_on_contig = hit_fw;
+        phits.global_pos += fast_hit.offset;
+        phits.hit.contig_pos += fast_hit.offset;
       }
       fast_hit.valid(false);
     }
 
     if (!found_match) {
-      phits = pfi->query(kit1, qc);
+      ++num_lookups;
+      phits.global_pos = pfi->query_raw(kit1, qc, phits.hit);
     }
 
+    if (delta_qc) { query_delta(); }
+
     return !phits.empty();
   }
 
+  // If the index has a delta layer, look up the current k-mer there as well.
+  // When the k-mer occurs only in the delta, the delta hit takes the place 
+  // of the base hit. Such hits never set up fast checks, since those read 
+  // the k-mers of the base contigs.
+  inline void query_delta() {
+    delta_phits.global_pos = pfi->query_delta_raw(kit1, *delta_qc, delta_phits.hit);
+    delta_hit = !delta_phits.empty();
+    if (delta_hit and phits.empty()) {
+      phits = delta_phits;
+      delta_hit = false;
+    }
+  }
+
+  // True if the current k-mer was found in both the base and the delta 
+  // layer of the index, in which case `delta_proj_hits()` is the latter hit.
+  inline bool has_delta_hit() { return delta_hit; }
+  inline const search_hit& delta_proj_hits() { return delta_phits; }
+
   // Returns true if the current hit occurred 
   // on a unitig other than that which was expected.
   // If there is no expecation about the unitig 
@@ -82,7 +174,7 @@ struct SkipContext {
   // obtaining this hit) or if the current unitig 
   // matches expectation, then it returns false.
   inline bool hit_is_unexpected() {
-    return (expected_cid != invalid_cid and phits.contigIdx_ != expected_cid);
+    return (expected_cid != invalid_cid and phits.hit.contig_id != expected_cid);
   }
 
   // Returns:
@@ -102,7 +194,7 @@ struct SkipContext {
 
   // Returns the most recent projected hits object 
   // obtained by this skip context.
-  inline projected_hits proj_hits() { return phits; }
+  inline const search_hit& proj_hits() { return phits; }
 
   // Clears out any expectation we have about the unitig 
   // on which the next hit should occur.
@@ -216,6 +308,18 @@ struct SkipContext {
    * (4) set up the appropriate context for a fast hit check if appropriate
    */
   inline void advance_from_hit() {
+      // an exhaustive search moves on to the next k-mer, without
+      // any expectation about it
+      if (policy.exhaustive()) {
+        kit1 += 1;
+        kit_tmp = kit1;
+        return;
+      }
+      if (policy.sampled()) {
+        advance_to_next_super_kmer();
+        return;
+      }
+
       int32_t skip = 1;
       // the offset of the hit on the read
       int32_t read_offset = kit1->second;
@@ -229,7 +333,7 @@ struct SkipContext {
       // found what we expected, but after 1 or more misses.  In that case, 
       // we're satisfied with the rest of this unitig so we simply move on 
       // to the position after our original skip position.
-      if ( (miss_it > 0) and (expected_cid != invalid_cid) and (expected_cid == phits.contigIdx_) ) {
+      if ( (miss_it > 0) and (expected_cid != invalid_cid) and (expected_cid == phits.hit.contig_id) ) {
         skip = read_target_pos - read_offset + 1;
         skip = (skip < 1) ? 1 : skip;
         kit1 += skip;
@@ -242,17 +346,17 @@ struct SkipContext {
       // any valid skip should always be at least 1 base
       read_skip = (read_skip < 1) ? 1 : read_skip;
       
-      size_t cStartPos = phits.globalPos_ - phits.contigPos_; 
-      size_t cEndPos = cStartPos + phits.contigLen_;
-      size_t cCurrPos = phits.globalPos_; 
+      size_t cStartPos = phits.global_pos - phits.hit.contig_pos; 
+      size_t cEndPos = cStartPos + phits.hit.contig_len;
+      size_t cCurrPos = phits.global_pos; 
       global_contig_pos = static_cast<int64_t>(cCurrPos);
 
       int32_t ctg_skip = 1;
       // fw ori
-      if (phits.contigOrientation_) {
+      if (phits.hit.fw_on_contig) {
         ctg_skip = static_cast<int64_t>(cEndPos) - (static_cast<int64_t>(cCurrPos + k));
       } else { // rc ori
-        ctg_skip = static_cast<int32_t>(phits.contigPos_);
+        ctg_skip = static_cast<int32_t>(phits.hit.contig_pos);
       }
       // we're already at the end of the contig
       bool at_contig_end = (ctg_skip == 0);
@@ -264,7 +368,7 @@ struct SkipContext {
         ctg_skip = 1;
         clear_expectation();
       } else { // otherwise, we expect the next contig to be the same
-        expected_cid = phits.contigIdx_;
+        expected_cid = phits.hit.contig_id;
       }
 
       // remember where we are coming from
@@ -298,14 +402,15 @@ struct SkipContext {
       // if we got the skip we expected, then 
       // set ourselves up for a fast check in case we see 
       // what we expect to see.
-      if (expected_skip and (expected_cid != invalid_cid) and (kit1 != kit_end)) {
+      if (expected_skip and (expected_cid != invalid_cid) and (kit1 != kit_end) and 
+          !phits.hit.from_delta) {
         /*
       if (2*cCurrPos > ref_contig_it.size()) {
         std::cout << "cCurrPos = " << 2*cCurrPos << ", ref_contig_len = " << ref_contig_it.size() << "\n";
         std::cout << "expected_cid = " << expected_cid << ", skip = " << skip << "\n";
       }
       */
-        if (phits.contigOrientation_) { 
+        if (phits.hit.fw_on_contig) { 
           // if match is fw, go to the next k-mer in the contig
           cCurrPos += skip;
           fast_hit.valid(true);
@@ -325,6 +430,23 @@ struct SkipContext {
   }
 
   inline void advance_from_miss() {
+      if (policy.exhaustive()) {
+        kit1 += 1;
+        return;
+      }
+      // after a miss on the first k-mer of a super-k-mer, try its last 
+      // k-mer, which is looked up in the bucket already located
+      if (policy.sampled()) {
+        if (!at_skmer_last and kit1->second != skmer_last->second) {
+          kit1 = skmer_last;
+          kit_tmp = kit1;
+          at_skmer_last = true;
+          return;
+        }
+        advance_to_next_super_kmer();
+        return;
+      }
+
       int32_t skip = 1;
 
       // distance from backup position 
@@ -332,10 +454,10 @@ struct SkipContext {
 
       switch (last_skip_type) {
         // we could have not yet seen a hit
-        // should move alt_skip at a time
+        // should move no_hit_skip at a time
         case LastSkipType::NO_HIT : {
           //int32_t dist_to_end = (read_len - (kit1->second + k));
-          kit1 += 5;
+          kit1 += policy.no_hit_skip;
           return;
         }
         break;
@@ -363,8 +485,8 @@ struct SkipContext {
           } else {
             // otherwise move the backup position toward us
             // and move the current point to the backup
-            skip = (miss_it < 4) ? dist / 2 : 2;
-            skip = (skip < 2) ? 2 : skip;
+            skip = (miss_it < policy.halving_misses) ? dist / 2 : policy.min_backoff;
+            skip = (skip < policy.min_backoff) ? policy.min_backoff : skip;
             kit_tmp += skip;
             kit1 = kit_tmp;
           }
@@ -375,9 +497,11 @@ struct SkipContext {
           if (// if we have an expecation
               (expected_cid != invalid_cid) and 
               // and the prev hit was on the expected unitig
-              (phits.contigIdx_ == expected_cid) and 
+              (phits.hit.contig_id == expected_cid) and 
               // and we are still before the final target position 
-              (kit1->second < read_target_pos)) {
+              (kit1->second < read_target_pos) and
+              // and the hit is on a contig of the base index
+              !phits.hit.from_delta) {
             
             // Here, we compute the actual amount we skipped by, since
             // there may have been intervening 'N's in the read and 
@@ -389,7 +513,7 @@ struct SkipContext {
             // reset the fast_hit offset.
             if (miss_it == 0) { fast_hit.offset = 0; }
             
-            if (phits.contigOrientation_) {
+            if (phits.hit.fw_on_contig) {
               fast_hit.offset += actual_skip;
               global_contig_pos += actual_skip;
             } else {
@@ -417,11 +541,20 @@ struct SkipContext {
       // that doesn't matter since it is recursively one of the above cases.
   }
 
+  // Moves kit1 to the first k-mer of the next super-k-mer of the read (or
+  // to the end of the read).
+  inline void advance_to_next_super_kmer() {
+    if (!sampler->next(kit1, skmer_last)) { kit1 = kit_end; }
+    kit_tmp = kit1;
+    at_skmer_last = false;
+  }
+
   pufferfish::CanonicalKmerIterator kit1;
   pufferfish::CanonicalKmerIterator kit_tmp;
   pufferfish::CanonicalKmerIterator kit_end;
   pufferfish::CanonicalKmerIterator kit_swap;
   reference_index* pfi={nullptr};
+  sshash::streaming_query_canonical_parsing* delta_qc={nullptr};
   sshash::bit_vector_iterator ref_contig_it;
   int32_t read_len;
   int32_t read_target_pos;
@@ -429,72 +562,90 @@ struct SkipContext {
   int32_t read_prev_pos;
   int32_t safe_skip;
   int32_t k;
+  skipping_policy policy;
   FastHitInfo fast_hit;
   uint32_t expected_cid;
   LastSkipType last_skip_type{LastSkipType::NO_HIT};
   int32_t miss_it;
   int64_t global_contig_pos;
-  projected_hits phits;
+  search_hit phits;
+  search_hit delta_phits;
+  bool delta_hit{false};
+  uint32_t num_lookups{0};
+  uint32_t num_fast_checks{0};
+  // the super-k-mers of the read, for the SAMPLED strategy
+  std::optional<SuperKmerSampler> sampler;
+  pufferfish::CanonicalKmerIterator skmer_last;
+  bool at_skmer_last{false};
   static constexpr uint32_t invalid_cid{std::numeric_limits<uint32_t>::max()};
 };
 
-// This method performs k-mer / hit collection 
-// using a custom implementation of the corresponding 
-// part of the pseudoalignment algorithm as described in (1).
-// Specifically, it attempts to find a small set of 
-// k-mers along the fragment (`read`) that are shared with
-// a set of unitigs in the compacted colored de Bruijn graph, 
-// using the structure of the graph to avoid queries that
-// are unlikely to change the resulting set of unitigs 
-// that are discovered.  This function only fills out the 
-// set of hits, and does not itself implement any 
-// consensus mechanism.  This hit collection mechanism 
-// prioritizes speed compared to e.g. the uniMEM collection
-// strategy implemented in the `operator()` method of this 
-// class.  Currently, this strategy is only used in the 
-// `--sketch` mode of alevin.  One may refer to the 
-// [release notes](https://github.com/COMBINE-lab/salmon/releases/tag/v1.4.0)
-// of the relevant version of salmon and links therein 
-// for a more detailed discussion of the downstream effects of 
-// different strategies.
-//
-// The function fills out the appropriate raw hits 
-// member of this MemCollector instance.  
-// 
-// If the `isLeft` flag is set to true, then the left 
-// raw hits are filled and can be retreived with 
-// `get_left_hits()`.  Otherwise, the right raw hits are 
-// filled and can be retrieved with `get_right_hits()`.
-//
-// This function returns `true` if at least one hit was 
-// found shared between the read and reference and 
-// `false` otherwise.
-// 
-// [1] Bray NL, Pimentel H, Melsted P, Pachter L. 
-// Near-optimal probabilistic RNA-seq quantification. 
-// Nat Biotechnol. 2016;34(5):525-527.
-//
-bool hit_searcher::get_raw_hits_sketch(std::string &read,
-                  sshash::streaming_query_canonical_parsing& qc,
-                  bool isLeft,
-                  bool verbose) {
-  (void) verbose;
-  projected_hits phits;
-  auto& raw_hits = isLeft ? left_rawHits : right_rawHits;
+// The hit search of `get_raw_hits_sketch` over a single read, written as
+// a state machine that stops before each k-mer lookup. Each call to
+// `resume()` performs the pending lookup and carries the search on up to
+// the next one, so that the searches of several reads can be interleaved
+// (see `batched_hit_searcher`).
+struct SkipSearch {
+  enum class State : uint8_t { QUERY = 0, SAFE_QUERY, DONE };
+
+  SkipSearch(std::string& read, reference_index* pfi_in, int32_t k_in,
+             const skipping_policy& policy_in,
+             sshash::streaming_query_canonical_parsing* delta_qc_in,
+             std::vector<raw_hit>& raw_hits_in) :
+    skip_ctx(read, pfi_in, k_in, policy_in, delta_qc_in), raw_hits(raw_hits_in),
+    state(skip_ctx.is_exhausted() ? State::DONE : State::QUERY) { }
+
+  inline bool done() const { return state == State::DONE; }
+
+  inline uint32_t num_lookups() const { return skip_ctx.num_lookups; }
+  inline uint32_t num_fast_checks() const { return skip_ctx.num_fast_checks; }
+
+  // The k-mer of the pending lookup.
+  inline CanonicalKmer& pending_kmer() { return skip_ctx.curr_kmer(); }
+
+  // True if the pending lookup starts with a check against the k-mer 
+  // expected on the current contig, which reads nothing from the index.
+  inline bool pending_fast_check() { return skip_ctx.fast_hit.valid(); }
+
+  // Performs the pending lookup and advances to the next one. Returns 
+  // false once the whole read has been searched.
+  inline bool resume(sshash::streaming_query_canonical_parsing& qc) {
+    switch (state) {
+      case State::QUERY:
+        query(qc);
+        break;
+      case State::SAFE_QUERY:
+        safe_query(qc);
+        break;
+      case State::DONE:
+        return false;
+    }
+    if (state == State::QUERY and skip_ctx.is_exhausted()) { state = State::DONE; }
+    return state != State::DONE;
+  }
 
-  CanonicalKmer::k(k);
-  int32_t k = static_cast<int32_t>(CanonicalKmer::k());
-  SkipContext skip_ctx(read, pfi_, k);
-  
-  // while it is possible to search further
-  while (!skip_ctx.is_exhausted()) {
-    
+private:
+  // a k-mer shared by the base and the delta layer of the 
+  // index yields a hit in each, recorded at the same position.
+  inline void record_hit(int32_t pos, const search_hit& ph, 
+                         bool has_delta_hit, const search_hit& dph) {
+    raw_hits.push_back(ph.hit);
+    raw_hits.back().read_pos = pos;
+    if (has_delta_hit) {
+      raw_hits.push_back(dph.hit);
+      raw_hits.back().read_pos = pos;
+    }
+  }
+
+  inline void query(sshash::streaming_query_canonical_parsing& qc) {
     // if we had a hit
     if (skip_ctx.query_kmer(qc)) {
 
       // record this hit
-      int32_t read_pos = skip_ctx.read_pos();
-      auto proj_hits = skip_ctx.proj_hits();
+      read_pos = skip_ctx.read_pos();
+      proj_hits = skip_ctx.proj_hits();
+      has_delta_hit = skip_ctx.has_delta_hit();
+      delta_hits = skip_ctx.delta_proj_hits();
       
       // if the hit was not inline with what we were 
       // expecting. 
@@ -513,11 +664,11 @@ bool hit_searcher::get_raw_hits_sketch(std::string &read,
         // we want to add the current hit *before* doing advances 
         // to the end position, and then do a normal `advance_from_miss()`.
         
-        bool hit_at_end = !skip_ctx.hit_is_before_target_pos();
+        hit_at_end = !skip_ctx.hit_is_before_target_pos();
 
         // we are in case (2)
         if (!hit_at_end) {
-          raw_hits.push_back(std::make_pair(read_pos, proj_hits));
+          record_hit(read_pos, proj_hits, has_delta_hit, delta_hits);
         }
 
         int32_t dist_to_target = skip_ctx.compute_safe_skip();
@@ -534,52 +685,20 @@ bool hit_searcher::get_raw_hits_sketch(std::string &read,
 
             // walk until we hit the read end or the position
             // that we wanted to skip to, collecting the 
-            // hits we find along the way.
-            while (skip_ctx.advance_safe()) {
-              if (skip_ctx.query_kmer(qc)) {
-                raw_hits.push_back(
-                    std::make_pair(skip_ctx.read_pos(), skip_ctx.proj_hits()));
-              }
-            }
-            
-            // now we examined the positions in between.
-            // if we were in case (1), jump back to the valid 
-            // hit that we first encountered.  If we were in 
-            // case (2), advance to at least the point right
-            // after the initial jump.
-            if (hit_at_end) {
-              skip_ctx.fast_forward();
-            } else {
-              skip_ctx.advance_to_target_pos_successor();
-              skip_ctx.clear_miss_counter();
+            // hits we find along the way in `safe_query()`.
+            if (skip_ctx.advance_safe()) {
+              state = State::SAFE_QUERY;
+              return;
             }
+            end_safe_walk();
           }
-
-          // if we got here, then either we are done, or we 
-          // reached our target position so we don't
-          // have an expectation of what should come next.
-          skip_ctx.clear_expectation();
-
-          // If we were in case (1)
-          if (hit_at_end) {
-            // set the phits for the skip_ctx so the 
-            // next jump can be properly computed
-            skip_ctx.phits = proj_hits;
-            // add the hit here
-            raw_hits.push_back(std::make_pair(read_pos, proj_hits));
-            // advance as if this was a normal hit
-            skip_ctx.advance_from_hit();
-          } else {
-            // We were in case 2
-            // now advance as if this was a normal miss.
-            skip_ctx.advance_from_miss();
-          }
+          end_unexpected_hit();
       } else {
         // We got a hit and either we had no expectation
         // or the hit was in accordance with our expectation.
         
         // push this hit and advance
-        raw_hits.push_back(std::make_pair(read_pos, proj_hits));
+        record_hit(read_pos, proj_hits, has_delta_hit, delta_hits);
         skip_ctx.advance_from_hit();
       }
     } else {
@@ -587,13 +706,238 @@ bool hit_searcher::get_raw_hits_sketch(std::string &read,
       skip_ctx.advance_from_miss();
     }
   }
+
+  // One step of the walk towards the position we wanted to skip to.
+  inline void safe_query(sshash::streaming_query_canonical_parsing& qc) {
+    if (skip_ctx.query_kmer(qc)) {
+      record_hit(skip_ctx.read_pos(), skip_ctx.proj_hits(),
+                 skip_ctx.has_delta_hit(), skip_ctx.delta_proj_hits());
+    }
+    if (skip_ctx.advance_safe()) { return; }
+    end_safe_walk();
+    end_unexpected_hit();
+    state = State::QUERY;
+  }
+
+  inline void end_safe_walk() {
+    // now we examined the positions in between.
+    // if we were in case (1), jump back to the valid 
+    // hit that we first encountered.  If we were in 
+    // case (2), advance to at least the point right
+    // after the initial jump.
+    if (hit_at_end) {
+      skip_ctx.fast_forward();
+    } else {
+      skip_ctx.advance_to_target_pos_successor();
+      skip_ctx.clear_miss_counter();
+    }
+  }
+
+  inline void end_unexpected_hit() {
+    // if we got here, then either we are done, or we 
+    // reached our target position so we don't
+    // have an expectation of what should come next.
+    skip_ctx.clear_expectation();
+
+    // If we were in case (1)
+    if (hit_at_end) {
+      // set the phits for the skip_ctx so the 
+      // next jump can be properly computed
+      skip_ctx.phits = proj_hits;
+      // add the hit here
+      record_hit(read_pos, proj_hits, has_delta_hit, delta_hits);
+      // advance as if this was a normal hit
+      skip_ctx.advance_from_hit();
+    } else {
+      // We were in case 2
+      // now advance as if this was a normal miss.
+      skip_ctx.advance_from_miss();
+    }
+  }
+
+  SkipContext skip_ctx;
+  std::vector<raw_hit>& raw_hits;
+  State state;
+
+  // the unexpected hit that started the current walk
+  int32_t read_pos{0};
+  search_hit proj_hits;
+  bool has_delta_hit{false};
+  search_hit delta_hits;
+  bool hit_at_end{false};
+};
+
+// This method performs k-mer / hit collection 
+// using a custom implementation of the corresponding 
+// part of the pseudoalignment algorithm as described in (1).
+// Specifically, it attempts to find a small set of 
+// k-mers along the fragment (`read`) that are shared with
+// a set of unitigs in the compacted colored de Bruijn graph, 
+// using the structure of the graph to avoid queries that
+// are unlikely to change the resulting set of unitigs 
+// that are discovered.  This function only fills out the 
+// set of hits, and does not itself implement any 
+// consensus mechanism.  This hit collection mechanism 
+// prioritizes speed compared to e.g. the uniMEM collection
+// strategy implemented in the `operator()` method of this 
+// class.  Currently, this strategy is only used in the 
+// `--sketch` mode of alevin.  One may refer to the 
+// [release notes](https://github.com/COMBINE-lab/salmon/releases/tag/v1.4.0)
+// of the relevant version of salmon and links therein 
+// for a more detailed discussion of the downstream effects of 
+// different strategies.
+//
+// The function fills out the appropriate raw hits 
+// member of this MemCollector instance.  
+// 
+// If the `isLeft` flag is set to true, then the left 
+// raw hits are filled and can be retreived with 
+// `get_left_hits()`.  Otherwise, the right raw hits are 
+// filled and can be retrieved with `get_right_hits()`.
+//
+// This function returns `true` if at least one hit was 
+// found shared between the read and reference and 
+// `false` otherwise.
+// 
+// [1] Bray NL, Pimentel H, Melsted P, Pachter L. 
+// Near-optimal probabilistic RNA-seq quantification. 
+// Nat Biotechnol. 2016;34(5):525-527.
+//
+bool hit_searcher::get_raw_hits_sketch(std::string &read,
+                  sshash::streaming_query_canonical_parsing& qc,
+                  bool isLeft,
+                  bool verbose) {
+  (void) verbose;
+  auto& raw_hits = isLeft ? left_rawHits : right_rawHits;
+
+  CanonicalKmer::k(k);
+  int32_t k = static_cast<int32_t>(CanonicalKmer::k());
+  SkipSearch search(read, pfi_, k, policy_, delta_qc_.get(), raw_hits);
+  while (search.resume(qc)) {}
+  num_lookups_ += search.num_lookups();
+  num_fast_checks_ += search.num_fast_checks();
   
   return raw_hits.size() != 0;
 }
 
 void hit_searcher::clear() {
+  if (delta_qc_) { delta_qc_->start(); }
   left_rawHits.clear();
   right_rawHits.clear();
 }
 
+// The search of one of the reads in flight, along with the state of 
+// the prefetching of the data its pending lookup will read.
+struct batched_hit_searcher::search_slot {
+  enum class Stage : uint8_t { BUCKET = 0, SUPER_KMER, KMERS, LOOKUP };
+
+  explicit search_slot(reference_index* pfi) : qc(pfi->get_dict()) {
+    if (pfi->has_delta()) {
+      delta_qc.reset(
+          new sshash::streaming_query_canonical_parsing(pfi->get_delta()->get_dict()));
+    }
+  }
+
+  void start(std::string& read, reference_index* pfi, int32_t k,
+             const skipping_policy& policy,
+             std::vector<raw_hit>& raw_hits) {
+    qc.start();
+    if (delta_qc) { delta_qc->start(); }
+    search.emplace(read, pfi, k, policy, delta_qc.get(), raw_hits);
+    stage = first_stage();
+  }
+
+  // Lookups that begin with a fast check are not prefetched, as
+  // they usually do not reach the index.
+  Stage first_stage() {
+    return search->pending_fast_check() ? Stage::LOOKUP : Stage::BUCKET;
+  }
+
+  // Carries the search on by one step: either the next stage of the 
+  // prefetching for its pending lookup, or the lookup itself.
+  // Returns false once the read has been searched.
+  bool step(const sshash::dictionary* dict) {
+    switch (stage) {
+      case Stage::BUCKET: {
+        auto& km = search->pending_kmer();
+        bucket_id = dict->prefetch_bucket_canonical(km.fwWord(), km.rcWord(), minimizer);
+        stage = Stage::SUPER_KMER;
+        return true;
+      }
+      case Stage::SUPER_KMER:
+        std::tie(bucket_begin, bucket_end) = dict->prefetch_first_super_kmer(bucket_id);
+        stage = Stage::KMERS;
+        return true;
+      case Stage::KMERS:
+        dict->prefetch_super_kmer(bucket_begin);
+        // hand the located bucket over, so that the lookup does not locate it again
+        qc.set_next_bucket(search->pending_kmer().fwWord(), minimizer, bucket_begin,
+                           bucket_end);
+        stage = Stage::LOOKUP;
+        return true;
+      case Stage::LOOKUP:
+        if (!search->resume(qc)) { return false; }
+        stage = first_stage();
+        return true;
+    }
+    return false;
+  }
+
+  sshash::streaming_query_canonical_parsing qc;
+  std::unique_ptr<sshash::streaming_query_canonical_parsing> delta_qc;
+  std::optional<SkipSearch> search;
+  Stage stage{Stage::BUCKET};
+  uint64_t bucket_id{0};
+  uint64_t minimizer{0};
+  uint64_t bucket_begin{0};
+  uint64_t bucket_end{0};
+};
+
+batched_hit_searcher::batched_hit_searcher(reference_index* pfi, size_t width,
+                                           const skipping_policy& policy) 
+  : pfi_(pfi), k(static_cast<size_t>(pfi->k())), policy_(policy) {
+  width = (width < 1) ? 1 : width;
+  for (size_t i = 0; i < width; ++i) {
+    slots_.emplace_back(new search_slot(pfi_));
+  }
+}
+
+batched_hit_searcher::~batched_hit_searcher() = default;
+
+// Searches the reads round-robin over the slots, each visit to a slot
+// doing one step of its search. The data prefetched by a step has the 
+// time the steps of the other slots take to arrive in cache. A slot 
+// whose read is done takes the next read of the batch.
+void batched_hit_searcher::get_raw_hits_sketch(const std::vector<std::string*>& reads) {
+  CanonicalKmer::k(k);
+  int32_t k = static_cast<int32_t>(CanonicalKmer::k());
+  if (rawHits_.size() < reads.size()) { rawHits_.resize(reads.size()); }
+
+  size_t next_read = 0;
+  // start the search of the next read that has k-mers to look up
+  auto start_next = [&](search_slot& slot) -> bool {
+    while (next_read < reads.size()) {
+      auto& raw_hits = rawHits_[next_read];
+      raw_hits.clear();
+      slot.start(*reads[next_read++], pfi_, k, policy_, raw_hits);
+      if (!slot.search->done()) { return true; }
+    }
+    slot.search.reset();
+    return false;
+  };
+
+  size_t num_active = 0;
+  for (auto& slot : slots_) { 
+    if (start_next(*slot)) { ++num_active; }
+  }
+
+  const sshash::dictionary* dict = pfi_->get_dict();
+  while (num_active > 0) {
+    for (auto& slot : slots_) {
+      if (!slot->search) { continue; }
+      if (!slot->step(dict) and !start_next(*slot)) { --num_active; }
+    }
+  }
+}
+
 }
@@ -3,55 +3,464 @@
 #include "../include/util.hpp"
 #include "../include/mapping/utils.hpp"
 #include "../include/parallel_hashmap/phmap.h"
+#include "../include/FastxParser.hpp"
+#include "../include/CanonicalKmerIterator.hpp"
+#include "../include/json.hpp"
+#include "../include/spdlog/spdlog.h"
+#include "../include/spdlog/sinks/stdout_color_sinks.h"
 
 #include <iostream>
+#include <iomanip>
 #include <vector>
+#include <map>
 #include <numeric>
 #include <cstdio>
+#include <chrono>
 
-std::vector<uint64_t> histogram(mindex::reference_index& ri){
-	const auto& ct = ri.get_contig_table();
-	
-	phmap::flat_hash_map<uint64_t, uint64_t> freq_map;
-
-	auto cit = ct.m_ctg_offsets.at(0);// sshash::ef_sequence<false>::iterator(&ct.m_ctg_offsets, 0);
-	uint64_t max_freq = 0;
-	uint64_t prev = 0;
-	while (cit.has_next()) {
-		auto n = cit.next();
-		auto v = (n-prev);
-		auto& f = freq_map[v];
-		f += 1;
-		if (v > max_freq) { max_freq = v; }
-		prev = n;
-	}
-
-	std::cerr << "max_freq = " << max_freq << "\n";
-	std::vector<uint64_t> freqs(max_freq+1, 0);
-	for (size_t i = 0; i <= max_freq; ++i){
-		freqs[i] = freq_map[i];
-	}
-	return freqs;
-}
+namespace sshash {
 
-int main(int argc, char* argv[]) {
+/*
+    Profiles an index: how its components are shaped, how many bytes a lookup is
+    expected to touch in each of them, and (when given reads) how long a lookup
+    actually spends in each of them.
+*/
+struct index_profiler {
+    index_profiler(mindex::reference_index& ri) : m_ri(ri), m_dict(*ri.get_dict()) {}
+
+    nlohmann::json index_info() const {
+        nlohmann::json j;
+        j["k"] = m_dict.k();
+        j["m"] = m_dict.m();
+        j["canonical_parsing"] = m_dict.canonicalized();
+        j["num_kmers"] = m_dict.size();
+        j["num_minimizers"] = m_dict.m_minimizers.size();
+        j["num_super_kmers"] = m_dict.m_buckets.offsets.size();
+        j["num_contigs"] = m_ri.get_contig_table().num_contigs();
+        j["num_refs"] = m_ri.num_refs();
+
+        auto const& buckets = m_dict.m_buckets;
+        auto const& ct = m_ri.get_contig_table();
+        double n = m_dict.size();
+        j["bits_per_kmer"] = {
+            {"minimizers", m_dict.m_minimizers.num_bits() / n},
+            {"pieces", buckets.pieces.num_bits() / n},
+            {"num_super_kmers_before_bucket", buckets.num_super_kmers_before_bucket.num_bits() / n},
+            {"offsets", 8.0 * buckets.offsets.bytes() / n},
+            {"strings", 8.0 * buckets.strings.bytes() / n},
+            {"skew_index", m_dict.m_skew_index.num_bits() / n},
+            {"contig_table",
+             (8.0 * (ct.m_is_single.bytes() + ct.m_ctg_inline.bytes() + ct.m_ctg_entries.bytes()) +
+              ct.m_ctg_offsets.num_bits()) /
+                 n}};
+        return j;
+    }
+
+    /* Walk all buckets: their size distribution, how they fill the skew index partitions,
+       and the expected cost of a lookup. */
+    nlohmann::json bucket_stats() {
+        auto const& buckets = m_dict.m_buckets;
+        auto const& skew = m_dict.m_skew_index;
+        const uint64_t k = m_dict.k();
+        const uint64_t num_buckets = m_dict.m_minimizers.size();
+
+        // super-k-mers tile the contigs, so one ends where the next one (in string order) starts
+        std::vector<uint64_t> sorted_offsets(buckets.offsets.size());
+        for (uint64_t i = 0; i != sorted_offsets.size(); ++i) {
+            sorted_offsets[i] = buckets.offsets.access(i);
+        }
+        std::sort(sorted_offsets.begin(), sorted_offsets.end());
+
+        std::map<uint64_t, uint64_t> size_hist;
+        std::vector<uint64_t> partition_buckets(skew.positions.size(), 0);
+        uint64_t max_size = 0;
+        uint64_t num_super_kmers = 0;
+        double sk_lines = 0.0;          // cache lines of strings read per super-k-mer
+        double pos_scanned = 0.0;       // super-k-mers scanned by positive lookups (k-mer weighted)
+        double pos_skew_kmers = 0.0;    // k-mers looked up through the skew index
+
+        for (uint64_t bucket_id = 0; bucket_id != num_buckets; ++bucket_id) {
+            auto [begin, end] = buckets.locate_bucket(bucket_id);
+            uint64_t size = end - begin;
+            size_hist[size] += 1;
+            max_size = std::max(max_size, size);
+            num_super_kmers += size;
+
+            uint64_t log2_size = util::ceil_log2_uint32(size);
+            bool in_skew = !skew.empty() and log2_size > skew.min_log2;
+            if (in_skew) {
+                uint64_t partition_id = log2_size - (skew.min_log2 + 1);
+                if (log2_size == skew.log2_max_num_super_kmers_in_bucket or
+                    log2_size > skew.max_log2) {
+                    partition_id = skew.positions.size() - 1;
+                }
+                partition_buckets[partition_id] += 1;
+            }
+
+            for (uint64_t super_kmer_id = begin; super_kmer_id != end; ++super_kmer_id) {
+                uint64_t offset = buckets.offsets.access(super_kmer_id);
+                auto [res, contig_end] = buckets.offset_to_id(offset, k);
+                (void)res;
+                uint64_t next_offset = contig_end - k + 1;
+                auto next = std::upper_bound(sorted_offsets.begin(), sorted_offsets.end(), offset);
+                if (next != sorted_offsets.end()) next_offset = std::min(next_offset, *next);
+                uint64_t num_kmers = next_offset - offset;
+                sk_lines += cache_lines((2 * (num_kmers + k - 1) + 7) / 8);
+                if (in_skew) {
+                    // a forward k-mer is found by the first probe, a backward one by the second
+                    pos_skew_kmers += num_kmers;
+                    pos_scanned += 1.5 * num_kmers;
+                } else {
+                    pos_scanned += static_cast<double>(num_kmers) * (super_kmer_id - begin + 1);
+                }
+            }
+        }
+        m_sk_lines = num_super_kmers ? sk_lines / num_super_kmers : 0.0;
+        m_pos_scanned = pos_scanned / m_dict.size();
+        m_pos_skew_fraction = pos_skew_kmers / m_dict.size();
+
+        nlohmann::json j;
+        nlohmann::json hist = nlohmann::json::array();
+        for (auto const& [size, count] : size_hist) hist.push_back({size, count});
+        j["size_histogram"] = hist;  // [num super-k-mers in bucket, num buckets]
+        j["mean_size"] = static_cast<double>(num_super_kmers) / num_buckets;
+        j["max_size"] = max_size;
+        j["super_kmers_scanned_per_positive_lookup"] = m_pos_scanned;
+
+        nlohmann::json s;
+        s["min_log2"] = skew.min_log2;
+        s["max_log2"] = skew.max_log2;
+        s["partitions"] = nlohmann::json::array();
+        uint64_t lower = 1ULL << skew.min_log2;
+        uint64_t upper = 2 * lower;
+        uint64_t num_kmers_in_skew_index = 0;
+        for (uint64_t partition_id = 0; partition_id != skew.mphfs.size(); ++partition_id) {
+            uint64_t num_kmers = skew.mphfs[partition_id].num_keys();
+            num_kmers_in_skew_index += num_kmers;
+            bool last = partition_id + 1 == skew.mphfs.size();
+            s["partitions"].push_back(
+                {{"bucket_size_lower", lower},
+                 {"bucket_size_upper", last ? max_size : upper},
+                 {"num_buckets", partition_buckets[partition_id]},
+                 {"num_kmers", num_kmers},
+                 {"positions_width", skew.positions[partition_id].width()},
+                 {"mphf_bits_per_kmer",
+                  num_kmers ? static_cast<double>(skew.mphfs[partition_id].num_bits()) / num_kmers
+                            : 0.0},
+                 {"positions_bits_per_kmer",
+                  num_kmers ? 8.0 * skew.positions[partition_id].bytes() / num_kmers : 0.0}});
+            lower = upper;
+            upper = 2 * lower;
+        }
+        s["num_kmers"] = num_kmers_in_skew_index;
+        s["kmer_fraction"] = static_cast<double>(num_kmers_in_skew_index) / m_dict.size();
+        j["skew_index"] = s;
+        return j;
+    }
+
+    /* Lengths (in bases) of the contigs of the dictionary. */
+    nlohmann::json contig_stats() const {
+        auto const& buckets = m_dict.m_buckets;
+        uint64_t num_contigs = buckets.pieces.size() - 1;
+        std::vector<uint64_t> lengths(num_contigs);
+        std::vector<uint64_t> log2_hist;
+        for (uint64_t contig_id = 0; contig_id != num_contigs; ++contig_id) {
+            uint64_t len = buckets.contig_length(contig_id);
+            lengths[contig_id] = len;
+            uint64_t bin = len ? 63 - __builtin_clzll(len) : 0;
+            if (bin >= log2_hist.size()) log2_hist.resize(bin + 1, 0);
+            log2_hist[bin] += 1;
+        }
+        std::sort(lengths.begin(), lengths.end(), std::greater<uint64_t>());
+        uint64_t total = std::accumulate(lengths.begin(), lengths.end(), uint64_t(0));
+        uint64_t n50 = 0;
+        for (uint64_t acc = 0, i = 0; i != lengths.size(); ++i) {
+            acc += lengths[i];
+            if (2 * acc >= total) {
+                n50 = lengths[i];
+                break;
+            }
+        }
+        nlohmann::json j;
+        j["log2_length_histogram"] = log2_hist;  // i-th entry: lengths in [2^i, 2^(i+1))
+        j["min_length"] = lengths.empty() ? 0 : lengths.back();
+        j["max_length"] = lengths.empty() ? 0 : lengths.front();
+        j["mean_length"] = num_contigs ? static_cast<double>(total) / num_contigs : 0.0;
+        j["n50"] = n50;
+        return j;
+    }
+
+    /* Distribution of the number of reference occurrences of the contigs. */
+    nlohmann::json contig_table_stats() {
+        auto const& ct = m_ri.get_contig_table();
+        const uint64_t k = m_dict.k();
+        std::vector<uint64_t> hist;
+        uint64_t num_entries = 0;
+        double lines = 0.0;
+        for (uint64_t contig_id = 0; contig_id != ct.num_contigs(); ++contig_id) {
+            uint64_t occs = ct.num_occurrences(contig_id);
+            if (occs >= hist.size()) hist.resize(occs + 1, 0);
+            hist[occs] += 1;
+            num_entries += occs;
+            // is_single and the inline slot, then the offsets and entries of longer lists
+            double contig_lines = 2.0;
+            if (occs > 1) contig_lines += 3.0 + cache_lines((occs * ct.m_ctg_entries.width() + 7) / 8);
+            lines += contig_lines * (m_dict.m_buckets.contig_length(contig_id) - k + 1);
+        }
+        m_ctab_lines = lines / m_dict.size();
+
+        nlohmann::json j;
+        j["occurrence_histogram"] = hist;  // i-th entry: contigs occurring i times
+        j["num_single"] = hist.size() > 1 ? hist[1] : 0;
+        j["num_entries"] = num_entries;
+        j["entry_bits"] = ct.m_ctg_entries.width();
+        j["ref_len_bits"] = ct.m_ref_len_bits;
+        return j;
+    }
+
+    nlohmann::json ec_table_stats() {
+        auto const& ec = m_ri.get_ec_table();
+        uint64_t num_ecs = ec.m_label_list_offsets.size() - 1;
+        std::vector<uint64_t> hist;
+        for (uint64_t ec_id = 0; ec_id != num_ecs; ++ec_id) {
+            uint64_t card = ec.entries_for_ec(ec_id).size();
+            if (card >= hist.size()) hist.resize(card + 1, 0);
+            hist[card] += 1;
+        }
+        std::vector<uint64_t> tile_hist;
+        for (uint64_t tile_id = 0; tile_id != ec.m_tile_ec_ids.size(); ++tile_id) {
+            uint64_t card = ec.entries_for_tile(tile_id).size();
+            if (card >= tile_hist.size()) tile_hist.resize(card + 1, 0);
+            tile_hist[card] += 1;
+        }
+        nlohmann::json j;
+        j["num_ecs"] = num_ecs;
+        j["cardinality_histogram"] = hist;            // i-th entry: ECs of cardinality i
+        j["contig_cardinality_histogram"] = tile_hist;  // i-th entry: contigs whose EC has i
+        return j;
+    }
 
-	std::ios_base::sync_with_stdio(false);
+    /*
+        Cost model: the bytes (as 64-byte cache lines) that a lookup is expected to touch
+        in each component. A random access costs a line; an Elias-Fano access costs three
+        (the select sample, the upper and the lower bits). A positive lookup is a k-mer
+        of the index drawn uniformly; a negative one is a k-mer whose minimizer is not in
+        the index, which the streaming query rejects on the first k-mer of the bucket.
+        Must be called after bucket_stats() and contig_table_stats().
+    */
+    nlohmann::json expected_bytes() const {
+        constexpr double line = 64.0;
+        const double ef_access = 3.0;
+        nlohmann::json pos = {
+            {"minimizers", line},
+            {"num_super_kmers_before_bucket", ef_access * line},
+            {"skew_index", m_pos_skew_fraction * 1.5 * 2.0 * line},
+            {"offsets", m_pos_scanned * line},
+            {"pieces", m_pos_scanned * ef_access * line},
+            {"strings", m_pos_scanned * m_sk_lines * line},
+            {"contig_table", m_ctab_lines * line}};
+        nlohmann::json neg = {{"minimizers", line},
+                              {"num_super_kmers_before_bucket", ef_access * line},
+                              {"skew_index", 0.0},
+                              {"offsets", line},
+                              {"pieces", ef_access * line},
+                              {"strings", cache_lines((2 * m_dict.k() + 7) / 8) * line},
+                              {"contig_table", 0.0}};
+        for (auto* j : {&pos, &neg}) {
+            double total = 0.0;
+            for (auto const& [key, val] : j->items()) total += val.get<double>();
+            (*j)["total"] = total;
+        }
+        return {{"positive", pos}, {"negative", neg}};
+    }
+
+    /*
+        Replay the k-mers of (up to) `max_reads` reads of `reads_filename`, timing each
+        component on its own over all k-mers, and the streaming query used by the mapper.
+    */
+    nlohmann::json replay(std::string const& reads_filename, uint64_t max_reads) {
+        struct query_kmer {
+            uint64_t fw, rc;
+            int32_t read_pos;
+        };
+        std::vector<query_kmer> kmers;
+        std::vector<uint64_t> read_starts;
+        uint64_t num_reads = 0;
+        {
+            CanonicalKmer::k(m_dict.k());
+            fastx_parser::FastxParser<klibpp::KSeq> rparser({reads_filename}, 1);
+            rparser.start();
+            auto rg = rparser.getReadGroup();
+            pufferfish::CanonicalKmerIterator kit_end;
+            while (num_reads < max_reads and rparser.refill(rg)) {
+                for (auto& record : rg) {
+                    if (num_reads == max_reads) break;
+                    ++num_reads;
+                    read_starts.push_back(kmers.size());
+                    for (pufferfish::CanonicalKmerIterator kit(record.seq); kit != kit_end; ++kit) {
+                        kmers.push_back(
+                            {kit->first.fwWord(), kit->first.rcWord(), kit->second});
+                    }
+                }
+            }
+            rparser.stop();
+        }
+        read_starts.push_back(kmers.size());
+        nlohmann::json j;
+        j["num_reads"] = num_reads;
+        j["num_kmers"] = kmers.size();
+        if (kmers.empty()) return j;
+
+        using clock = std::chrono::steady_clock;
+        auto ns_per = [](clock::time_point start, uint64_t n) {
+            return n ? std::chrono::duration<double, std::nano>(clock::now() - start).count() / n
+                     : 0.0;
+        };
+        uint64_t sink = 0;
+        const uint64_t k = m_dict.k(), m = m_dict.m(), seed = m_dict.seed();
+
+        // the streaming query, as the mapper issues it
+        std::vector<lookup_result> results(kmers.size());
+        auto start = clock::now();
+        {
+            streaming_query_canonical_parsing q(&m_dict);
+            for (uint64_t r = 0; r + 1 < read_starts.size(); ++r) {
+                q.start();
+                for (uint64_t i = read_starts[r]; i != read_starts[r + 1]; ++i) {
+                    results[i] = q.get_contig_pos(kmers[i].fw, kmers[i].rc, kmers[i].read_pos);
+                }
+            }
+        }
+        j["streaming_query_ns"] = ns_per(start, kmers.size());
+
+        std::vector<uint64_t> positives, negatives;
+        for (uint64_t i = 0; i != kmers.size(); ++i) {
+            (results[i].kmer_id != constants::invalid_uint64 ? positives : negatives).push_back(i);
+        }
+        j["num_positive"] = positives.size();
+        j["num_negative"] = negatives.size();
+
+        // the components of a random (non-streaming) lookup, each on its own
+        std::vector<uint64_t> minimizers(kmers.size()), bucket_ids(kmers.size());
+        start = clock::now();
+        for (uint64_t i = 0; i != kmers.size(); ++i) {
+            minimizers[i] = std::min(util::compute_minimizer(kmers[i].fw, k, m, seed),
+                                     util::compute_minimizer(kmers[i].rc, k, m, seed));
+        }
+        double minimizer_ns = ns_per(start, kmers.size());
+        start = clock::now();
+        for (uint64_t i = 0; i != kmers.size(); ++i) {
+            bucket_ids[i] = m_dict.m_minimizers.lookup(minimizers[i]);
+        }
+        double mphf_ns = ns_per(start, kmers.size());
+        start = clock::now();
+        for (uint64_t i = 0; i != kmers.size(); ++i) {
+            auto [begin, end] = m_dict.m_buckets.locate_bucket(bucket_ids[i]);
+            sink += begin + end;
+        }
+        double locate_ns = ns_per(start, kmers.size());
+
+        auto time_lookups = [&](std::vector<uint64_t> const& ids) {
+            auto start = clock::now();
+            for (auto i : ids) sink += m_dict.lookup_uint64_canonical_parsing(kmers[i].fw).kmer_id;
+            return ns_per(start, ids.size());
+        };
+        double positive_ns = time_lookups(positives);
+        double negative_ns = time_lookups(negatives);
+
+        // the contig table (and the EC table), for the positive k-mers
+        auto const& ct = m_ri.get_contig_table();
+        start = clock::now();
+        for (auto i : positives) {
+            for (auto e : ct.contig_entries(results[i].contig_id)) sink += e;
+        }
+        double ctab_ns = ns_per(start, positives.size());
+
+        nlohmann::json c;
+        c["minimizer_computation"] = minimizer_ns;
+        c["minimizers"] = mphf_ns;
+        c["num_super_kmers_before_bucket"] = locate_ns;
+        // what remains of a full lookup: the skew index and the scan of the bucket
+        c["bucket_scan_positive"] = std::max(0.0, positive_ns - minimizer_ns - mphf_ns - locate_ns);
+        c["bucket_scan_negative"] = std::max(0.0, negative_ns - minimizer_ns - mphf_ns - locate_ns);
+        c["contig_table"] = ctab_ns;
+        if (m_ri.has_ec_table()) {
+            auto const& ec = m_ri.get_ec_table();
+            start = clock::now();
+            for (auto i : positives) {
+                for (auto e : ec.entries_for_tile(results[i].contig_id)) sink += e;
+            }
+            c["ec_table"] = ns_per(start, positives.size());
+        }
+        j["lookup_positive_ns"] = positive_ns;
+        j["lookup_negative_ns"] = negative_ns;
+        j["component_ns"] = c;
+        j["checksum"] = sink;  // keeps the timed loops from being optimized away
+        return j;
+    }
+
+private:
+    mindex::reference_index& m_ri;
+    dictionary const& m_dict;
+    double m_sk_lines{0.0};
+    double m_pos_scanned{0.0};
+    double m_pos_skew_fraction{0.0};
+    double m_ctab_lines{0.0};
+
+    /* Expected number of cache lines spanned by `bytes` bytes at a random offset. */
+    static double cache_lines(uint64_t bytes) { return bytes ? 1.0 + (bytes - 1) / 64.0 : 0.0; }
+};
+
+}  // namespace sshash
+
+int main(int argc, char* argv[]) {
+    std::ios_base::sync_with_stdio(false);
     cmd_line_parser::parser parser(argc, argv);
 
     /* mandatory arguments */
-    parser.add("input_filename",
-               "input index prefix.");
+    parser.add("input_filename", "input index prefix.");
+
+    /* optional arguments */
+    parser.add("reads", "Reads (FASTA/FASTQ, possibly gzipped) whose k-mers are replayed to time lookups.",
+               "-r", false);
+    parser.add("num_reads", "Maximum number of reads to replay (default is 100000).", "-n", false);
+    parser.add("output_filename", "Write the profile to this file rather than to stdout.", "-o",
+               false);
     if (!parser.parse()) return 1;
 
-	auto index_prefix = parser.get<std::string>("input_filename");
+    // the profile may go to stdout, so log to stderr
+    spdlog::drop_all();
+    auto logger = spdlog::create<spdlog::sinks::stderr_color_sink_mt>("");
+    logger->set_pattern("%+");
+    spdlog::set_default_logger(logger);
+
+    auto index_prefix = parser.get<std::string>("input_filename");
+    bool has_ec_table = ghc::filesystem::exists(index_prefix + ".ectab");
+
+    mindex::reference_index ri(index_prefix, has_ec_table);
+    sshash::index_profiler profiler(ri);
 
-	mindex::reference_index ri(index_prefix);
+    nlohmann::json profile;
+    profile["index"] = profiler.index_info();
+    profile["buckets"] = profiler.bucket_stats();
+    profile["contigs"] = profiler.contig_stats();
+    profile["contig_table"] = profiler.contig_table_stats();
+    if (ri.has_ec_table()) profile["ec_table"] = profiler.ec_table_stats();
+    profile["expected_bytes_per_lookup"] = profiler.expected_bytes();
+    if (parser.parsed("reads")) {
+        uint64_t num_reads = parser.parsed("num_reads") ? parser.get<uint64_t>("num_reads") : 100000;
+        profile["replay"] = profiler.replay(parser.get<std::string>("reads"), num_reads);
+    }
 
-	auto freqs = histogram(ri);
-	for (size_t i = 0; i < freqs.size(); ++i) {
-		std::cout << freqs[i];
-		if (i != freqs.size()-1) { std::cout << "\t"; }
-	}
-	std::cout << "\n";
+    if (parser.parsed("output_filename")) {
+        auto output_filename = parser.get<std::string>("output_filename");
+        std::ofstream out(output_filename);
+        out << std::setw(4) << profile << std::endl;
+        if (!out.good()) {
+            spdlog::critical("could not write {}", output_filename);
+            return 1;
+        }
+    } else {
+        std::cout << std::setw(4) << profile << std::endl;
+    }
+    return 0;
 }
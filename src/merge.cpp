@@ -0,0 +1,342 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+
+#include "../external/pthash/external/cmd_line_parser/include/parser.hpp"
+#include "../include/dictionary.hpp"
+#include "../include/parallel_hashmap/phmap.h"
+#include "../include/json.hpp"
+#include "../include/spdlog/spdlog.h"
+#include "../include/spdlog/sinks/stdout_color_sinks.h"
+
+using namespace sshash;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  int run_merge(int argc, char** argv);
+#ifdef __cplusplus
+}
+#endif
+
+// defined in build.cpp
+int build_reference_index(const std::string& input_files_basename,
+                          build_configuration const& build_config,
+                          const std::string& output_filename, bool build_ec_table, bool check,
+                          bool bench, const std::string& delta_of);
+
+namespace {
+
+// A maximal run of consecutive k-mers of a delta segment that are either all
+// absent from the base index (a novel piece, which becomes a new segment), or
+// that all occur, consecutively, on the same contig of the base index.
+struct delta_piece {
+  bool novel;
+  // for a novel piece, the id of the new segment, otherwise the base contig
+  uint64_t id;
+  // the base k-mer range [begin, end) covered by the piece on the contig
+  uint32_t begin;
+  uint32_t end;
+  // true if the piece is forward with respect to the base contig
+  bool fw;
+};
+
+// The pieces into which a base contig is cut, given by the k-mer offsets
+// at which they start (the last entry is the number of k-mers of the contig).
+struct split_contig {
+  std::vector<uint32_t> boundaries;
+  uint64_t first_piece_id;
+};
+
+// Segments of the merged input get ids in two disjoint spaces: unsplit base
+// segments keep (a shifted version of) their original id, while every new
+// segment (novel delta pieces and pieces of split base contigs) gets a fresh one.
+inline uint64_t base_segment_id(uint64_t id) { return id << 1; }
+inline uint64_t new_segment_id(uint64_t id) { return (id << 1) | 1; }
+
+void append_tile(std::vector<std::string>& tiles, uint64_t id, bool fw) {
+  tiles.push_back(std::to_string(id) + (fw ? '+' : '-'));
+}
+
+// Append the tiles of the pieces of the split base contig `sc` covering the
+// k-mer range [begin, end), in the given orientation.
+void append_split_tiles(std::vector<std::string>& tiles, const split_contig& sc,
+                        uint32_t begin, uint32_t end, bool fw) {
+  auto& b = sc.boundaries;
+  size_t first = std::lower_bound(b.begin(), b.end(), begin) - b.begin();
+  size_t last = std::lower_bound(b.begin(), b.end(), end) - b.begin();
+  if (fw) {
+    for (size_t i = first; i < last; ++i) { append_tile(tiles, new_segment_id(sc.first_piece_id + i), true); }
+  } else {
+    for (size_t i = last; i > first; --i) { append_tile(tiles, new_segment_id(sc.first_piece_id + i - 1), false); }
+  }
+}
+
+using short_refs_t = std::vector<std::pair<std::string, size_t>>;
+
+short_refs_t read_short_refs(const std::string& input_basename) {
+  short_refs_t short_refs;
+  std::ifstream json_file(input_basename + ".json");
+  if (json_file.good()) {
+    nlohmann::json dbg_info;
+    json_file >> dbg_info;
+    if (dbg_info.contains("short refs")) { short_refs = dbg_info["short refs"].get<short_refs_t>(); }
+  }
+  return short_refs;
+}
+
+}  // namespace
+
+// Write, to `merged_basename`.{cf_seg,cf_seq,json}, the cuttlefish-style
+// input of an index over the references of both the base input and the delta
+// input. The delta segments are cut into the runs of k-mers they share with
+// the contigs of the base `dict` and the runs of novel k-mers; the base
+// contigs are cut at the boundaries of the shared runs. Every k-mer therefore
+// occurs in exactly one segment of the merged input, and the tilings of all
+// references are rewritten in terms of these segments.
+bool write_merged_input(const dictionary& dict, const std::string& base_basename,
+                        const std::string& delta_basename, const std::string& merged_basename) {
+  const uint64_t k = dict.k();
+  std::ofstream seg_out(merged_basename + ".cf_seg");
+  std::ofstream seq_out(merged_basename + ".cf_seq");
+  if (!seg_out.good() or !seq_out.good()) {
+    spdlog::critical("could not open the merged input files {}.* for writing.", merged_basename);
+    return false;
+  }
+
+  uint64_t next_new_id = 0;
+  phmap::flat_hash_map<uint64_t, std::vector<delta_piece>> delta_pieces;
+  phmap::flat_hash_map<uint32_t, split_contig> split_contigs;
+
+  // pass over the delta segments, cutting them into pieces
+  {
+    std::ifstream seg_file(delta_basename + ".cf_seg");
+    uint64_t seg_id;
+    std::string seg;
+    uint64_t num_shared_kmers = 0;
+    uint64_t num_novel_kmers = 0;
+    while (seg_file >> seg_id >> seg) {
+      auto& pieces = delta_pieces[seg_id];
+      if (seg.length() < k) { continue; }
+      uint64_t num_kmers = seg.length() - k + 1;
+      uint64_t run_start = 0;
+      lookup_result prev;
+      for (uint64_t i = 0; i <= num_kmers; ++i) {
+        lookup_result curr;
+        if (i < num_kmers) { curr = dict.lookup_advanced(seg.data() + i, true); }
+        bool prev_found = (i > 0) and (prev.kmer_id != constants::invalid_uint64);
+        bool curr_found = (curr.kmer_id != constants::invalid_uint64);
+        bool extends = false;
+        if (i > 0 and i < num_kmers) {
+          if (prev_found and curr_found) {
+            bool fw = (prev.kmer_orientation == constants::forward_orientation);
+            extends = (curr.contig_id == prev.contig_id) and
+                      (curr.kmer_orientation == prev.kmer_orientation) and
+                      (fw ? (curr.kmer_id_in_contig == prev.kmer_id_in_contig + 1)
+                          : (curr.kmer_id_in_contig + 1 == prev.kmer_id_in_contig));
+          } else {
+            extends = (!prev_found and !curr_found);
+          }
+        }
+        if (i > 0 and !extends) {
+          // close the run [run_start, i)
+          if (prev_found) {
+            bool fw = (prev.kmer_orientation == constants::forward_orientation);
+            uint32_t last_off = prev.kmer_id_in_contig;
+            uint32_t first_off = fw ? last_off - (i - 1 - run_start) : last_off + (i - 1 - run_start);
+            uint32_t begin = std::min(first_off, last_off);
+            uint32_t end = std::max(first_off, last_off) + 1;
+            pieces.push_back({false, prev.contig_id, begin, end, fw});
+            auto& sc = split_contigs[prev.contig_id];
+            sc.boundaries.push_back(begin);
+            sc.boundaries.push_back(end);
+            num_shared_kmers += (i - run_start);
+          } else {
+            uint64_t id = next_new_id++;
+            pieces.push_back({true, id, 0, 0, true});
+            seg_out << new_segment_id(id) << '\t' << seg.substr(run_start, (i - run_start) + k - 1)
+                    << '\n';
+            num_novel_kmers += (i - run_start);
+          }
+          run_start = i;
+        }
+        prev = curr;
+      }
+    }
+    spdlog::info("delta has {} novel k-mers and {} k-mers shared with the base index.",
+                 num_novel_kmers, num_shared_kmers);
+  }
+
+  // pass over the base segments, cutting the contigs shared with the delta
+  phmap::flat_hash_map<uint64_t, uint32_t> split_base_ids;
+  {
+    std::ifstream seg_file(base_basename + ".cf_seg");
+    uint64_t seg_id;
+    std::string seg;
+    uint32_t rank = 0;
+    while (seg_file >> seg_id >> seg) {
+      auto it = split_contigs.find(rank);
+      if (it == split_contigs.end()) {
+        seg_out << base_segment_id(seg_id) << '\t' << seg << '\n';
+      } else {
+        auto& b = it->second.boundaries;
+        b.push_back(0);
+        b.push_back(seg.length() - k + 1);
+        std::sort(b.begin(), b.end());
+        b.erase(std::unique(b.begin(), b.end()), b.end());
+        it->second.first_piece_id = next_new_id;
+        for (size_t i = 0; i + 1 < b.size(); ++i) {
+          seg_out << new_segment_id(next_new_id++) << '\t'
+                  << seg.substr(b[i], (b[i + 1] - b[i]) + k - 1) << '\n';
+        }
+        split_base_ids[seg_id] = rank;
+      }
+      ++rank;
+    }
+    spdlog::info("split {} of the {} base contigs.", split_contigs.size(), rank);
+  }
+  seg_out.close();
+
+  // rewrite the tilings of the base and then of the delta references
+  const std::string refstr = "Reference";
+  auto rewrite_tilings = [&](const std::string& input_basename, bool is_delta) {
+    std::ifstream ifile(input_basename + ".cf_seq");
+    std::vector<std::string> tiles;
+    bool first = true;
+    std::string tok;
+    while (ifile >> tok) {
+      if (tok.compare(0, refstr.length(), refstr) == 0) {
+        if (!first) { seq_out << '\n'; }
+        seq_out << tok << '\t';
+        first = false;
+        continue;
+      }
+      if (tok.front() == 'N') {
+        seq_out << tok << ' ';
+        continue;
+      }
+      bool fw = (tok.back() == '+');
+      tok.pop_back();
+      uint64_t id = std::stoul(tok, nullptr, 10);
+      tiles.clear();
+      if (is_delta) {
+        for (auto& p : delta_pieces[id]) {
+          if (p.novel) {
+            append_tile(tiles, new_segment_id(p.id), true);
+          } else {
+            append_split_tiles(tiles, split_contigs[p.id], p.begin, p.end, p.fw);
+          }
+        }
+      } else {
+        auto it = split_base_ids.find(id);
+        if (it == split_base_ids.end()) {
+          append_tile(tiles, base_segment_id(id), true);
+        } else {
+          auto& sc = split_contigs[it->second];
+          append_split_tiles(tiles, sc, 0, sc.boundaries.back(), true);
+        }
+      }
+      // the tiles are in the forward orientation of the segment
+      if (fw) {
+        for (auto& t : tiles) { seq_out << t << ' '; }
+      } else {
+        for (auto t = tiles.rbegin(); t != tiles.rend(); ++t) {
+          t->back() = (t->back() == '+') ? '-' : '+';
+          seq_out << *t << ' ';
+        }
+      }
+    }
+    if (!first) { seq_out << '\n'; }
+  };
+  rewrite_tilings(base_basename, false);
+  rewrite_tilings(delta_basename, true);
+  seq_out.close();
+
+  // the short references of both inputs
+  short_refs_t short_refs = read_short_refs(base_basename);
+  short_refs_t delta_short_refs = read_short_refs(delta_basename);
+  short_refs.insert(short_refs.end(), delta_short_refs.begin(), delta_short_refs.end());
+  nlohmann::json dbg_info;
+  dbg_info["short refs"] = short_refs;
+  std::ofstream json_out(merged_basename + ".json");
+  json_out << dbg_info.dump();
+  return seq_out.good();
+}
+
+int run_merge(int argc, char** argv) {
+    cmd_line_parser::parser parser(argc, argv);
+
+    /* mandatory arguments */
+    parser.add("base_input_basename",
+               "The basename of the cuttlefish files from which the base index was built.");
+    parser.add("delta_input_basename",
+               "The basename of the cuttlefish files from which the delta was built.");
+
+    /* optional arguments */
+    parser.add("index", "The basename of the base index.", "-i", false);
+    parser.add("output_filename", "Output file name where the merged index will be serialized.",
+               "-o", false);
+    parser.add(
+        "tmp_dirname",
+        "Temporary directory used for the merged input and for construction in external memory. Default is directory '" +
+            constants::default_tmp_dirname + "'.",
+        "-d", false);
+    parser.add("num_threads", "Number of threads to use for construction (default is 1).", "-t",
+               false);
+    parser.add("build_ec_table", "build orientation-aware equivalence class table an include it in the index.",
+               "--build-ec-table", true);
+    parser.add("quiet", "Only write errors or critical messages to the log", "--quiet", true);
+
+    if (!parser.parse()) return 1;
+
+    spdlog::drop_all();
+    auto logger = spdlog::create<spdlog::sinks::stdout_color_sink_mt>("");
+    logger->set_pattern("%+");
+    if (parser.get<bool>("quiet")) { logger->set_level(spdlog::level::warn); }
+    spdlog::set_default_logger(logger);
+
+    if (!parser.parsed("index") or !parser.parsed("output_filename")) {
+        spdlog::critical("both the base index (-i) and the output filename (-o) are required!");
+        return 1;
+    }
+    auto base_input = parser.get<std::string>("base_input_basename");
+    auto delta_input = parser.get<std::string>("delta_input_basename");
+    auto index_basename = parser.get<std::string>("index");
+    auto output_filename = parser.get<std::string>("output_filename");
+
+    build_configuration build_config;
+    if (parser.parsed("tmp_dirname")) {
+        build_config.tmp_dirname = parser.get<std::string>("tmp_dirname");
+        essentials::create_directory(build_config.tmp_dirname);
+    }
+    if (parser.parsed("num_threads")) {
+        build_config.num_threads = std::max(parser.get<uint32_t>("num_threads"), uint32_t(1));
+    }
+
+    std::stringstream merged_basename;
+    merged_basename << build_config.tmp_dirname << "/sshash.tmp.run_"
+                    << pthash::clock_type::now().time_since_epoch().count() << ".merged";
+    {
+        // the merged index uses the same parameters as the base
+        dictionary dict;
+        essentials::load(dict, (index_basename + ".sshash").c_str());
+        build_config.k = dict.k();
+        build_config.m = dict.m();
+        build_config.seed = dict.seed();
+        build_config.canonical_parsing = dict.canonicalized();
+        spdlog::info("writing merged input to {}.*", merged_basename.str());
+        if (!write_merged_input(dict, base_input, delta_input, merged_basename.str())) {
+            return 1;
+        }
+    }
+
+    int ret = build_reference_index(merged_basename.str(), build_config, output_filename,
+                                    parser.get<bool>("build_ec_table"), false, false, "");
+    for (auto suffix : {".cf_seg", ".cf_seq", ".json"}) {
+        std::remove((merged_basename.str() + suffix).c_str());
+    }
+    spdlog::drop_all();
+    return ret;
+}
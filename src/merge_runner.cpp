@@ -0,0 +1,11 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+  int run_merge(int argc, char** argv);
+#ifdef __cplusplus
+}
+#endif
+
+int main(int argc, char** argv) {
+  return run_merge(argc, argv);
+}
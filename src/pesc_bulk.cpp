@@ -1,6 +1,8 @@
 #include "../include/reference_index.hpp"
 #include "../include/util.hpp"
 #include "../include/mapping/utils.hpp"
+#include "../include/mapping/read_cache.hpp"
+#include "../include/mapping/long_read.hpp"
 #include "../include/spdlog/spdlog.h"
 #include "../include/spdlog/sinks/stdout_color_sinks.h"
 #include "../include/rad/rad_writer.hpp"
@@ -15,15 +17,19 @@
 //#include "../src/hit_searcher.cpp"
 
 #include <atomic>
+#include <memory>
 #include <iostream>
 #include <vector>
 #include <numeric>
 #include <cstdio>
 #include <thread>
 #include <sstream>
+#include <type_traits>
 
 using namespace klibpp;
 using mapping::util::mapping_cache_info;
+using mapping::util::read_mapping_cache;
+using mapping::util::long_read_mapper;
 
 // utility class that wraps the information we will
 // need access to when writing output within each thread
@@ -42,30 +48,110 @@ public:
     std::mutex rad_mutex;
     // will record the total number of observed fragments
     std::atomic<size_t> observed_fragments{0};
+    // the number of reads whose hits were not all collected (see --early-exit)
+    std::atomic<uint64_t> num_early_exits{0};
+    // the lookups in the per-thread caches of read mappings (see --read-cache),
+    // and how many found the read
+    std::atomic<uint64_t> num_read_cache_lookups{0};
+    std::atomic<uint64_t> num_read_cache_hits{0};
+    // the reads mapped in windows (see --long-read-window), and their windows
+    std::atomic<uint64_t> num_long_reads{0};
+    std::atomic<uint64_t> num_long_read_windows{0};
 };
 
-void print_header(mindex::reference_index& ri, std::string& cmdline) {
+// also collects the reference names into `ref_names`, so that the SAM records
+// do not decode (and allocate) the name of their reference one at a time
+void print_header(mindex::reference_index& ri, std::string& cmdline,
+                  std::vector<std::string>& ref_names) {
     std::cout << "@HD\tVN:1.0\tSO:unsorted\n";
-    for (uint64_t i = 0; i < ri.num_refs(); ++i) {
-        std::cout << "@SQ\tSN:" << ri.ref_name(i) << "\tLN:" << ri.ref_len(i) << "\n";
-    }
+    ref_names.clear();
+    ref_names.reserve(ri.num_refs());
+    ri.for_each_ref([&ref_names](std::string const& name, uint64_t len) {
+        std::cout << "@SQ\tSN:" << name << "\tLN:" << len << "\n";
+        ref_names.push_back(name);
+    });
     std::cout << "@PG\tID:mindex_map\tPN:mapper\tVN:0.0.1\t"
               << "CL:" << cmdline << "\n";
 }
 
+// the reads of a fragment, in the order in which map_fragment maps them
+void add_reads(fastx_parser::ReadSeq& record, std::vector<std::string*>& reads) {
+    reads.push_back(&record.seq);
+}
+
+void add_reads(fastx_parser::ReadPair& record, std::vector<std::string*>& reads) {
+    reads.push_back(&record.first.seq);
+    reads.push_back(&record.second.seq);
+}
+
+// the raw hits collected by `bhs` for the `read_idx`-th read of the chunk (see
+// add_reads), whose index among the searched reads is search_idx[read_idx]; null if
+// the read was not searched up front
+std::vector<raw_hit>* chunk_hits(mindex::batched_hit_searcher* bhs,
+                                 const std::vector<int64_t>& search_idx, size_t read_idx) {
+    if (!bhs or search_idx[read_idx] < 0) { return nullptr; }
+    return &bhs->get_hits(static_cast<size_t>(search_idx[read_idx]));
+}
+
+// map a read, using its raw hits `raw_hits` (if not null), or take its mapping
+// from `read_cache`; a long read is mapped in windows instead
+bool map_read(std::string* read_seq, std::vector<raw_hit>* raw_hits,
+              mapping_cache_info& map_cache, read_mapping_cache& read_cache,
+              long_read_mapper& long_reads) {
+    if (long_reads.options().applies_to(read_seq->length())) {
+        return long_reads.map(read_seq, map_cache);
+    }
+    // a cached mapping may have been evicted since its read was left out of the
+    // search, then the read is searched here
+    if (raw_hits) {
+        return mapping::util::map_read_cached(read_seq, *raw_hits, map_cache, read_cache);
+    }
+    return mapping::util::map_read_cached(read_seq, map_cache, read_cache);
+}
+
+// collect the raw hits of a read, from `raw_hits` (if not null) or by searching it
+void collect_hits(std::string* read_seq, std::vector<raw_hit>* raw_hits,
+                  mapping_cache_info& map_cache) {
+    if (raw_hits) {
+        mapping::util::collect_hits(*raw_hits, map_cache);
+    } else {
+        mapping::util::collect_hits(read_seq, map_cache);
+    }
+}
+
 // single-end
 bool map_fragment(fastx_parser::ReadSeq& record, mapping_cache_info& map_cache_left,
-                  mapping_cache_info& map_cache_right, mapping_cache_info& map_cache_out) {
+                  mapping_cache_info& map_cache_right, mapping_cache_info& map_cache_out,
+                  read_mapping_cache& read_cache, long_read_mapper& long_reads,
+                  mindex::batched_hit_searcher* bhs, const std::vector<int64_t>& search_idx,
+                  size_t frag_idx, bool joint_pe) {
     (void)map_cache_left;
     (void)map_cache_right;
-    return mapping::util::map_read(&record.seq, map_cache_out, false);
+    (void)joint_pe;
+    return map_read(&record.seq, chunk_hits(bhs, search_idx, frag_idx), map_cache_out,
+                    read_cache, long_reads);
 }
 
 // paried-end
 bool map_fragment(fastx_parser::ReadPair& record, mapping_cache_info& map_cache_left,
-                  mapping_cache_info& map_cache_right, mapping_cache_info& map_cache_out) {
-    bool early_exit_left = mapping::util::map_read(&record.first.seq, map_cache_left, false);
-    bool early_exit_right = mapping::util::map_read(&record.second.seq, map_cache_right, false);
+                  mapping_cache_info& map_cache_right, mapping_cache_info& map_cache_out,
+                  read_mapping_cache& read_cache, long_read_mapper& long_reads,
+                  mindex::batched_hit_searcher* bhs, const std::vector<int64_t>& search_idx,
+                  size_t frag_idx, bool joint_pe) {
+    auto* left_hits = chunk_hits(bhs, search_idx, 2 * frag_idx);
+    auto* right_hits = chunk_hits(bhs, search_idx, 2 * frag_idx + 1);
+    if (joint_pe) {
+        collect_hits(&record.first.seq, left_hits, map_cache_left);
+        collect_hits(&record.second.seq, right_hits, map_cache_right);
+        return mapping::util::map_mates_jointly(&record.first.seq, &record.second.seq,
+                                                map_cache_left, map_cache_right, map_cache_out);
+    }
+
+    // the mapping of a mate does not depend on the other one, so they share the cache
+    bool early_exit_left =
+        map_read(&record.first.seq, left_hits, map_cache_left, read_cache, long_reads);
+    bool early_exit_right =
+        map_read(&record.second.seq, right_hits, map_cache_right, read_cache, long_reads);
 
     int32_t left_len = static_cast<int32_t>(record.first.seq.length());
     int32_t right_len = static_cast<int32_t>(record.second.seq.length());
@@ -88,7 +174,8 @@ bool map_fragment(fastx_parser::ReadPair& record, mapping_cache_info& map_cache_
 // single-end
 inline void write_sam_mappings(mapping_cache_info& map_cache_out, fastx_parser::ReadSeq& record,
                                std::string& workstr_left, std::string& workstr_right,
-                               std::atomic<uint64_t>& global_nhits, std::ostringstream& osstream) {
+                               std::atomic<uint64_t>& global_nhits, std::ostringstream& osstream,
+                               const std::vector<std::string>& ref_names) {
     (void)workstr_right;
     constexpr uint16_t is_secondary = 256;
     constexpr uint16_t is_rc = 16;
@@ -110,7 +197,7 @@ inline void write_sam_mappings(mapping_cache_info& map_cache_out, fastx_parser::
                 sptr = &record.seq;
             }
             osstream << record.name << "\t" << flag << "\t"
-                     << map_cache_out.hs.get_index()->ref_name(ah.tid) << "\t" << ah.pos + 1
+                     << ref_names[ah.tid] << "\t" << ah.pos + 1
                      << "\t255\t*\t*\t0\t" << record.seq.length() << "\t" << *sptr << "\t*\n";
             secondary = true;
         }
@@ -123,7 +210,8 @@ inline void write_sam_mappings(mapping_cache_info& map_cache_out, fastx_parser::
 // paired-end
 inline void write_sam_mappings(mapping_cache_info& map_cache_out, fastx_parser::ReadPair& record,
                                std::string& workstr_left, std::string& workstr_right,
-                               std::atomic<uint64_t>& global_nhits, std::ostringstream& osstream) {
+                               std::atomic<uint64_t>& global_nhits, std::ostringstream& osstream,
+                               const std::vector<std::string>& ref_names) {
     (void)workstr_right;
     constexpr uint16_t is_secondary = 256;
     constexpr uint16_t is_rc = 16;
@@ -259,7 +347,7 @@ inline void write_sam_mappings(mapping_cache_info& map_cache_out, fastx_parser::
                 }
             };
 
-            const auto ref_name = map_cache_out.hs.get_index()->ref_name(ah.tid);
+            const char* ref_name = ref_names[ah.tid].c_str();
             const int32_t ref_len =
                 static_cast<int32_t>(map_cache_out.hs.get_index()->ref_len(ah.tid));
 
@@ -300,7 +388,11 @@ std::string& get_name(fastx_parser::ReadPair& rs) { return rs.first.name; }
 template <typename FragT>
 void do_map(mindex::reference_index& ri, fastx_parser::FastxParser<FragT>& parser,
             std::atomic<uint64_t>& global_nr, std::atomic<uint64_t>& global_nhits,
-            mapping_output_info& out_info, std::mutex& iomut) {
+            mapping_output_info& out_info, std::mutex& iomut, size_t interleave,
+            const mindex::skipping_policy& skipping, const mapping::util::occ_thresholds& occs,
+            uint32_t early_exit_hits, bool joint_pe, size_t read_cache_slots,
+            size_t kmer_cache_entries, bool pseudoalign,
+            const mapping::util::long_read_options& long_read_opts) {
     auto log_level = spdlog::get_level();
     auto write_mapping_rate = false;
     switch (log_level) {
@@ -333,6 +425,23 @@ void do_map(mindex::reference_index& ri, fastx_parser::FastxParser<FragT>& parse
     mapping_cache_info map_cache_left(ri);
     mapping_cache_info map_cache_right(ri);
     mapping_cache_info map_cache_out(ri);
+    map_cache_left.hs.set_skipping_policy(skipping);
+    map_cache_right.hs.set_skipping_policy(skipping);
+    map_cache_out.hs.set_skipping_policy(skipping);
+    map_cache_left.occs = occs;
+    map_cache_right.occs = occs;
+    map_cache_out.occs = occs;
+    map_cache_left.early_exit_hits = early_exit_hits;
+    map_cache_right.early_exit_hits = early_exit_hits;
+    map_cache_out.early_exit_hits = early_exit_hits;
+    map_cache_left.q.enable_kmer_cache(kmer_cache_entries);
+    map_cache_right.q.enable_kmer_cache(kmer_cache_entries);
+    map_cache_out.q.enable_kmer_cache(kmer_cache_entries);
+    map_cache_left.pseudoalign = pseudoalign;
+    map_cache_right.pseudoalign = pseudoalign;
+    map_cache_out.pseudoalign = pseudoalign;
+    read_mapping_cache read_cache(read_cache_slots);
+    long_read_mapper long_reads(long_read_opts);
 
     rad_writer rad_w;
     size_t max_chunk_reads = 5000;
@@ -343,8 +452,16 @@ void do_map(mindex::reference_index& ri, fastx_parser::FastxParser<FragT>& parse
     rad_w << num_reads_in_chunk;
     rad_w << num_reads_in_chunk;
 
-    sshash::streaming_query_canonical_parsing q(ri.get_dict());
-    mindex::hit_searcher hs(&ri);
+    // if more than one read is searched at once, the raw hits of each
+    // chunk of reads are collected up front, interleaving their searches
+    std::unique_ptr<mindex::batched_hit_searcher> bhs;
+    if (interleave > 1) { bhs.reset(new mindex::batched_hit_searcher(&ri, interleave, skipping)); }
+    std::vector<std::string*> chunk_seqs;
+    std::vector<std::string*> chunk_reads;
+    std::vector<int64_t> chunk_search_idx;
+    // the reads whose mapping is cached are not searched, but mates mapped jointly
+    // do not use the read cache
+    bool skip_cached = !(joint_pe and std::is_same<FragT, fastx_parser::ReadPair>::value);
     uint64_t read_num = 0;
     // SAM output
     //uint64_t processed = 0;
@@ -363,6 +480,25 @@ void do_map(mindex::reference_index& ri, fastx_parser::FastxParser<FragT>& parse
     while (parser.refill(rg)) {
         // Here, rg will contain a chunk of read pairs
         // we can process.
+        if (bhs) {
+            chunk_seqs.clear();
+            chunk_reads.clear();
+            chunk_search_idx.clear();
+            for (auto& record : rg) { add_reads(record, chunk_seqs); }
+            for (auto* r : chunk_seqs) {
+                // long reads are mapped in windows, and cached reads take their mapping
+                // from the cache, so there is nothing to search for them
+                if (long_read_opts.applies_to(r->length()) or
+                    (skip_cached and read_cache.contains(*r))) {
+                    chunk_search_idx.push_back(-1);
+                    continue;
+                }
+                chunk_search_idx.push_back(static_cast<int64_t>(chunk_reads.size()));
+                chunk_reads.push_back(r);
+            }
+            bhs->get_raw_hits_sketch(chunk_reads);
+        }
+        size_t frag_idx = 0;
         for (auto& record : rg) {
             ++global_nr;
             ++read_num;
@@ -379,7 +515,8 @@ void do_map(mindex::reference_index& ri, fastx_parser::FastxParser<FragT>& parse
             // If record is single-end, just map that read, otherwise, map both and look
             // for proper pairs.
             bool had_early_stop =
-                map_fragment(record, map_cache_left, map_cache_right, map_cache_out);
+                map_fragment(record, map_cache_left, map_cache_right, map_cache_out, read_cache,
+                             long_reads, bhs.get(), chunk_search_idx, frag_idx++, joint_pe);
             (void)had_early_stop;
 
             // to write unmapped names
@@ -416,7 +553,7 @@ void do_map(mindex::reference_index& ri, fastx_parser::FastxParser<FragT>& parse
             // SAM output
             /*
             write_sam_mappings(map_cache_out, record, workstr_left, workstr_right, global_nhits,
-                               osstream);
+                               osstream, ref_names);
 
             if (processed >= buff_size) {
                 std::string o = osstream.str();
@@ -443,6 +580,12 @@ void do_map(mindex::reference_index& ri, fastx_parser::FastxParser<FragT>& parse
         rad_w.clear();
         num_reads_in_chunk = 0;
     }
+    out_info.num_early_exits += map_cache_left.num_early_exits +
+                                map_cache_right.num_early_exits + map_cache_out.num_early_exits;
+    out_info.num_read_cache_lookups += read_cache.num_lookups();
+    out_info.num_read_cache_hits += read_cache.num_hits();
+    out_info.num_long_reads += long_reads.num_reads();
+    out_info.num_long_read_windows += long_reads.num_windows();
 
     // SAM output
     // dump any remaining output
@@ -477,6 +620,16 @@ int run_pesc_bulk(int argc, char** argv) {
     std::vector<std::string> single_read_filenames;
     std::string output_stem;
     size_t nthread{16};
+    size_t interleave{1};
+    mindex::SkippingStrategy skipping_strategy{mindex::SkippingStrategy::PASC};
+    mapping::util::occ_thresholds occs;
+    bool calibrate_occs{false};
+    uint32_t early_exit_hits{0};
+    bool joint_pe{false};
+    size_t read_cache_slots{0};
+    size_t kmer_cache_entries{0};
+    bool pseudoalign{false};
+    mapping::util::long_read_options long_read_opts;
     bool quiet{false};
 
     CLI::App app{"Mapper"};
@@ -507,6 +660,69 @@ int run_pesc_bulk(int argc, char** argv) {
     app.add_option("-t,--threads", nthread,
                    "An integer that specifies the number of threads to use")
         ->default_val(16);
+    app.add_option("--interleave", interleave,
+                   "the number of reads whose k-mer lookups each thread interleaves, "
+                   "prefetching the index data of one while working on the others "
+                   "(1 = map one read at a time)")
+        ->default_val(1);
+    app.add_option("--skipping", skipping_strategy,
+                   "how the hit search skips along reads between k-mer lookups: exhaustive, "
+                   "pasc, aggressive, adaptive or sampled")
+        ->transform(CLI::CheckedTransformer(mindex::skipping_strategy_names(), CLI::ignore_case))
+        ->default_val("pasc");
+    auto max_hit_occ_opt =
+        app.add_option("--max-hit-occ", occs.max_occ_default,
+                       "hits whose k-mer occurs this many times or more in the index are skipped")
+            ->check(CLI::PositiveNumber)
+            ->default_val(200);
+    auto max_hit_occ_recover_opt =
+        app.add_option("--max-hit-occ-recover", occs.max_occ_recover,
+                       "if every hit of a read is skipped, the least frequent are used if they "
+                       "occur fewer times than this (a value <= --max-hit-occ disables this)")
+            ->default_val(1000);
+    auto max_read_occ_opt =
+        app.add_option("--max-read-occ", occs.max_read_occ,
+                       "reads with more mappings than this are left unmapped")
+            ->default_val(2500);
+    app.add_flag("--calibrate-occ", calibrate_occs,
+                 "derive the three thresholds above from how often the k-mers of the index "
+                 "occur, raising them for highly redundant indices")
+        ->excludes(max_hit_occ_opt, max_hit_occ_recover_opt, max_read_occ_opt);
+    app.add_option("--early-exit", early_exit_hits,
+                   "approximate mapping: once a single target, in a single orientation, is "
+                   "consistent with this many hits of a read, accept it without checking the "
+                   "remaining hits, which could have left the read unmapped (0 = exact, check "
+                   "every hit)")
+        ->default_val(0);
+    app.add_flag("--joint-pe", joint_pe,
+                 "map the mates of a pair jointly: map first the mate whose k-mers are the "
+                 "least repetitive, and only consider its targets for the other mate")
+        ->needs(paired_left_opt);
+    app.add_option("--read-cache", read_cache_slots,
+                   "cache the mappings of up to this many distinct read sequences per thread, "
+                   "so that duplicate reads are mapped once (0 = no cache; not used for the "
+                   "pairs mapped with --joint-pe)")
+        ->default_val(0);
+    app.add_option("--kmer-cache", kmer_cache_entries,
+                   "cache the index lookups of up to this many k-mers per thread, so that the "
+                   "k-mers of highly expressed targets are looked up once (0 = no cache; not "
+                   "used with --interleave)")
+        ->default_val(0);
+    app.add_flag("--pseudoalign", pseudoalign,
+                 "assign each read to the targets shared by the contigs of all its hits "
+                 "(using the equivalence class table, if the index has one), rather than "
+                 "chaining the hits; the mappings have no positions");
+    auto long_read_window_opt =
+        app.add_option("--long-read-window", long_read_opts.window_len,
+                       "map the reads longer than this in overlapping windows of this length, "
+                       "merging the mappings of the windows that agree (0 = map every read "
+                       "whole; the read cache is not used for the reads mapped in windows)")
+            ->excludes(paired_left_opt)
+            ->default_val(0);
+    app.add_option("--long-read-overlap", long_read_opts.window_overlap,
+                   "the number of bases shared by consecutive windows of a long read")
+        ->needs(long_read_window_opt)
+        ->default_val(100);
     app.add_flag("--quiet", quiet, "try to be quiet in terms of console output");
 
     CLI11_PARSE(app, argc, argv);
@@ -523,8 +739,6 @@ int run_pesc_bulk(int argc, char** argv) {
     // start the timer
     auto start_t = std::chrono::high_resolution_clock::now();
 
-    mindex::reference_index ri(input_filename);
-
     bool is_paired = read_opt->empty();
 
     std::string cmdline;
@@ -534,7 +748,8 @@ int run_pesc_bulk(int argc, char** argv) {
         cmdline.push_back(' ');
     }
     cmdline.pop_back();
-    // print_header(ri, cmdline);
+    // std::vector<std::string> ref_names;
+    // print_header(ri, cmdline, ref_names);
 
     ghc::filesystem::path rad_file_path = output_stem + ".rad";
 
@@ -544,6 +759,52 @@ int run_pesc_bulk(int argc, char** argv) {
         throw std::runtime_error("error creating output file.");
     }
 
+    // start parsing (and decompressing) the reads while the index loads
+    uint32_t np = 1;
+    std::unique_ptr<fastx_parser::FastxParser<fastx_parser::ReadPair>> pe_parser;
+    std::unique_ptr<fastx_parser::FastxParser<fastx_parser::ReadSeq>> se_parser;
+    if (is_paired) {
+        if ((left_read_filenames.size() > 1) and (nthread >= 6)) {
+            np += 1;
+            nthread -= 1;
+        }
+        pe_parser.reset(new fastx_parser::FastxParser<fastx_parser::ReadPair>(
+            left_read_filenames, right_read_filenames, nthread, np));
+        pe_parser->start();
+    } else {
+        if ((single_read_filenames.size() > 1) and (nthread >= 6)) {
+            np += 1;
+            nthread -= 1;
+        }
+        se_parser.reset(
+            new fastx_parser::FastxParser<fastx_parser::ReadSeq>(single_read_filenames, nthread, np));
+        se_parser->start();
+    }
+    // the parser threads only exit once the reads are consumed, so if the mapping can not
+    // start the remaining reads are drained
+    auto stop_parser = [&pe_parser, &se_parser]() {
+        if (pe_parser) { mapping::util::drain_and_stop(*pe_parser); }
+        if (se_parser) { mapping::util::drain_and_stop(*se_parser); }
+    };
+
+    // pseudoalignment uses the ec map if it was built, and the contig table otherwise
+    bool attempt_load_ec_map =
+        pseudoalign and ghc::filesystem::exists(input_filename + ".ectab");
+    std::unique_ptr<mindex::reference_index> ri_ptr;
+    try {
+        ri_ptr.reset(new mindex::reference_index(input_filename, attempt_load_ec_map));
+    } catch (...) {
+        stop_parser();
+        throw;
+    }
+    auto& ri = *ri_ptr;
+
+    if (long_read_opts.enabled() and long_read_opts.window_len <= ri.k()) {
+        spdlog::critical("--long-read-window must be larger than k ({})", ri.k());
+        stop_parser();
+        return 1;
+    }
+
     mapping_output_info out_info;
     out_info.rad_file = std::move(rad_file);
     size_t chunk_offset = rad::util::write_rad_header_bulk(ri, is_paired, out_info.rad_file);
@@ -552,47 +813,47 @@ int run_pesc_bulk(int argc, char** argv) {
 
     // set the canonical k-mer size globally
     CanonicalKmer::k(ri.k());
+
     std::atomic<uint64_t> global_nr{0};
     std::atomic<uint64_t> global_nh{0};
-    uint32_t np = 1;
+
+    mindex::skipping_policy skipping(skipping_strategy);
+    if (calibrate_occs) {
+        occs = mapping::util::calibrate_occ_thresholds(ri);
+        spdlog::info("occurrence thresholds: --max-hit-occ {} --max-hit-occ-recover {} "
+                     "--max-read-occ {}",
+                     occs.max_occ_default, occs.max_occ_recover, occs.max_read_occ);
+    }
 
     // if we have paired-end data
-    if (read_opt->empty()) {
+    if (is_paired) {
         std::vector<std::thread> workers;
-        if ((left_read_filenames.size() > 1) and (nthread >= 6)) {
-            np += 1;
-            nthread -= 1;
-        }
-
-        fastx_parser::FastxParser<fastx_parser::ReadPair> rparser(
-            left_read_filenames, right_read_filenames, nthread, np);
-        rparser.start();
-
+        auto& rparser = *pe_parser;
         for (size_t i = 0; i < nthread; ++i) {
-            workers.push_back(
-                std::thread([&ri, &rparser, &global_nr, &global_nh, &out_info, &iomut]() {
-                    do_map(ri, rparser, global_nr, global_nh, out_info, iomut);
-                }));
+            workers.push_back(std::thread([&ri, &rparser, &global_nr, &global_nh, &out_info,
+                                           &iomut, interleave, &skipping, &occs,
+                                           early_exit_hits, joint_pe, read_cache_slots,
+                                           kmer_cache_entries, pseudoalign, &long_read_opts]() {
+                do_map(ri, rparser, global_nr, global_nh, out_info, iomut, interleave, skipping,
+                       occs, early_exit_hits, joint_pe, read_cache_slots, kmer_cache_entries,
+                       pseudoalign, long_read_opts);
+            }));
         }
 
         for (auto& w : workers) { w.join(); }
         rparser.stop();
     } else {  // single-end
         std::vector<std::thread> workers;
-        if ((single_read_filenames.size() > 1) and (nthread >= 6)) {
-            np += 1;
-            nthread -= 1;
-        }
-
-        fastx_parser::FastxParser<fastx_parser::ReadSeq> rparser(single_read_filenames, nthread,
-                                                                 np);
-        rparser.start();
-
+        auto& rparser = *se_parser;
         for (size_t i = 0; i < nthread; ++i) {
-            workers.push_back(
-                std::thread([&ri, &rparser, &global_nr, &global_nh, &out_info, &iomut]() {
-                    do_map(ri, rparser, global_nr, global_nh, out_info, iomut);
-                }));
+            workers.push_back(std::thread([&ri, &rparser, &global_nr, &global_nh, &out_info,
+                                           &iomut, interleave, &skipping, &occs,
+                                           early_exit_hits, joint_pe, read_cache_slots,
+                                           kmer_cache_entries, pseudoalign, &long_read_opts]() {
+                do_map(ri, rparser, global_nr, global_nh, out_info, iomut, interleave, skipping,
+                       occs, early_exit_hits, joint_pe, read_cache_slots, kmer_cache_entries,
+                       pseudoalign, long_read_opts);
+            }));
         }
 
         for (auto& w : workers) { w.join(); }
@@ -632,7 +893,14 @@ int run_pesc_bulk(int argc, char** argv) {
     rs.cmd_line(cmdline);
     rs.num_reads(global_nr.load());
     rs.num_hits(global_nh.load());
+    rs.num_early_exits(out_info.num_early_exits.load());
+    rs.read_cache_stats(out_info.num_read_cache_lookups.load(),
+                        out_info.num_read_cache_hits.load());
+    if (long_read_opts.enabled()) {
+        rs.long_read_stats(out_info.num_long_reads.load(), out_info.num_long_read_windows.load());
+    }
     rs.num_seconds(num_sec.count());
+    rs.index_load_seconds(ri.load_seconds());
 
     ghc::filesystem::path map_info_file_path = output_stem + ".map_info.json";
     bool info_ok = piscem::meta_info::write_map_info(rs, map_info_file_path);
@@ -6,6 +6,8 @@
 #include "../include/projected_hits.hpp"
 #include "../include/util.hpp"
 #include "../include/mapping/utils.hpp"
+#include "../include/mapping/read_cache.hpp"
+#include "../include/mapping/read_masker.hpp"
 #include "../include/parallel_hashmap/phmap.h"
 #include "../include/FastxParser.hpp"
 #include "../include/rad/rad_writer.hpp"
@@ -24,6 +26,7 @@
 
 #include <atomic>
 #include <chrono>
+#include <deque>
 #include <iostream>
 #include <vector>
 #include <memory>
@@ -52,6 +55,15 @@ struct pesc_options {
     bool check_ambig_hits{false};
     uint32_t max_ec_card{256};
     size_t nthread{16};
+    size_t interleave{1};
+    mindex::SkippingStrategy skipping_strategy{mindex::SkippingStrategy::PASC};
+    mapping::util::occ_thresholds occs;
+    bool calibrate_occs{false};
+    uint32_t early_exit_hits{0};
+    size_t read_cache_slots{0};
+    size_t kmer_cache_entries{0};
+    bool pseudoalign{false};
+    mapping::util::read_mask_options mask_opts;
 };
 
 // utility class that wraps the information we will
@@ -77,6 +89,17 @@ public:
     // the mutex for safely writing to
     // unmapped_bc_file
     std::mutex unmapped_bc_mutex;
+    // the number of reads whose hits were not all collected (see --early-exit)
+    std::atomic<uint64_t> num_early_exits{0};
+    // the lookups in the per-thread caches of read mappings (see --read-cache),
+    // and how many found the read
+    std::atomic<uint64_t> num_read_cache_lookups{0};
+    std::atomic<uint64_t> num_read_cache_hits{0};
+    // the reads and bases masked before the hit search (see --mask-*)
+    std::atomic<uint64_t> num_reads_masked{0};
+    std::atomic<uint64_t> num_polya_bases_masked{0};
+    std::atomic<uint64_t> num_motif_bases_masked{0};
+    std::atomic<uint64_t> num_homopolymer_bases_masked{0};
 };
 
 template <typename Protocol>
@@ -117,6 +140,14 @@ void do_map(mindex::reference_index& ri, fastx_parser::FastxParser<fastx_parser:
 
     mapping::util::mapping_cache_info map_cache(ri);
     map_cache.max_ec_card = po.max_ec_card;
+    map_cache.occs = po.occs;
+    map_cache.early_exit_hits = po.early_exit_hits;
+    mindex::skipping_policy skipping(po.skipping_strategy);
+    map_cache.hs.set_skipping_policy(skipping);
+    map_cache.q.enable_kmer_cache(po.kmer_cache_entries);
+    map_cache.pseudoalign = po.pseudoalign;
+    mapping::util::read_mapping_cache read_cache(po.read_cache_slots);
+    mapping::util::read_masker masker(po.mask_opts);
 
     size_t max_chunk_reads = 5000;
     // Get the read group by which this thread will
@@ -132,9 +163,56 @@ void do_map(mindex::reference_index& ri, fastx_parser::FastxParser<fastx_parser:
     rad_w << num_reads_in_chunk;
     rad_w << num_reads_in_chunk;
 
+    // writes the mapping of a read to the RAD chunk, dumping the chunk when full
+    auto write_mapping = [&](bc_kmer_t& bc_kmer, umi_kmer_t& umi_kmer) {
+        global_nhits += map_cache.accepted_hits.empty() ? 0 : 1;
+        rad::util::write_to_rad_stream(bc_kmer, umi_kmer, map_cache.map_type,
+                                       map_cache.accepted_hits, map_cache.unmapped_bc_map,
+                                       num_reads_in_chunk, rad_w);
+
+        // dump buffer
+        if (num_reads_in_chunk > max_chunk_reads) {
+            out_info.num_chunks++;
+            uint32_t num_bytes = rad_w.num_bytes();
+            rad_w.write_integer_at_offset(0, num_bytes);
+            rad_w.write_integer_at_offset(sizeof(num_bytes), num_reads_in_chunk);
+            out_info.rad_mutex.lock();
+            out_info.rad_file << rad_w;
+            out_info.rad_mutex.unlock();
+            rad_w.clear();
+            num_reads_in_chunk = 0;
+
+            // reserve space for headers of next chunk
+            rad_w << num_reads_in_chunk;
+            rad_w << num_reads_in_chunk;
+        }
+    };
+
+    // if more than one read is searched at once, the reads of a chunk that
+    // have a valid barcode and UMI are set aside (the mappable read may live in
+    // a buffer of the protocol, so it is copied), and mapped once the raw hits
+    // of all of them have been collected, interleaving their searches; the
+    // reads whose mapping is cached are not searched (chunk_search_idx < 0)
+    std::unique_ptr<mindex::batched_hit_searcher> bhs;
+    if (po.interleave > 1) {
+        bhs.reset(new mindex::batched_hit_searcher(&ri, po.interleave, skipping));
+    }
+    std::vector<std::pair<bc_kmer_t, umi_kmer_t>> chunk_tags;
+    // the reads of the chunk are held by pointer; only those that the protocol
+    // assembles in its own (reused) buffer are copied, into a deque so that
+    // the pointers to the earlier copies stay valid
+    std::vector<std::string*> chunk_seqs;
+    std::deque<std::string> chunk_copies;
+    size_t num_chunk_copies = 0;
+    std::vector<std::string*> chunk_reads;
+    std::vector<int64_t> chunk_search_idx;
+
     while (parser.refill(rg)) {
         // Here, rg will contain a chunk of read pairs
         // we can process.
+        chunk_tags.clear();
+        chunk_seqs.clear();
+        num_chunk_copies = 0;
         for (auto& record : rg) {
             ++global_nr;
             auto rctr = global_nr.load();
@@ -179,34 +257,49 @@ void do_map(mindex::reference_index& ri, fastx_parser::FastxParser<fastx_parser:
             // alt_max_occ = 0;
             std::string* read_seq =
                 protocol.extract_mappable_read(record.first.seq, record.second.seq);
+            masker.mask(*read_seq);
+
+            if (bhs) {
+                if (read_seq != &record.first.seq and read_seq != &record.second.seq) {
+                    if (chunk_copies.size() <= num_chunk_copies) { chunk_copies.emplace_back(); }
+                    chunk_copies[num_chunk_copies].assign(*read_seq);
+                    read_seq = &chunk_copies[num_chunk_copies++];
+                }
+                chunk_seqs.push_back(read_seq);
+                chunk_tags.emplace_back(bc_kmer, umi_kmer);
+                continue;
+            }
 
-            bool had_early_stop = mapping::util::map_read(read_seq, map_cache);
+            bool had_early_stop = mapping::util::map_read_cached(read_seq, map_cache, read_cache);
             (void)had_early_stop;
+            write_mapping(bc_kmer, umi_kmer);
+        }
 
-            global_nhits += map_cache.accepted_hits.empty() ? 0 : 1;
-            rad::util::write_to_rad_stream(bc_kmer, umi_kmer, map_cache.map_type,
-                                           map_cache.accepted_hits, map_cache.unmapped_bc_map,
-                                           num_reads_in_chunk, rad_w);
-
-            // dump buffer
-            if (num_reads_in_chunk > max_chunk_reads) {
-                out_info.num_chunks++;
-                uint32_t num_bytes = rad_w.num_bytes();
-                rad_w.write_integer_at_offset(0, num_bytes);
-                rad_w.write_integer_at_offset(sizeof(num_bytes), num_reads_in_chunk);
-                out_info.rad_mutex.lock();
-                out_info.rad_file << rad_w;
-                out_info.rad_mutex.unlock();
-                rad_w.clear();
-                num_reads_in_chunk = 0;
-
-                // reserve space for headers of next chunk
-                rad_w << num_reads_in_chunk;
-                rad_w << num_reads_in_chunk;
+        if (bhs and !chunk_tags.empty()) {
+            chunk_reads.clear();
+            chunk_search_idx.clear();
+            for (size_t i = 0; i < chunk_tags.size(); ++i) {
+                if (read_cache.contains(*chunk_seqs[i])) {
+                    chunk_search_idx.push_back(-1);
+                    continue;
+                }
+                chunk_search_idx.push_back(static_cast<int64_t>(chunk_reads.size()));
+                chunk_reads.push_back(chunk_seqs[i]);
+            }
+            bhs->get_raw_hits_sketch(chunk_reads);
+            for (size_t i = 0; i < chunk_tags.size(); ++i) {
+                // a cached mapping may have been evicted since, then the read is searched
+                bool had_early_stop =
+                    (chunk_search_idx[i] < 0)
+                        ? mapping::util::map_read_cached(chunk_seqs[i], map_cache, read_cache)
+                        : mapping::util::map_read_cached(
+                              chunk_seqs[i], bhs->get_hits(chunk_search_idx[i]), map_cache,
+                              read_cache);
+                (void)had_early_stop;
+                write_mapping(chunk_tags[i].first, chunk_tags[i].second);
             }
         }
     }
-
     // dump any remaining output
     if (num_reads_in_chunk > 0) {
         out_info.num_chunks++;
@@ -219,6 +312,13 @@ void do_map(mindex::reference_index& ri, fastx_parser::FastxParser<fastx_parser:
         rad_w.clear();
         num_reads_in_chunk = 0;
     }
+    out_info.num_early_exits += map_cache.num_early_exits;
+    out_info.num_read_cache_lookups += read_cache.num_lookups();
+    out_info.num_read_cache_hits += read_cache.num_hits();
+    out_info.num_reads_masked += masker.stats().num_reads_masked;
+    out_info.num_polya_bases_masked += masker.stats().num_polya_bases;
+    out_info.num_motif_bases_masked += masker.stats().num_motif_bases;
+    out_info.num_homopolymer_bases_masked += masker.stats().num_homopolymer_bases;
 
     // unmapped barcode writer
     {  // make a scope and dump the unmapped barcode counts
@@ -289,6 +389,72 @@ int run_pesc_sc(int argc, char** argv) {
     app.add_option("-t,--threads", po.nthread,
                    "An integer that specifies the number of threads to use")
         ->default_val(16);
+    app.add_option("--interleave", po.interleave,
+                   "the number of reads whose k-mer lookups each thread interleaves, "
+                   "prefetching the index data of one while working on the others "
+                   "(1 = map one read at a time)")
+        ->default_val(1);
+    app.add_option("--skipping", po.skipping_strategy,
+                   "how the hit search skips along reads between k-mer lookups: exhaustive, "
+                   "pasc, aggressive, adaptive or sampled")
+        ->transform(CLI::CheckedTransformer(mindex::skipping_strategy_names(), CLI::ignore_case))
+        ->default_val("pasc");
+    auto max_hit_occ_opt =
+        app.add_option("--max-hit-occ", po.occs.max_occ_default,
+                       "hits whose k-mer occurs this many times or more in the index are skipped")
+            ->check(CLI::PositiveNumber)
+            ->default_val(200);
+    auto max_hit_occ_recover_opt =
+        app.add_option("--max-hit-occ-recover", po.occs.max_occ_recover,
+                       "if every hit of a read is skipped, the least frequent are used if they "
+                       "occur fewer times than this (a value <= --max-hit-occ disables this)")
+            ->default_val(1000);
+    auto max_read_occ_opt =
+        app.add_option("--max-read-occ", po.occs.max_read_occ,
+                       "reads with more mappings than this are left unmapped")
+            ->default_val(2500);
+    app.add_flag("--calibrate-occ", po.calibrate_occs,
+                 "derive the three thresholds above from how often the k-mers of the index "
+                 "occur, raising them for highly redundant indices")
+        ->excludes(max_hit_occ_opt, max_hit_occ_recover_opt, max_read_occ_opt);
+    app.add_option("--early-exit", po.early_exit_hits,
+                   "approximate mapping: once a single target, in a single orientation, is "
+                   "consistent with this many hits of a read, accept it without checking the "
+                   "remaining hits, which could have left the read unmapped (0 = exact, check "
+                   "every hit)")
+        ->default_val(0);
+    app.add_option("--read-cache", po.read_cache_slots,
+                   "cache the mappings of up to this many distinct read sequences per thread, "
+                   "so that duplicate reads are mapped once (0 = no cache)")
+        ->default_val(0);
+    app.add_option("--kmer-cache", po.kmer_cache_entries,
+                   "cache the index lookups of up to this many k-mers per thread, so that the "
+                   "k-mers of highly expressed targets are looked up once (0 = no cache; not "
+                   "used with --interleave)")
+        ->default_val(0);
+    app.add_flag("--pseudoalign", po.pseudoalign,
+                 "assign each read to the targets shared by the contigs of all its hits "
+                 "(using the equivalence class table, if the index has one), rather than "
+                 "chaining the hits");
+    app.add_option("--mask-polya", po.mask_opts.min_polya_len,
+                   "mask poly-A tails and poly-T heads of the mapped reads at least this long "
+                   "before collecting their hits (0 = do not mask them)")
+        ->default_val(0);
+    app.add_option("--mask-homopolymer", po.mask_opts.min_homopolymer_len,
+                   "mask the runs of a single base at least this long in the mapped reads "
+                   "(0 = do not mask them)")
+        ->default_val(0);
+    auto mask_motif_opt =
+        app.add_option("--mask-motif", po.mask_opts.motifs,
+                       "mask the occurrences of this sequence (e.g. an adapter or the template "
+                       "switch oligo, of at most 64 bases), or of its reverse complement, in the "
+                       "mapped reads; may be given more than once");
+    app.add_option("--mask-motif-overlap", po.mask_opts.min_motif_overlap,
+                   "also mask the partial occurrences of a --mask-motif sequence at the ends of "
+                   "the reads that overlap them by at least this many bases")
+        ->needs(mask_motif_opt)
+        ->check(CLI::PositiveNumber)
+        ->default_val(8);
     app.add_flag("--quiet", po.quiet, "try to be quiet in terms of console output");
     auto check_ambig =
         app.add_flag("--check-ambig-hits", po.check_ambig_hits,
@@ -318,6 +484,17 @@ int run_pesc_sc(int argc, char** argv) {
         return 1;
     }
 
+    for (auto& motif : po.mask_opts.motifs) {
+        auto normalized = mapping::util::read_masker::normalize_motif(motif);
+        if (normalized.empty()) {
+            spdlog::critical("the --mask-motif sequence [{}] is not made of A, C, G and T only, "
+                             "or is longer than {} bases",
+                             motif, mapping::util::read_masker::max_motif_len);
+            return 1;
+        }
+        motif = normalized;
+    }
+
     // RAD file path
     ghc::filesystem::path output_path(po.output_dirname);
     ghc::filesystem::create_directories(output_path);
@@ -325,9 +502,6 @@ int run_pesc_sc(int argc, char** argv) {
     ghc::filesystem::path rad_file_path = output_path / "map.rad";
     ghc::filesystem::path unmapped_bc_file_path = output_path / "unmapped_bc_count.bin";
 
-    bool attempt_load_ec_map = po.check_ambig_hits;
-    mindex::reference_index ri(po.index_basename, attempt_load_ec_map);
-
     std::string cmdline;
     size_t narg = static_cast<size_t>(argc);
     for (size_t i = 0; i < narg; ++i) {
@@ -349,6 +523,38 @@ int run_pesc_sc(int argc, char** argv) {
         throw std::runtime_error("error creating output file.");
     }
 
+    // start parsing (and decompressing) the reads while the index loads
+    uint32_t np = 1;
+    if ((po.left_read_filenames.size() > 1) and (po.nthread >= 6)) {
+        np += 1;
+        po.nthread -= 1;
+    }
+
+    fastx_parser::FastxParser<fastx_parser::ReadPair> rparser(
+        po.left_read_filenames, po.right_read_filenames, po.nthread, np);
+    rparser.start();
+
+    // pseudoalignment uses the ec map if it was built, and the contig table otherwise
+    bool attempt_load_ec_map =
+        po.check_ambig_hits or
+        (po.pseudoalign and ghc::filesystem::exists(po.index_basename + ".ectab"));
+    std::unique_ptr<mindex::reference_index> ri_ptr;
+    try {
+        ri_ptr.reset(new mindex::reference_index(po.index_basename, attempt_load_ec_map));
+        if (po.calibrate_occs) {
+            po.occs = mapping::util::calibrate_occ_thresholds(*ri_ptr);
+            spdlog::info("occurrence thresholds: --max-hit-occ {} --max-hit-occ-recover {} "
+                         "--max-read-occ {}",
+                         po.occs.max_occ_default, po.occs.max_occ_recover,
+                         po.occs.max_read_occ);
+        }
+    } catch (...) {
+        // the parser threads only exit once the reads are consumed
+        mapping::util::drain_and_stop(rparser);
+        throw;
+    }
+    auto& ri = *ri_ptr;
+
     pesc_output_info out_info;
     out_info.rad_file = std::move(rad_file);
     out_info.unmapped_bc_file = std::move(unmapped_bc_file);
@@ -360,16 +566,6 @@ int run_pesc_sc(int argc, char** argv) {
     std::atomic<uint64_t> num_chunks{0};
     std::mutex iomut;
 
-    uint32_t np = 1;
-    if ((po.left_read_filenames.size() > 1) and (po.nthread >= 6)) {
-        np += 1;
-        po.nthread -= 1;
-    }
-
-    fastx_parser::FastxParser<fastx_parser::ReadPair> rparser(
-        po.left_read_filenames, po.right_read_filenames, po.nthread, np);
-    rparser.start();
-
     // set the k-mer size for the
     // CanonicalKmer type.
     CanonicalKmer::k(ri.k());
@@ -443,7 +639,16 @@ int run_pesc_sc(int argc, char** argv) {
     rs.cmd_line(cmdline);
     rs.num_reads(global_nr.load());
     rs.num_hits(global_nh.load());
+    rs.num_early_exits(out_info.num_early_exits.load());
+    rs.read_cache_stats(out_info.num_read_cache_lookups.load(),
+                        out_info.num_read_cache_hits.load());
+    if (po.mask_opts.enabled()) {
+        rs.read_mask_stats(out_info.num_reads_masked.load(), out_info.num_polya_bases_masked.load(),
+                           out_info.num_motif_bases_masked.load(),
+                           out_info.num_homopolymer_bases_masked.load());
+    }
     rs.num_seconds(num_sec.count());
+    rs.index_load_seconds(ri.load_seconds());
 
     ghc::filesystem::path map_info_file_path = output_path / "map_info.json";
     bool info_ok = piscem::meta_info::write_map_info(rs, map_info_file_path);
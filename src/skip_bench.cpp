@@ -0,0 +1,278 @@
+#include "../external/pthash/external/cmd_line_parser/include/parser.hpp"
+#include "../include/reference_index.hpp"
+#include "../include/mapping/utils.hpp"
+#include "../include/hit_searcher.hpp"
+#include "../include/FastxParser.hpp"
+#include "../include/json.hpp"
+#include "../include/spdlog/spdlog.h"
+#include "../include/spdlog/sinks/stdout_color_sinks.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <iomanip>
+#include <iostream>
+#include <tuple>
+#include <vector>
+
+/*
+    Compares the skipping strategies of the hit search on a set of (single-end) reads:
+    for each strategy, the number of index lookups and fast checks it makes per read,
+    the time it takes per read, and how its mappings agree with those of the
+    exhaustive search, which looks up every k-mer. With -i, the pasc search is also
+    run with the lookups of that many reads interleaved (as --interleave does).
+*/
+
+namespace {
+// every heap allocation of the process (see the replaced operator new below)
+std::atomic<uint64_t> num_heap_allocations{0};
+}  // namespace
+
+// Count the heap allocations, so that those made while mapping a read (by the
+// arena, but also by the raw hits and the accepted hits) are measured rather than
+// inferred. The array, nothrow and sized forms all defer to these two.
+void* operator new(std::size_t bytes) {
+    num_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(bytes ? bytes : 1)) { return p; }
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+
+namespace {
+
+// the (target, position, orientation) of the mappings of a read, sorted
+typedef std::vector<std::tuple<uint32_t, int32_t, bool>> read_mappings;
+
+struct strategy_run {
+    uint64_t num_lookups{0};
+    uint64_t num_fast_checks{0};
+    uint64_t num_raw_hits{0};
+    // lookups answered by the k-mer cache of the query (with -c), and not
+    uint64_t num_kmer_cache_hits{0};
+    uint64_t num_kmer_cache_misses{0};
+    // heap allocations made while mapping the reads, in all and over the second
+    // half of the reads (once the per-thread buffers have warmed up), and the part
+    // of them that are blocks of the scratch arena
+    uint64_t num_heap_allocations{0};
+    uint64_t num_late_heap_allocations{0};
+    uint64_t num_scratch_allocations{0};
+    double seconds{0.0};
+    std::vector<read_mappings> mappings;
+};
+
+strategy_run run_strategy(mindex::reference_index& ri, std::vector<std::string>& reads,
+                          mindex::skipping_policy const& policy, uint64_t kmer_cache_entries) {
+    strategy_run run;
+    mapping::util::mapping_cache_info map_cache(ri);
+    map_cache.hs.set_skipping_policy(policy);
+    map_cache.q.enable_kmer_cache(kmer_cache_entries);
+    run.mappings.resize(reads.size());
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < reads.size(); ++i) {
+        uint64_t allocations_before = num_heap_allocations.load(std::memory_order_relaxed);
+        mapping::util::map_read(&reads[i], map_cache);
+        uint64_t allocations =
+            num_heap_allocations.load(std::memory_order_relaxed) - allocations_before;
+        run.num_heap_allocations += allocations;
+        if (i >= reads.size() / 2) { run.num_late_heap_allocations += allocations; }
+        run.num_raw_hits += map_cache.hs.get_left_hits().size();
+        auto& m = run.mappings[i];
+        for (auto& ah : map_cache.accepted_hits) { m.emplace_back(ah.tid, ah.pos, ah.is_fw); }
+    }
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (auto& m : run.mappings) { std::sort(m.begin(), m.end()); }
+    run.num_lookups = map_cache.hs.num_lookups();
+    run.num_fast_checks = map_cache.hs.num_fast_checks();
+    run.num_kmer_cache_hits = map_cache.q.num_cache_hits();
+    run.num_kmer_cache_misses = map_cache.q.num_cache_misses();
+    run.num_scratch_allocations = map_cache.num_scratch_allocations();
+    return run;
+}
+
+// Maps the reads as run_strategy does, but with their hits collected by a
+// batched_hit_searcher of the given width, a read group at a time.
+strategy_run run_interleaved(mindex::reference_index& ri, std::vector<std::string>& reads,
+                             mindex::skipping_policy const& policy, size_t width) {
+    // the number of reads in a read group of the FastxParser
+    constexpr size_t group_size = 1000;
+    strategy_run run;
+    mapping::util::mapping_cache_info map_cache(ri);
+    map_cache.hs.set_skipping_policy(policy);
+    mindex::batched_hit_searcher bhs(&ri, width, policy);
+    run.mappings.resize(reads.size());
+
+    std::vector<std::string*> group;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t first = 0; first < reads.size(); first += group_size) {
+        size_t last = std::min(reads.size(), first + group_size);
+        group.clear();
+        for (size_t i = first; i < last; ++i) { group.push_back(&reads[i]); }
+        bhs.get_raw_hits_sketch(group);
+        for (size_t i = first; i < last; ++i) {
+            auto& hits = bhs.get_hits(i - first);
+            run.num_raw_hits += hits.size();
+            mapping::util::map_read(&reads[i], hits, map_cache);
+            auto& m = run.mappings[i];
+            for (auto& ah : map_cache.accepted_hits) { m.emplace_back(ah.tid, ah.pos, ah.is_fw); }
+        }
+    }
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (auto& m : run.mappings) { std::sort(m.begin(), m.end()); }
+    return run;
+}
+
+// the targets of the mappings of a read, sorted and without duplicates
+std::vector<uint32_t> targets(read_mappings const& m) {
+    std::vector<uint32_t> t;
+    for (auto& x : m) { t.push_back(std::get<0>(x)); }
+    t.erase(std::unique(t.begin(), t.end()), t.end());
+    return t;
+}
+
+nlohmann::json compare(strategy_run const& run, strategy_run const& exhaustive,
+                       uint64_t num_reads) {
+    uint64_t num_mapped = 0, num_identical = 0, num_same_targets = 0;
+    uint64_t num_found = 0, num_missed = 0, num_extra = 0;
+    for (size_t i = 0; i < num_reads; ++i) {
+        auto& m = run.mappings[i];
+        auto& e = exhaustive.mappings[i];
+        num_mapped += !m.empty();
+        num_identical += (m == e);
+        num_same_targets += (targets(m) == targets(e));
+        num_found += (!m.empty() and !e.empty());
+        num_missed += (m.empty() and !e.empty());
+        num_extra += (!m.empty() and e.empty());
+    }
+
+    double n = num_reads ? static_cast<double>(num_reads) : 1.0;
+    nlohmann::json j;
+    j["lookups_per_read"] = run.num_lookups / n;
+    j["fast_checks_per_read"] = run.num_fast_checks / n;
+    j["raw_hits_per_read"] = run.num_raw_hits / n;
+    if (run.num_kmer_cache_hits + run.num_kmer_cache_misses > 0) {
+        j["kmer_cache_hit_rate"] =
+            static_cast<double>(run.num_kmer_cache_hits) /
+            (run.num_kmer_cache_hits + run.num_kmer_cache_misses);
+    }
+    j["lookup_ratio_to_exhaustive"] =
+        exhaustive.num_lookups ? static_cast<double>(run.num_lookups) / exhaustive.num_lookups
+                               : 0.0;
+    j["ns_per_read"] = run.seconds * 1e9 / n;
+    j["heap_allocations"] = run.num_heap_allocations;
+    j["heap_allocations_second_half"] = run.num_late_heap_allocations;
+    j["scratch_arena_blocks"] = run.num_scratch_allocations;
+    j["num_mapped"] = num_mapped;
+    j["concordance"] = {
+        // reads with exactly the mappings of the exhaustive search
+        {"identical", num_identical / n},
+        // reads mapped to the same targets as by the exhaustive search
+        {"same_targets", num_same_targets / n},
+        // of the reads the exhaustive search maps, the fraction still mapped
+        {"sensitivity", (num_found + num_missed) ? static_cast<double>(num_found) /
+                                                        (num_found + num_missed)
+                                                  : 1.0},
+        // reads mapped only when skipping
+        {"num_extra_mapped", num_extra}};
+    return j;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::ios_base::sync_with_stdio(false);
+    cmd_line_parser::parser parser(argc, argv);
+
+    /* mandatory arguments */
+    parser.add("input_filename", "input index prefix.");
+    parser.add("reads", "Single-end reads (FASTA/FASTQ, possibly gzipped) to map.");
+
+    /* optional arguments */
+    parser.add("num_reads", "Maximum number of reads to map (default is 100000).", "-n", false);
+    parser.add("kmer_cache_entries",
+               "Cache the lookups of up to this many k-mers (default is 0, no cache).", "-c",
+               false);
+    parser.add("interleave",
+               "Also run the pasc search interleaving the lookups of this many reads.", "-i",
+               false);
+    parser.add("output_filename", "Write the report to this file rather than to stdout.", "-o",
+               false);
+    if (!parser.parse()) return 1;
+
+    // the report may go to stdout, so log to stderr
+    spdlog::drop_all();
+    auto logger = spdlog::create<spdlog::sinks::stderr_color_sink_mt>("");
+    logger->set_pattern("%+");
+    spdlog::set_default_logger(logger);
+
+    auto index_prefix = parser.get<std::string>("input_filename");
+    mindex::reference_index ri(index_prefix);
+    CanonicalKmer::k(ri.k());
+
+    uint64_t max_reads = parser.parsed("num_reads") ? parser.get<uint64_t>("num_reads") : 100000;
+    std::vector<std::string> reads;
+    uint64_t total_len = 0;
+    {
+        fastx_parser::FastxParser<fastx_parser::ReadSeq> rparser({parser.get<std::string>("reads")},
+                                                                 1);
+        rparser.start();
+        auto rg = rparser.getReadGroup();
+        while (reads.size() < max_reads and rparser.refill(rg)) {
+            for (auto& record : rg) {
+                if (reads.size() == max_reads) break;
+                total_len += record.seq.length();
+                reads.push_back(record.seq);
+            }
+        }
+        rparser.stop();
+    }
+    spdlog::info("mapping {} reads with each skipping strategy", reads.size());
+    uint64_t kmer_cache_entries =
+        parser.parsed("kmer_cache_entries") ? parser.get<uint64_t>("kmer_cache_entries") : 0;
+
+    nlohmann::json report;
+    report["num_reads"] = reads.size();
+    report["mean_read_length"] = reads.empty() ? 0.0 : static_cast<double>(total_len) / reads.size();
+
+    auto exhaustive = run_strategy(
+        ri, reads, mindex::skipping_policy(mindex::SkippingStrategy::EXHAUSTIVE), kmer_cache_entries);
+    for (auto& [name, strategy] : mindex::skipping_strategy_names()) {
+        if (strategy == mindex::SkippingStrategy::EXHAUSTIVE) {
+            report["strategies"][name] = compare(exhaustive, exhaustive, reads.size());
+            continue;
+        }
+        auto run = run_strategy(ri, reads, mindex::skipping_policy(strategy), kmer_cache_entries);
+        report["strategies"][name] = compare(run, exhaustive, reads.size());
+    }
+
+    uint64_t interleave = parser.parsed("interleave") ? parser.get<uint64_t>("interleave") : 1;
+    if (interleave > 1) {
+        // the lookups are not counted by the batched search
+        mindex::skipping_policy pasc(mindex::SkippingStrategy::PASC);
+        auto run = run_interleaved(ri, reads, pasc, interleave);
+        auto j = compare(run, exhaustive, reads.size());
+        j.erase("lookups_per_read");
+        j.erase("fast_checks_per_read");
+        j.erase("lookup_ratio_to_exhaustive");
+        j.erase("heap_allocations");
+        j.erase("heap_allocations_second_half");
+        j.erase("scratch_arena_blocks");
+        j["width"] = interleave;
+        report["interleaved"]["pasc"] = j;
+    }
+
+    if (parser.parsed("output_filename")) {
+        auto output_filename = parser.get<std::string>("output_filename");
+        std::ofstream out(output_filename);
+        out << std::setw(4) << report << std::endl;
+        if (!out.good()) {
+            spdlog::critical("could not write {}", output_filename);
+            return 1;
+        }
+    } else {
+        std::cout << std::setw(4) << report << std::endl;
+    }
+    return 0;
+}
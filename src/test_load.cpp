@@ -40,7 +40,7 @@ void check_index(mindex::reference_index& ri, const std::string& ref_fname ){
             }
             
             for (auto h : ref_hits.refRange) {
-                auto txp_id = sshash::util::transcript_id(h);
+                auto txp_id = ref_hits.transcript_id(h);
                 auto rp = ref_hits.decode_hit(h);
                 if ((txp_id == refnum) and 
                     (static_cast<int>(rp.pos) == kit->second) and 
@@ -60,10 +60,10 @@ void check_index(mindex::reference_index& ri, const std::string& ref_fname ){
                               //<< ", rawpos: " << h.pos_
                               << ", contig: " << ref_hits.contig_id() 
                               << ", clen: " << ref_hits.contigLen_ 
-                              << ", cstart: " << sshash::util::pos(h) 
+                              << ", cstart: " << ref_hits.codec_.pos(h) 
                               << ", coff: " << ref_hits.contigPos_
                               << ", cori: " << (ref_hits.contigOrientation_ ? "fw" : "rc")
-                              << ", ref: " << sshash::util::transcript_id(h) 
+                              << ", ref: " << ref_hits.transcript_id(h) 
                               << ", pos: " << rp.pos 
                               << ", ori: " << (rp.isFW ? "fw" : "rc") << "]\n";
                     std::exit(1);